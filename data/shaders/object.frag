@@ -2,7 +2,11 @@
 
 uniform vec4 illumination_color;
 
-uniform sampler2D diffuseTex;
+uniform sampler2DArray diffuseTex;
+
+// Set when diffuseTex holds palette indices, to look up in paletteTex.
+uniform bool palettized;
+uniform sampler2D paletteTex;
 
 in vec3 pos_viewspace;
 in vec3 n_viewspace;
@@ -18,7 +22,14 @@ out vec4 IlluminationData;
 
 void main()
 {
-    vec4 color = vec4(texture(diffuseTex, TexCoords.xy).rgb, 0.0);
+    vec4 color;
+    if(palettized)
+    {
+        int idx = int(texture(diffuseTex, TexCoords.xyz).r*255.0 + 0.5);
+        color = vec4(texelFetch(paletteTex, ivec2(idx, 0), 0).rgb, 0.0);
+    }
+    else
+        color = vec4(texture(diffuseTex, TexCoords.xyz).rgb, 0.0);
     vec4 nn = vec4(0.5, 0.5, 1.0, 1.0);
 
     mat3 nmat = mat3(normalize(t_viewspace),
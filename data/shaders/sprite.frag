@@ -4,6 +4,10 @@ uniform vec4 illumination_color;
 
 uniform sampler2D diffuseTex;
 
+// Set when diffuseTex holds palette indices, to look up in paletteTex.
+uniform bool palettized;
+uniform sampler2D paletteTex;
+
 in vec3 pos_viewspace;
 in vec3 n_viewspace;
 in vec3 t_viewspace;
@@ -18,7 +22,15 @@ out vec4 IlluminationData;
 
 void main()
 {
-    vec4 color = texture(diffuseTex, TexCoords.xy);
+    vec4 color;
+    if(palettized)
+    {
+        // Index 0 is transparent.
+        int idx = int(texture(diffuseTex, TexCoords.xy).r*255.0 + 0.5);
+        color = vec4(texelFetch(paletteTex, ivec2(idx, 0), 0).rgb, (idx == 0) ? 0.0 : 1.0);
+    }
+    else
+        color = texture(diffuseTex, TexCoords.xy);
     color.a = ((color.a < 0.5) ? 1.0 : 0.0);
     vec4 nn = vec4(0.5, 0.5, 1.0, 1.0);
 
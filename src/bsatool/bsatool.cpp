@@ -8,54 +8,464 @@
 #include <iomanip>
 #include <cstring>
 #include <array>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <cctype>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <algorithm>
+#include <random>
+#include <thread>
 
 #include "components/archives/bsaarchive.hpp"
+#include "components/archives/bsawriter.hpp"
+#include "components/archives/packarchive.hpp"
+#include "components/archives/packwriter.hpp"
+#include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/texformat.hpp"
+#include "components/dfosg/blockformat.hpp"
+
+#include "misc/binaryreader.hpp"
+#include "misc/threadpool.hpp"
 
 #ifdef _WIN32
 #include <direct.h>
+#include "components/vfs/dirent.h"
 #define mkdir(x,y) _mkdir(x)
 #define S_IRWXU 0
+// No symlinks to worry about.
+#define lstat stat
+#define S_ISLNK(m) 0
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
 #endif
 
 
-int main(int argc, char *argv[])
+namespace
 {
-    if(argc < 2)
+
+std::string base_name(const std::string &path)
+{
+    size_t pos = path.find_last_of("/\\");
+    return (pos == std::string::npos) ? path : path.substr(pos+1);
+}
+
+/* An archive entry, by name or (if the name is empty) ID, with its current
+ * file offset range.
+ */
+struct OrderItem {
+    std::string mName;
+    size_t mId;
+    uint64_t mStart, mEnd;
+
+    std::string key() const { return mName.empty() ? std::to_string(mId) : mName; }
+};
+
+/* Returns all of an archive's entries in the order they're stored. */
+std::vector<OrderItem> get_entries(const Archives::BsaArchive &archive)
+{
+    std::vector<OrderItem> items;
+    for(size_t id : archive.getIds())
     {
-        std::cerr<< "Usage: "<<argv[0]<<" [option]" <<std::endl
-                 << "  Available options:" <<std::endl
-                 << "    -e <archive.bsa>  - Extract files from BSA" <<std::endl
-                 <<std::endl;
-        return 1;
+        OrderItem item{std::string(), id, 0, 0};
+        if(archive.getRange(id, item.mStart, item.mEnd))
+            items.push_back(item);
+    }
+    for(const std::string &name : archive.list())
+    {
+        OrderItem item{name, 0, 0, 0};
+        if(archive.getRange(name.c_str(), item.mStart, item.mEnd))
+            items.push_back(item);
     }
+    std::sort(items.begin(), items.end(),
+        [](const OrderItem &lhs, const OrderItem &rhs) { return lhs.mStart < rhs.mStart; }
+    );
+    return items;
+}
 
-    const char *archname = nullptr;
-    for(int i = 1;i < argc;++i)
+/* Reads the entry names (or IDs) listed in an access trace, as written by
+ * the engine, skipping those recorded for other archives. A plain list of
+ * names or IDs, one per line, works too.
+ */
+std::vector<std::string> read_order(const char *fname, const char *archname)
+{
+    std::ifstream in(fname, std::ios_base::binary);
+    if(!in.is_open())
+        throw std::runtime_error(std::string("Failed to open ")+fname);
+
+    std::string archbase = base_name(archname);
+    std::vector<std::string> names;
+    std::string line;
+    while(std::getline(in, line))
     {
-        if(strcmp(argv[i], "-e") == 0)
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        size_t tab = line.find('\t');
+        if(tab == std::string::npos)
         {
-            if(argc-1 <= i)
-                throw std::runtime_error("Missing archive filename");
-            archname = argv[++i];
-            break;
+            names.push_back(line);
+            continue;
         }
+
+        std::string source = base_name(line.substr(0, tab));
+        if(source.length() != archbase.length() ||
+           strncasecmp(source.c_str(), archbase.c_str(), source.length()) != 0)
+            continue;
+        size_t tab2 = line.find('\t', tab+1);
+        names.push_back(line.substr(tab+1, tab2-tab-1));
+    }
+    return names;
+}
+
+/* Rewrites an archive with the entries listed in the trace first, in the
+ * order listed, followed by the rest in their original order.
+ */
+void reorder(const char *archname, const char *tracename, const char *outname)
+{
+    Archives::BsaArchive archive;
+    archive.load(archname, Archives::BsaArchive::IO_PRead);
+
+    std::vector<OrderItem> items = get_entries(archive);
+    std::unordered_map<std::string,size_t> lookup;
+    for(size_t i = 0;i < items.size();++i)
+        lookup[items[i].key()] = i;
+
+    std::vector<size_t> order;
+    std::vector<bool> used(items.size(), false);
+    for(const std::string &name : read_order(tracename, archname))
+    {
+        auto iter = lookup.find(name);
+        if(iter == lookup.end() || used[iter->second])
+            continue;
+        used[iter->second] = true;
+        order.push_back(iter->second);
+    }
+    size_t traced = order.size();
+    for(size_t i = 0;i < items.size();++i)
+    {
+        if(!used[i])
+            order.push_back(i);
+    }
+
+    Archives::BsaWriter writer(outname, archive.getIds().empty() ? Archives::BsaWriter::Type_Named :
+                                                                   Archives::BsaWriter::Type_Indexed);
+    std::vector<char> data;
+    for(size_t i : order)
+    {
+        const OrderItem &item = items[i];
+        Archives::IStreamPtr instream = item.mName.empty() ? archive.open(item.mId) :
+                                                             archive.open(item.mName.c_str());
+        data.resize(item.mEnd - item.mStart);
+        if(!instream || !instream->read(data.data(), data.size()))
+            throw std::runtime_error("Failed to read "+item.key()+" from "+archname);
+
+        if(item.mName.empty())
+            writer.add(item.mId, data.data(), data.size());
         else
-            throw std::runtime_error(std::string("Invalid option: ")+argv[i]);
+            writer.add(item.mName, data.data(), data.size());
     }
+    writer.finish();
 
-    if(!archname)
-        throw std::runtime_error("No input specified");
+    std::cout<< "Wrote "<<order.size()<<" entries to "<<outname<<", "<<traced<<" in trace order" <<std::endl;
+}
 
+/* Reads the entries listed in a trace, in order, from a cold cache, as the
+ * engine would when loading the location the trace was recorded for. Run it
+ * on an original and a reordered archive to compare their layouts.
+ */
+void benchmark_trace(const char *archname, const char *tracename)
+{
+    typedef std::chrono::steady_clock clock;
+
+    Archives::drop_file_cache(archname);
     Archives::BsaArchive archive;
-    archive.load(archname);
+    archive.load(archname, Archives::BsaArchive::IO_PRead);
 
-    const char *fname = strrchr(archname, '/');
-    if(fname) archname = fname+1;
-    fname = strrchr(archname, '\\');
-    if(!fname) fname = archname;
-    else ++fname;
+    std::unordered_map<std::string,OrderItem> lookup;
+    for(const OrderItem &item : get_entries(archive))
+        lookup[item.key()] = item;
+    std::vector<OrderItem> items;
+    for(const std::string &name : read_order(tracename, archname))
+    {
+        auto iter = lookup.find(name);
+        if(iter != lookup.end())
+            items.push_back(iter->second);
+    }
 
-    std::string dirname(fname);
+    // Count how often the next entry isn't where the previous one ended.
+    size_t jumps = 0;
+    for(size_t i = 1;i < items.size();++i)
+        jumps += (items[i].mStart != items[i-1].mEnd);
+
+    clock::time_point start = clock::now();
+    size_t total = 0;
+    std::vector<char> data;
+    for(const OrderItem &item : items)
+    {
+        Archives::IStreamPtr instream = item.mName.empty() ? archive.open(item.mId) :
+                                                             archive.open(item.mName.c_str());
+        data.resize(item.mEnd - item.mStart);
+        if(instream && instream->read(data.data(), data.size()))
+            total += data.size();
+    }
+    double ms = std::chrono::duration<double,std::milli>(clock::now() - start).count();
+
+    std::cout<< archname<<": "<<items.size()<<" traced entries ("<<total<<" bytes, "<<jumps<<
+                " discontiguous) in "<<ms<<"ms ("<<(total/1048.576/ms)<<" MB/s)" <<std::endl;
+}
+
+
+/* Adds the names of all files under path to names, relative to the top. */
+void list_files(const std::string &path, const std::string &pre, std::vector<std::string> &names)
+{
+    DIR *dir = opendir(path.c_str());
+    if(!dir) return;
+
+    dirent *ent;
+    while((ent=readdir(dir)) != nullptr)
+    {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        // Symlinked directories are left out, as they may lead back up the
+        // tree and recurse forever. Symlinked files are fine.
+        std::string fullpath = path+"/"+ent->d_name;
+        struct stat st;
+        if(lstat(fullpath.c_str(), &st) != 0)
+            continue;
+        if(S_ISLNK(st.st_mode) && (stat(fullpath.c_str(), &st) != 0 || S_ISDIR(st.st_mode)))
+            continue;
+        if(S_ISDIR(st.st_mode))
+            list_files(fullpath, pre+ent->d_name+"/", names);
+        else
+            names.push_back(pre+ent->d_name);
+    }
+    closedir(dir);
+}
+
+/* Converts a Daggerfall data directory into one pack archive. Entries of the
+ * named BSAs keep their names, and take precedence over loose files as they
+ * do in the engine. Entries of the ID-indexed archives are named
+ * "<ARCHIVE>/<ID>", and the BSAs themselves are left out.
+ */
+void make_pack(const char *dirname, const char *outname)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    static const char named[4][16] = {
+        "MAPS.BSA", "BLOCKS.BSA", "MONSTER.BSA", "MIDI.BSA"
+    };
+    static const char indexed[2][16] = {
+        "ARCH3D.BSA", "DAGGER.SND"
+    };
+
+    std::string root(dirname);
+    std::vector<std::string> files;
+    list_files(root, std::string(), files);
+
+    struct Source {
+        Archives::BsaArchive *mArchive;
+        std::string mName;
+        size_t mId;
+    };
+    std::vector<std::unique_ptr<Archives::BsaArchive>> archives;
+    std::map<std::string,Source> sources;
+    auto fold = [](std::string name)
+    {
+        for(char &c : name)
+            c = std::toupper(c);
+        return name;
+    };
+
+    std::set<std::string> archnames;
+    for(const char *name : named) archnames.insert(name);
+    for(const char *name : indexed) archnames.insert(name);
+    for(const std::string &file : files)
+    {
+        if(archnames.count(fold(file)) == 0)
+            sources[fold(file)] = Source{nullptr, file, 0};
+    }
+
+    auto load = [&archives, &root, &files, &fold](const char *name) -> Archives::BsaArchive*
+    {
+        for(const std::string &file : files)
+        {
+            if(fold(file) != name)
+                continue;
+            archives.emplace_back(new Archives::BsaArchive());
+            archives.back()->load(root+"/"+file, Archives::BsaArchive::IO_Mapped);
+            return archives.back().get();
+        }
+        std::cerr<< "Warning: "<<name<<" not found in "<<root <<std::endl;
+        return nullptr;
+    };
+    for(const char *name : named)
+    {
+        Archives::BsaArchive *archive = load(name);
+        if(!archive) continue;
+        for(const std::string &entry : archive->list())
+            sources[fold(entry)] = Source{archive, entry, 0};
+    }
+    for(const char *name : indexed)
+    {
+        Archives::BsaArchive *archive = load(name);
+        if(!archive) continue;
+        for(size_t id : archive->getIds())
+            sources[std::string(name)+"/"+std::to_string(id)] = Source{archive, std::string(), id};
+    }
+
+    std::vector<std::string> names;
+    names.reserve(sources.size());
+    for(const auto &source : sources)
+        names.push_back(source.second.mArchive && source.second.mName.empty() ? source.first :
+                        source.second.mName);
+
+    Archives::PackWriter writer(outname, names);
+    size_t total = 0;
+    std::vector<uint8_t> data;
+    for(const auto &item : sources)
+    {
+        const Source &source = item.second;
+        Archives::IStreamPtr instream;
+        if(!source.mArchive)
+            instream.reset(new std::ifstream(root+"/"+source.mName, std::ios_base::binary));
+        else if(source.mName.empty())
+            instream = source.mArchive->open(source.mId);
+        else
+            instream = source.mArchive->open(source.mName.c_str());
+        if(!instream || !instream->good())
+            throw std::runtime_error("Failed to open "+item.first);
+
+        data.clear();
+        std::array<char,65536> buf;
+        while(instream->read(buf.data(), buf.size()) || instream->gcount() > 0)
+            data.insert(data.end(), buf.data(), buf.data()+instream->gcount());
+        writer.add(data.data(), data.size(), true);
+        total += data.size();
+    }
+    writer.finish();
+
+    // Make sure the result loads.
+    Archives::PackArchive pack;
+    pack.load(outname);
+
+    double ms = std::chrono::duration<double,std::milli>(clock::now() - start).count();
+    std::cout<< "Packed "<<pack.list().size()<<" entries ("<<total<<" bytes, "<<writer.getCompressedCount()<<
+                " compressed) into "<<outname<<" in "<<ms<<"ms" <<std::endl;
+}
+
+
+/* Copies an entry's data range from the archive file to a new file. On Linux
+ * the copy stays in the kernel (copy_file_range, or sendfile where that
+ * isn't supported between the two files), otherwise it goes through pread.
+ * Returns the number of bytes written.
+ */
+#ifndef _WIN32
+uint64_t copy_range(int infd, uint64_t start, uint64_t end, const std::string &outname)
+{
+    int outfd = open(outname.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(outfd < 0)
+        throw std::runtime_error("Failed to open for writing");
+
+    off_t offset = start;
+    uint64_t total = 0;
+#ifdef __linux__
+    ssize_t copied;
+    while(total < end-start && (copied=copy_file_range(infd, &offset, outfd, nullptr, end-start-total, 0)) > 0)
+        total += copied;
+    if(total == 0)
+    {
+        while(total < end-start && (copied=sendfile(outfd, infd, &offset, end-start-total)) > 0)
+            total += copied;
+    }
+#endif
+    std::array<char,65536> buf;
+    while(total < end-start)
+    {
+        ssize_t got = pread(infd, buf.data(), std::min<uint64_t>(buf.size(), end-start-total), offset);
+        if(got <= 0 || write(outfd, buf.data(), got) != got)
+        {
+            close(outfd);
+            throw std::runtime_error("Failed after writing "+std::to_string(total)+" bytes");
+        }
+        offset += got;
+        total += got;
+    }
+
+    if(close(outfd) != 0)
+        throw std::runtime_error("Failed to close after writing "+std::to_string(total)+" bytes");
+    return total;
+}
+#else
+uint64_t copy_stream(std::istream &instream, const std::string &outname)
+{
+    std::ofstream outstream(outname.c_str(), std::ios_base::binary);
+    if(!outstream.is_open())
+        throw std::runtime_error("Failed to open for writing");
+
+    uint64_t total = 0;
+    std::array<char,65536> buf;
+    while(instream.read(buf.data(), buf.size()) || instream.gcount() > 0)
+    {
+        if(!outstream.write(buf.data(), instream.gcount()))
+            throw std::runtime_error("Failed after writing "+std::to_string(total)+" bytes");
+        total += instream.gcount();
+    }
+    return total;
+}
+#endif
+
+/* Runs func(i) for each i in [0, count) on the given number of threads,
+ * handing out indices in order so neighbouring entries are read together.
+ */
+template<typename F>
+void parallel_for(size_t jobs, size_t count, F func)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&next, count, &func]()
+    {
+        size_t i;
+        while((i=next++) < count)
+            func(i);
+    };
+    if(jobs <= 1)
+    {
+        worker();
+        return;
+    }
+
+    Misc::ThreadPool pool(jobs);
+    std::vector<std::future<void>> results;
+    for(size_t i = 0;i < pool.size();++i)
+        results.push_back(pool.submit(worker));
+    for(std::future<void> &result : results)
+        result.get();
+}
+
+/* Extracts all entries of an archive to a directory named after it, using
+ * the given number of threads. Returns the number of entries that failed.
+ */
+size_t extract(const char *archname, size_t jobs)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    Archives::BsaArchive archive;
+    archive.load(archname, Archives::BsaArchive::IO_PRead);
+
+    std::string dirname = base_name(archname);
     size_t pos = dirname.rfind('.');
     if(pos != std::string::npos)
         dirname[pos] = '_';
@@ -65,89 +475,577 @@ int main(int argc, char *argv[])
     if(mkdir(dirname.c_str(), S_IRWXU) != 0 && errno != EEXIST)
         throw std::runtime_error("Failed to create output dir "+dirname);
 
-    std::set<size_t> ids = archive.getIds();
-    for(size_t id : ids)
-    {
-        Archives::IStreamPtr instream = archive.open(id);
-        if(!instream)
-        {
-            std::cerr<< "Failed to open ID "<<id<<" in archive" <<std::endl;
-            continue;
-        }
+#ifndef _WIN32
+    int infd = open(archname, O_RDONLY);
+    if(infd < 0)
+        throw std::runtime_error(std::string("Failed to open ")+archname);
+#endif
 
+    std::vector<OrderItem> items = get_entries(archive);
+    std::mutex mutex;
+    std::atomic<uint64_t> total(0);
+    std::atomic<size_t> failed(0);
+    parallel_for(jobs, items.size(), [&](size_t i)
+    {
+        const OrderItem &item = items[i];
         std::stringstream sstr;
-        sstr<< dirname<<"/"<<std::setfill('0')<<std::setw(5)<<id;
+        sstr<< dirname<<"/";
+        if(item.mName.empty())
+            sstr<< std::setfill('0')<<std::setw(5)<<item.mId;
+        else
+            sstr<< item.mName;
         std::string ofname = sstr.str();
-        std::cout<< "Writing "<<ofname<<"... ";
-        std::cout.flush();
 
-        std::ofstream outstream(ofname.c_str(), std::ios_base::binary);
-        if(!outstream.is_open())
+        try {
+#ifndef _WIN32
+            uint64_t size = copy_range(infd, item.mStart, item.mEnd, ofname);
+#else
+            Archives::IStreamPtr instream = item.mName.empty() ? archive.open(item.mId) :
+                                                                 archive.open(item.mName.c_str());
+            if(!instream)
+                throw std::runtime_error("Failed to open in archive");
+            uint64_t size = copy_stream(*instream, ofname);
+#endif
+            total += size;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cout<< "Wrote "<<ofname<<" ("<<size<<" bytes)" <<std::endl;
+        }
+        catch(std::exception &e) {
+            ++failed;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cerr<< ofname<<": "<<e.what() <<std::endl;
+        }
+    });
+
+#ifndef _WIN32
+    close(infd);
+#endif
+
+    double ms = std::chrono::duration<double,std::milli>(clock::now() - start).count();
+    std::cout<< "Extracted "<<(items.size()-failed)<<" of "<<items.size()<<" entries ("<<total<<
+                " bytes) to "<<dirname<<" with "<<jobs<<" jobs in "<<ms<<"ms ("<<
+                (total/1048.576/ms)<<" MB/s)" <<std::endl;
+    return failed;
+}
+
+
+/* Checks a TEXTURE.nnn file using the engine's headers, and that each
+ * image's data lies within the file.
+ */
+void verify_texture(Misc::BinaryReader &reader)
+{
+    DFOSG::TexFileHeader hdr;
+    hdr.load(reader);
+
+    for(const DFOSG::TexEntryHeader &entryhdr : hdr.getHeaders())
+    {
+        if(entryhdr.getOffset() == 0)
+            continue;
+
+        reader.seek(entryhdr.getOffset());
+        DFOSG::TexHeader texhdr;
+        texhdr.load(reader);
+        if(texhdr.getFrameCount() == 0)
+            continue;
+
+        size_t base = entryhdr.getOffset() + texhdr.getDataOffset();
+        reader.seek(base);
+        if(texhdr.getCompression() != 0)
+            continue;
+        if(texhdr.getFrameCount() == 1)
         {
-            std::cerr<< "Failed to open for writing" <<std::endl;
+            // Rows are stored 256 bytes apart.
+            if(texhdr.getHeight() > 0)
+            {
+                reader.seek(base + (texhdr.getHeight()-1)*256);
+                reader.consume(texhdr.getWidth());
+            }
             continue;
         }
 
-        size_t total = 0;
-        while(!instream->eof())
+        std::vector<uint32_t> offsets(texhdr.getFrameCount());
+        reader.readArray(offsets.data(), offsets.size());
+        for(uint32_t offset : offsets)
         {
-            std::array<char,4096> buf;
-            instream->read(buf.data(), buf.size());
-            size_t got = instream->gcount();
+            reader.seek(base + offset);
+            reader.skip(4);
+        }
+    }
+}
+
+
+struct VerifyItem {
+    enum Type {
+        Type_Mesh,
+        Type_Block,
+        Type_Dungeon,
+        Type_Texture
+    };
+    Type mType;
+    Archives::BsaArchive *mArchive;
+    OrderItem mEntry;
+    std::string mPath;
+};
 
-            if(got > 0)
+bool has_extension(const std::string &name, const char *ext)
+{
+    size_t len = strlen(ext);
+    return name.length() >= len && strcasecmp(name.c_str()+name.length()-len, ext) == 0;
+}
+
+bool is_texture(const std::string &path)
+{
+    std::string name = base_name(path);
+    return name.length() == 11 && strncasecmp(name.c_str(), "TEXTURE.", 8) == 0 &&
+           isdigit(name[8]) && isdigit(name[9]) && isdigit(name[10]);
+}
+
+/* Adds the model, block, and dungeon entries of an archive for checking. */
+void add_archive(Archives::BsaArchive &archive, std::vector<VerifyItem> &items)
+{
+    bool meshes = strcasecmp(base_name(archive.getName()).c_str(), "ARCH3D.BSA") == 0;
+    for(const OrderItem &entry : get_entries(archive))
+    {
+        if(meshes && entry.mName.empty())
+            items.push_back(VerifyItem{VerifyItem::Type_Mesh, &archive, entry, std::string()});
+        else if(has_extension(entry.mName, ".RMB"))
+            items.push_back(VerifyItem{VerifyItem::Type_Block, &archive, entry, std::string()});
+        else if(has_extension(entry.mName, ".RDB"))
+            items.push_back(VerifyItem{VerifyItem::Type_Dungeon, &archive, entry, std::string()});
+    }
+}
+
+/* Parses all models, blocks, dungeons, and textures found in a data
+ * directory (or in a single archive or texture file), with the given number
+ * of threads. Returns the number of entries that failed.
+ */
+size_t verify(const char *path, size_t jobs)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    std::vector<std::string> files;
+    struct stat st;
+    if(stat(path, &st) != 0)
+        throw std::runtime_error(std::string("Failed to find ")+path);
+    if(S_ISDIR(st.st_mode))
+    {
+        list_files(path, std::string(path)+"/", files);
+        std::sort(files.begin(), files.end());
+    }
+    else
+        files.push_back(path);
+
+    std::vector<std::unique_ptr<Archives::BsaArchive>> archives;
+    std::vector<VerifyItem> items;
+    for(const std::string &file : files)
+    {
+        std::string name = base_name(file);
+        if(is_texture(file))
+            items.push_back(VerifyItem{VerifyItem::Type_Texture, nullptr, OrderItem(), file});
+        else if(has_extension(name, ".BSA"))
+        {
+            archives.emplace_back(new Archives::BsaArchive());
+            archives.back()->load(file, Archives::BsaArchive::IO_Mapped);
+            add_archive(*archives.back(), items);
+        }
+    }
+    clock::time_point loaded = clock::now();
+
+    static const char *const typenames[] = { "model", "block", "dungeon", "texture" };
+    std::mutex mutex;
+    std::array<std::atomic<size_t>,4> counts;
+    for(std::atomic<size_t> &count : counts)
+        count = 0;
+    std::atomic<uint64_t> total(0);
+    std::atomic<size_t> failed(0);
+    parallel_for(jobs, items.size(), [&](size_t i)
+    {
+        const VerifyItem &item = items[i];
+        std::string name = item.mArchive ? base_name(item.mArchive->getName())+"/"+item.mEntry.key() :
+                                           item.mPath;
+        try {
+            std::vector<char> data;
+            Archives::EntryView view;
+            bool have_view = false;
+            if(item.mArchive)
+            {
+                have_view = item.mEntry.mName.empty() ? item.mArchive->getView(item.mEntry.mId, view) :
+                                                        item.mArchive->getView(item.mEntry.mName.c_str(), view);
+                if(!have_view)
+                {
+                    Archives::IStreamPtr instream = item.mEntry.mName.empty() ?
+                        item.mArchive->open(item.mEntry.mId) :
+                        item.mArchive->open(item.mEntry.mName.c_str());
+                    data.resize(item.mEntry.mEnd - item.mEntry.mStart);
+                    if(!instream || !instream->read(data.data(), data.size()))
+                        throw std::runtime_error("Failed to read from archive");
+                }
+            }
+            else
+            {
+                std::ifstream instream(item.mPath.c_str(), std::ios_base::binary);
+                if(!instream.is_open())
+                    throw std::runtime_error("Failed to open");
+                data.assign(std::istreambuf_iterator<char>(instream), std::istreambuf_iterator<char>());
+            }
+            if(!have_view)
             {
-                if(!outstream.write(buf.data(), got))
+                view.mData = reinterpret_cast<const uint8_t*>(data.data());
+                view.mSize = data.size();
+            }
+
+            Misc::BinaryReader reader(view.mData, view.mSize);
+            switch(item.mType)
+            {
+                case VerifyItem::Type_Mesh:
+                {
+                    DFOSG::Mesh mesh;
+                    mesh.load(reader);
+                    break;
+                }
+                case VerifyItem::Type_Block:
+                {
+                    DFOSG::RmbFile rmb;
+                    rmb.load(reader);
+                    break;
+                }
+                case VerifyItem::Type_Dungeon:
+                {
+                    DFOSG::RdbFile rdb;
+                    rdb.load(reader);
+                    break;
+                }
+                case VerifyItem::Type_Texture:
+                    verify_texture(reader);
                     break;
-                total += got;
             }
+            ++counts[item.mType];
+            total += view.mSize;
         }
-        if(!outstream.good())
-            std::cerr<< "failed after writing "<<outstream.tellp()<<" bytes" <<std::endl;
-        else
-            std::cout<< "wrote "<<total<<" bytes" <<std::endl;
+        catch(std::exception &e) {
+            ++failed;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cerr<< name<<": "<<e.what() <<std::endl;
+        }
+    });
+
+    auto ms = [](clock::duration d) { return std::chrono::duration<double,std::milli>(d).count(); };
+    clock::time_point done = clock::now();
+    std::cout<< "Verified "<<(items.size()-failed)<<" of "<<items.size()<<" entries (";
+    for(size_t i = 0;i < counts.size();++i)
+        std::cout<< (i ? ", " : "")<<counts[i]<<" "<<typenames[i]<<"s";
+    std::cout<< ", "<<total<<" bytes) with "<<jobs<<" jobs in "<<ms(done-start)<<"ms (index "<<
+                ms(loaded-start)<<"ms, "<<(total/1048.576/ms(done-loaded))<<" MB/s)" <<std::endl;
+    return failed;
+}
+
+
+/* One set of measurements from bench(), for one read path and cache state. */
+struct BenchResult {
+    std::string mPath;
+    bool mCold;
+    double mIndexMs;
+    double mOpenUs;
+    double mOpenMaxUs;
+    double mSequentialMBs;
+    double mRandomMBs;
+    uint64_t mBytes;
+    uint32_t mChecksum;
+};
+
+/* Measures an archive through one I/O mode, reading entries through
+ * istreams, or through views into the mapping if views is set. Every byte
+ * read goes into the checksum either way, as a parser would use it. With
+ * cold set, the archive is dropped from the page cache before loading the
+ * index and before each read pass.
+ */
+BenchResult bench_path(const char *archname, Archives::BsaArchive::IOMode mode, bool views, bool cold)
+{
+    typedef std::chrono::steady_clock clock;
+    auto us = [](clock::duration d) { return std::chrono::duration<double,std::micro>(d).count(); };
+
+    static const char *const modenames[] = { "ifstream", "pread", "mmap" };
+    BenchResult result{std::string(modenames[mode])+(views ? "-view" : ""), cold, 0.0, 0.0, 0.0, 0.0, 0.0, 0, 0};
+
+    if(cold) Archives::drop_file_cache(archname);
+    clock::time_point start = clock::now();
+    Archives::BsaArchive archive;
+    archive.load(archname, mode);
+    result.mIndexMs = us(clock::now() - start) / 1000.0;
+    if(archive.getIOMode() != mode)
+        throw std::runtime_error(std::string(modenames[mode])+" is not supported here");
+
+    std::vector<OrderItem> items = get_entries(archive);
+    auto open_item = [&archive](const OrderItem &item) -> Archives::IStreamPtr
+    {
+        return item.mName.empty() ? archive.open(item.mId) : archive.open(item.mName.c_str());
+    };
+
+    if(!views && !items.empty())
+    {
+        double total = 0.0;
+        for(const OrderItem &item : items)
+        {
+            clock::time_point opened = clock::now();
+            Archives::IStreamPtr instream = open_item(item);
+            double time = us(clock::now() - opened);
+            if(!instream)
+                throw std::runtime_error("Failed to open "+item.key());
+            total += time;
+            result.mOpenMaxUs = std::max(result.mOpenMaxUs, time);
+        }
+        result.mOpenUs = total / items.size();
     }
 
-    std::set<std::string> files = archive.list();
-    for(const std::string &name : files)
+    auto consume = [&result](const uint8_t *data, size_t size)
+    {
+        uint32_t sum = result.mChecksum;
+        for(size_t i = 0;i < size;++i)
+            sum = sum*31 + data[i];
+        result.mChecksum = sum;
+    };
+    auto read_all = [&](const std::vector<OrderItem> &order) -> double
     {
-        Archives::IStreamPtr instream = archive.open(name.c_str());
-        if(!instream)
+        // The archive's own mapping has to let go of its pages too, or the
+        // mmap modes would read the first pass's pages again.
+        if(cold) archive.dropCache();
+        clock::time_point begin = clock::now();
+        uint64_t total = 0;
+        std::array<char,65536> buf;
+        for(const OrderItem &item : order)
         {
-            std::cerr<< "Failed to open "<<name<<" in archive" <<std::endl;
-            continue;
+            if(views)
+            {
+                Archives::EntryView view;
+                bool found = item.mName.empty() ? archive.getView(item.mId, view) :
+                                                  archive.getView(item.mName.c_str(), view);
+                if(!found)
+                    throw std::runtime_error("Failed to view "+item.key());
+                consume(view.mData, view.mSize);
+                total += view.mSize;
+                continue;
+            }
+            Archives::IStreamPtr instream = open_item(item);
+            if(!instream)
+                throw std::runtime_error("Failed to open "+item.key());
+            while(instream->read(buf.data(), buf.size()) || instream->gcount() > 0)
+            {
+                consume(reinterpret_cast<const uint8_t*>(buf.data()), instream->gcount());
+                total += instream->gcount();
+            }
         }
+        result.mBytes = total;
+        double secs = us(clock::now() - begin) / 1000000.0;
+        return (secs > 0.0) ? total/1048576.0/secs : 0.0;
+    };
+    result.mSequentialMBs = read_all(items);
 
-        std::string ofname = dirname+"/"+name;
-        std::cout<< "Writing "<<ofname<<"... ";
-        std::cout.flush();
+    std::vector<OrderItem> shuffled(items);
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(12345));
+    result.mRandomMBs = read_all(shuffled);
+
+    return result;
+}
 
-        std::ofstream outstream(ofname.c_str(), std::ios_base::binary);
-        if(!outstream.is_open())
+/* Measures index load time, open latency, and sequential and random read
+ * throughput over every entry of an archive, for each read path on a cold
+ * and a warm page cache. Prints a table, and writes the results as JSON to
+ * jsonname if given.
+ */
+void bench(const char *archname, const char *jsonname)
+{
+    static const struct {
+        Archives::BsaArchive::IOMode mMode;
+        bool mViews;
+    } paths[] = {
+        { Archives::BsaArchive::IO_Stream, false },
+        { Archives::BsaArchive::IO_PRead, false },
+        { Archives::BsaArchive::IO_Mapped, false },
+        { Archives::BsaArchive::IO_Mapped, true },
+    };
+
+    std::vector<BenchResult> results;
+    for(const auto &path : paths)
+    {
+        for(bool cold : { true, false })
         {
-            std::cerr<< "Failed to open for writing" <<std::endl;
-            continue;
+            try {
+                results.push_back(bench_path(archname, path.mMode, path.mViews, cold));
+            }
+            catch(std::exception &e) {
+                std::cerr<< "Skipping: "<<e.what() <<std::endl;
+                break;
+            }
         }
+    }
+
+    Archives::BsaArchive archive;
+    archive.load(archname, Archives::BsaArchive::IO_PRead);
+    size_t count = get_entries(archive).size();
+    uint64_t bytes = results.empty() ? 0 : results[0].mBytes;
+
+    std::cout<< archname<<": "<<count<<" entries, "<<bytes<<" bytes" <<std::endl;
+    std::cout<< std::left<<std::setw(12)<<"path"<<std::setw(7)<<"cache"<<std::right
+             <<std::setw(10)<<"index ms"<<std::setw(11)<<"open us"<<std::setw(11)<<"max us"
+             <<std::setw(12)<<"seq MB/s"<<std::setw(12)<<"rand MB/s" <<std::endl;
+    std::cout<< std::fixed<<std::setprecision(2);
+    for(const BenchResult &result : results)
+    {
+        std::cout<< std::left<<std::setw(12)<<result.mPath<<std::setw(7)<<(result.mCold ? "cold" : "warm")
+                 <<std::right<<std::setw(10)<<result.mIndexMs;
+        if(result.mOpenUs > 0.0)
+            std::cout<< std::setw(11)<<result.mOpenUs<<std::setw(11)<<result.mOpenMaxUs;
+        else
+            std::cout<< std::setw(11)<<"-"<<std::setw(11)<<"-";
+        std::cout<< std::setw(12)<<result.mSequentialMBs<<std::setw(12)<<result.mRandomMBs <<std::endl;
+    }
+    std::cout.unsetf(std::ios_base::floatfield);
 
-        size_t total = 0;
-        while(!instream->eof())
+    if(!jsonname)
+        return;
+
+    std::ofstream out(jsonname, std::ios_base::binary);
+    if(!out.is_open())
+        throw std::runtime_error(std::string("Failed to create ")+jsonname);
+
+    std::array<char,256> host{};
+#ifndef _WIN32
+    if(gethostname(host.data(), host.size()-1) != 0)
+        host[0] = 0;
+#endif
+    auto quote = [](const std::string &str)
+    {
+        std::string ret("\"");
+        for(char c : str)
         {
-            std::array<char,4096> buf;
-            instream->read(buf.data(), buf.size());
-            size_t got = instream->gcount();
+            if(c == '"' || c == '\\')
+                ret += '\\';
+            ret += c;
+        }
+        return ret + "\"";
+    };
+    out<< "{\n"
+       << "  \"archive\": "<<quote(base_name(archname))<<",\n"
+       << "  \"host\": "<<quote(host.data())<<",\n"
+       << "  \"threads\": "<<std::thread::hardware_concurrency()<<",\n"
+       << "  \"time\": "<<std::chrono::duration_cast<std::chrono::seconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count()<<",\n"
+       << "  \"entries\": "<<count<<",\n"
+       << "  \"bytes\": "<<bytes<<",\n"
+       << "  \"results\": [";
+    for(size_t i = 0;i < results.size();++i)
+    {
+        const BenchResult &result = results[i];
+        out<< (i ? "," : "")<<"\n    { \"path\": "<<quote(result.mPath)
+           <<", \"cache\": \""<<(result.mCold ? "cold" : "warm")<<"\""
+           <<", \"index_ms\": "<<result.mIndexMs
+           <<", \"open_us\": "<<result.mOpenUs
+           <<", \"open_max_us\": "<<result.mOpenMaxUs
+           <<", \"sequential_mbs\": "<<result.mSequentialMBs
+           <<", \"random_mbs\": "<<result.mRandomMBs
+           <<", \"checksum\": "<<result.mChecksum<<" }";
+    }
+    out<< "\n  ]\n}\n";
+    if(!out.good())
+        throw std::runtime_error(std::string("Failed to write ")+jsonname);
+    std::cout<< "Wrote "<<jsonname <<std::endl;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr<< "Usage: "<<argv[0]<<" [option]" <<std::endl
+                 << "  Available options:" <<std::endl
+                 << "    [-j N] -e <archive.bsa>  - Extract files from BSA, using N threads" <<std::endl
+                 << "    [-j N] -verify <arena2 dir|file>  - Parse all models, blocks, dungeons, and textures," <<std::endl
+                 << "                                        using N threads (default: one per core)" <<std::endl
+                 << "    bench <archive.bsa> [out.json]  - Measure index load, open latency, and sequential" <<std::endl
+                 << "                                      and random reads, on a cold and warm cache" <<std::endl
+                 << "    -b <archive.bsa> [trace]  - Same as bench, or read only the traced entries" <<std::endl
+                 << "                                from a cold cache" <<std::endl
+                 << "    -r <archive.bsa> <trace> <out.bsa>  - Rewrite the archive with the traced entries first" <<std::endl
+                 << "    -p <arena2 dir> <out.pack>  - Convert all data into one pack archive" <<std::endl
+                 <<std::endl;
+        return 1;
+    }
 
-            if(got > 0)
+    const char *archname = nullptr;
+    const char *tracename = nullptr;
+    const char *outname = nullptr;
+    char mode = 0;
+    size_t jobs = 0;
+    for(int i = 1;i < argc;++i)
+    {
+        if(strcmp(argv[i], "-j") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing job count");
+            jobs = std::max(1, atoi(argv[++i]));
+        }
+        else if(strcmp(argv[i], "bench") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing archive filename");
+            bench(argv[i+1], (i+2 < argc) ? argv[i+2] : nullptr);
+            return 0;
+        }
+        else if(strcmp(argv[i], "-verify") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing data directory or filename");
+            return verify(argv[i+1], jobs ? jobs : Misc::ThreadPool::defaultSize()) ? 1 : 0;
+        }
+        else if(strcmp(argv[i], "-p") == 0)
+        {
+            if(argc-3 < i)
+                throw std::runtime_error("Missing data directory or output filename");
+            make_pack(argv[i+1], argv[i+2]);
+            return 0;
+        }
+        else if(strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-r") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing archive filename");
+            mode = argv[i][1];
+            archname = argv[++i];
+            if(mode == 'b' && i < argc-1)
+                tracename = argv[++i];
+            else if(mode == 'r')
             {
-                if(!outstream.write(buf.data(), got))
-                    break;
-                total += got;
+                if(argc-3 < i)
+                    throw std::runtime_error("Missing trace or output filename");
+                tracename = argv[++i];
+                outname = argv[++i];
             }
+            break;
         }
-        if(!outstream.good())
-            std::cerr<< "failed after writing "<<outstream.tellp()<<" bytes" <<std::endl;
         else
-            std::cout<< "wrote "<<total<<" bytes" <<std::endl;
+            throw std::runtime_error(std::string("Invalid option: ")+argv[i]);
+    }
+
+    if(!archname)
+        throw std::runtime_error("No input specified");
+
+    if(mode == 'r')
+    {
+        reorder(archname, tracename, outname);
+        return 0;
+    }
+    if(mode == 'b' && tracename)
+    {
+        benchmark_trace(archname, tracename);
+        return 0;
+    }
+    if(mode == 'b')
+    {
+        bench(archname, nullptr);
+        return 0;
     }
 
-    return 0;
+    return extract(archname, jobs ? jobs : 1) ? 1 : 0;
 }
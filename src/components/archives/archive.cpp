@@ -1,12 +1,25 @@
 
 #include "archive.hpp"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdexcept>
+#include <cerrno>
+
 
 namespace Archives
 {
 
-ConstrainedFileStreamBuf::ConstrainedFileStreamBuf(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end)
-  : mStart(start), mEnd(end), mFile(std::move(file))
+ConstrainedFileStreamBuf::ConstrainedFileStreamBuf(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end, IOStats *stats)
+  : mStart(start), mEnd(end), mFile(std::move(file)), mStats(stats)
 {
 }
 ConstrainedFileStreamBuf::~ConstrainedFileStreamBuf()
@@ -20,6 +33,11 @@ ConstrainedFileStreamBuf::int_type ConstrainedFileStreamBuf::underflow()
         std::streamsize toread = std::min<std::streamsize>(mEnd-mFile->tellg(), mBuffer.size());
         mFile->read(mBuffer.data(), toread);
         setg(mBuffer.data(), mBuffer.data(), mBuffer.data()+mFile->gcount());
+        if(mStats)
+        {
+            ++mStats->mReads;
+            mStats->mBytes += mFile->gcount();
+        }
     }
     if(gptr() == egptr())
         return traits_type::eof();
@@ -52,6 +70,8 @@ ConstrainedFileStreamBuf::pos_type ConstrainedFileStreamBuf::seekoff(off_type of
     if(newPos < mStart || newPos > mEnd)
         return traits_type::eof();
 
+    if(mStats && !(whence == std::ios_base::cur && offset == 0))
+        ++mStats->mSeeks;
     if(!mFile->seekg(newPos))
         return traits_type::eof();
 
@@ -69,6 +89,8 @@ ConstrainedFileStreamBuf::pos_type ConstrainedFileStreamBuf::seekpos(pos_type po
     if(pos < 0 || pos > (mEnd-mStart))
         return traits_type::eof();
 
+    if(mStats)
+        ++mStats->mSeeks;
     if(!mFile->seekg(pos + mStart))
         return traits_type::eof();
 
@@ -79,4 +101,278 @@ ConstrainedFileStreamBuf::pos_type ConstrainedFileStreamBuf::seekpos(pos_type po
 }
 
 
+
+#ifdef _WIN32
+FileHandle::FileHandle(const std::string &fname)
+{
+    mHandle = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(mHandle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open "+fname);
+}
+
+FileHandle::~FileHandle()
+{
+    CloseHandle(mHandle);
+}
+
+size_t FileHandle::read(void *buf, size_t size, uint64_t offset) const
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        OVERLAPPED ov{};
+        ov.Offset = DWORD(offset+total);
+        ov.OffsetHigh = DWORD((offset+total) >> 32);
+        DWORD toread = DWORD(std::min<size_t>(size-total, 0x40000000));
+        DWORD got = 0;
+        if(!ReadFile(mHandle, static_cast<char*>(buf)+total, toread, &got, &ov) || got == 0)
+            break;
+        total += got;
+    }
+    return total;
+}
+
+void FileHandle::prefetch(uint64_t, uint64_t) const
+{
+}
+
+uint64_t FileHandle::size() const
+{
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mHandle, &size))
+        return 0;
+    return size.QuadPart;
+}
+#else
+FileHandle::FileHandle(const std::string &fname)
+{
+    mFd = ::open(fname.c_str(), O_RDONLY);
+    if(mFd < 0)
+        throw std::runtime_error("Failed to open "+fname);
+}
+
+FileHandle::~FileHandle()
+{
+    ::close(mFd);
+}
+
+size_t FileHandle::read(void *buf, size_t size, uint64_t offset) const
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        ssize_t got = pread(mFd, static_cast<char*>(buf)+total, size-total, offset+total);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            break;
+        total += got;
+    }
+    return total;
+}
+
+void FileHandle::prefetch(uint64_t offset, uint64_t size) const
+{
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(mFd, offset, size, POSIX_FADV_WILLNEED);
+#else
+    (void)offset; (void)size;
+#endif
+}
+
+uint64_t FileHandle::size() const
+{
+    struct stat st;
+    if(fstat(mFd, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+#endif
+
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &fname)
+  : mData(nullptr), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(nullptr)
+{
+    mFile = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(mFile == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open "+fname);
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mFile, &size))
+    {
+        CloseHandle(mFile);
+        throw std::runtime_error("Failed to get size of "+fname);
+    }
+    mSize = size.QuadPart;
+    if(mSize == 0)
+        return;
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mMapping)
+        mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if(!mData)
+    {
+        if(mMapping) CloseHandle(mMapping);
+        CloseHandle(mFile);
+        throw std::runtime_error("Failed to map "+fname);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if(mData) UnmapViewOfFile(mData);
+    if(mMapping) CloseHandle(mMapping);
+    if(mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+}
+
+void MappedFile::releasePages() const
+{
+}
+
+void MappedFile::prefetch(size_t, size_t) const
+{
+}
+
+void drop_file_cache(const std::string&)
+{
+}
+
+void prefetch_file(const std::string&, uint64_t, uint64_t)
+{
+}
+#else
+MappedFile::MappedFile(const std::string &fname)
+  : mData(nullptr), mSize(0)
+{
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("Failed to open "+fname);
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to get size of "+fname);
+    }
+    mSize = st.st_size;
+    if(mSize == 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    void *ptr = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping holds its own reference to the file.
+    ::close(fd);
+    if(ptr == MAP_FAILED)
+        throw std::runtime_error("Failed to map "+fname);
+    mData = static_cast<const uint8_t*>(ptr);
+}
+
+MappedFile::~MappedFile()
+{
+    if(mData)
+        munmap(const_cast<uint8_t*>(mData), mSize);
+}
+
+void MappedFile::releasePages() const
+{
+    if(mData)
+        madvise(const_cast<uint8_t*>(mData), mSize, MADV_DONTNEED);
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+    if(!mData || offset >= mSize)
+        return;
+    size = std::min(size, mSize-offset);
+
+    // madvise needs a page-aligned start.
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t start = offset - offset%pagesize;
+    madvise(const_cast<uint8_t*>(mData)+start, size+(offset-start), MADV_WILLNEED);
+}
+
+void drop_file_cache(const std::string &fname)
+{
+#ifdef POSIX_FADV_DONTNEED
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    (void)fname;
+#endif
+}
+
+void prefetch_file(const std::string &fname, uint64_t offset, uint64_t size)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    (void)fname; (void)offset; (void)size;
+#endif
+}
+#endif
+
+
+MemoryStreamBuf::MemoryStreamBuf(const uint8_t *data, size_t size, IOStats *stats)
+  : mStats(stats)
+{
+    // The get area is never written to, so casting away const is safe.
+    char *ptr = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+    setg(ptr, ptr, ptr+size);
+}
+
+std::streamsize MemoryStreamBuf::xsgetn(char_type *s, std::streamsize count)
+{
+    count = std::min<std::streamsize>(count, egptr()-gptr());
+    std::copy(gptr(), gptr()+count, s);
+    gbump(count);
+    if(mStats)
+        mStats->mBytes += count;
+    return count;
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode)
+{
+    if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+        return traits_type::eof();
+
+    off_type newPos;
+    switch(whence)
+    {
+        case std::ios_base::beg:
+            newPos = offset;
+            break;
+        case std::ios_base::cur:
+            newPos = offset + (gptr()-eback());
+            break;
+        case std::ios_base::end:
+            newPos = offset + (egptr()-eback());
+            break;
+        default:
+            return traits_type::eof();
+    }
+
+    if(newPos < 0 || newPos > (egptr()-eback()))
+        return traits_type::eof();
+    if(mStats && newPos != gptr()-eback())
+        ++mStats->mSeeks;
+
+    setg(eback(), eback()+newPos, egptr());
+    return newPos;
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode mode)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, mode);
+}
+
 } // namespace Archives
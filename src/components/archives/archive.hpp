@@ -6,6 +6,9 @@
 #include <memory>
 #include <array>
 #include <set>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 
 
 namespace Archives
@@ -31,15 +34,40 @@ inline uint16_t read_le16(std::istream &stream)
 }
 
 
+/* I/O counters of an archive, updated by its streams from any thread. Reads
+ * are calls into the OS, and bytes are what the streams handed out (or for
+ * file-backed streams, what they read from the file). Seeks only count
+ * repositioning, not position queries.
+ */
+struct IOStats {
+    std::atomic<uint64_t> mOpens;
+    std::atomic<uint64_t> mReads;
+    std::atomic<uint64_t> mBytes;
+    std::atomic<uint64_t> mSeeks;
+
+    IOStats() : mOpens(0), mReads(0), mBytes(0), mSeeks(0) { }
+
+    void reset()
+    {
+        mOpens = 0;
+        mReads = 0;
+        mBytes = 0;
+        mSeeks = 0;
+    }
+};
+
+
 class ConstrainedFileStreamBuf : public std::streambuf {
     std::streamsize mStart, mEnd;
 
     std::unique_ptr<std::istream> mFile;
+    IOStats *mStats;
 
     std::array<char,4096> mBuffer;
 
 public:
-    ConstrainedFileStreamBuf(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end);
+    ConstrainedFileStreamBuf(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end,
+                             IOStats *stats=nullptr);
     ~ConstrainedFileStreamBuf();
 
     virtual int_type underflow();
@@ -50,8 +78,9 @@ public:
 
 class ConstrainedFileStream : public std::istream {
 public:
-    ConstrainedFileStream(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end)
-        : std::istream(new ConstrainedFileStreamBuf(std::move(file), start, end))
+    ConstrainedFileStream(std::unique_ptr<std::istream> file, std::streamsize start, std::streamsize end,
+                          IOStats *stats=nullptr)
+        : std::istream(new ConstrainedFileStreamBuf(std::move(file), start, end, stats))
     {
     }
 
@@ -62,12 +91,271 @@ public:
 };
 
 
+/* A read-only file handle that can be shared by many streams. Reads are
+ * positional, so streams (even on different threads) don't disturb each
+ * other's file position.
+ */
+class FileHandle {
+#ifdef _WIN32
+    void *mHandle;
+#else
+    int mFd;
+#endif
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+public:
+    FileHandle(const std::string &fname);
+    ~FileHandle();
+
+    /* Reads up to size bytes from the given file offset. Returns the number
+     * of bytes read, which is only short at the end of the file or on error.
+     */
+    size_t read(void *buf, size_t size, uint64_t offset) const;
+
+    /* Asks the OS to start reading the given range into its cache. */
+    void prefetch(uint64_t offset, uint64_t size) const;
+
+    uint64_t size() const;
+};
+typedef std::shared_ptr<FileHandle> FileHandlePtr;
+
+/* Reads the range [start, end) of a shared file handle, through a buffer of
+ * BufSize bytes held in the stream buffer itself.
+ */
+template<size_t BufSize>
+class PReadStreamBuf : public std::streambuf {
+    FileHandlePtr mFile;
+    IOStats *mStats;
+
+    std::streamsize mStart, mEnd;
+    // File offset just past the end of the buffered data.
+    std::streamsize mPos;
+
+    std::array<char,BufSize> mBuffer;
+
+    std::streamsize tell() const { return mPos - (egptr()-gptr()); }
+
+    size_t readFile(char *dst, size_t count)
+    {
+        size_t got = mFile->read(dst, count, mPos);
+        mPos += got;
+        if(mStats)
+        {
+            ++mStats->mReads;
+            mStats->mBytes += got;
+        }
+        return got;
+    }
+
+public:
+    PReadStreamBuf(FileHandlePtr file, std::streamsize start, std::streamsize end, IOStats *stats=nullptr)
+      : mFile(std::move(file)), mStats(stats), mStart(start), mEnd(end), mPos(start)
+    {
+    }
+
+    virtual int_type underflow()
+    {
+        if(gptr() == egptr() && mPos < mEnd)
+        {
+            size_t toread = std::min<std::streamsize>(mEnd-mPos, mBuffer.size());
+            size_t got = readFile(mBuffer.data(), toread);
+            setg(mBuffer.data(), mBuffer.data(), mBuffer.data()+got);
+        }
+        if(gptr() == egptr())
+            return traits_type::eof();
+
+        return traits_type::to_int_type(*gptr());
+    }
+
+    virtual std::streamsize xsgetn(char_type *s, std::streamsize count)
+    {
+        std::streamsize total = std::min<std::streamsize>(egptr()-gptr(), count);
+        std::copy(gptr(), gptr()+total, s);
+        gbump(total);
+
+        // Large reads skip the buffer and go right into the destination. The
+        // buffer no longer ends at mPos after that, so it's dropped.
+        if(count-total >= (std::streamsize)mBuffer.size())
+        {
+            size_t toread = std::min<std::streamsize>(mEnd-mPos, count-total);
+            setg(0, 0, 0);
+            return total + readFile(s+total, toread);
+        }
+        if(total < count)
+            total += std::streambuf::xsgetn(s+total, count-total);
+        return total;
+    }
+
+    virtual pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode)
+    {
+        if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+            return traits_type::eof();
+
+        std::streamsize newPos;
+        switch(whence)
+        {
+            case std::ios_base::beg:
+                newPos = offset + mStart;
+                break;
+            case std::ios_base::cur:
+                newPos = offset + tell();
+                break;
+            case std::ios_base::end:
+                newPos = offset + mEnd;
+                break;
+            default:
+                return traits_type::eof();
+        }
+
+        if(newPos < mStart || newPos > mEnd)
+            return traits_type::eof();
+        if(mStats && newPos != tell())
+            ++mStats->mSeeks;
+
+        // Keep the buffered data if the new position is within it.
+        if(newPos >= mPos-(egptr()-eback()) && newPos <= mPos)
+            setg(eback(), egptr()-(mPos-newPos), egptr());
+        else
+        {
+            mPos = newPos;
+            setg(0, 0, 0);
+        }
+
+        return newPos - mStart;
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode mode)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, mode);
+    }
+};
+
+template<size_t BufSize>
+struct PReadStreamBufHolder {
+    PReadStreamBuf<BufSize> mStreamBuf;
+
+    PReadStreamBufHolder(FileHandlePtr&& file, std::streamsize start, std::streamsize end, IOStats *stats)
+      : mStreamBuf(std::move(file), start, end, stats)
+    { }
+};
+
+/* The stream buffer is a (base) member so the whole stream is one object, and
+ * creating it with std::make_shared needs no other allocations.
+ */
+template<size_t BufSize=4096>
+class PReadStream : private PReadStreamBufHolder<BufSize>, public std::istream {
+public:
+    PReadStream(FileHandlePtr file, std::streamsize start, std::streamsize end, IOStats *stats=nullptr)
+      : PReadStreamBufHolder<BufSize>(std::move(file), start, end, stats)
+      , std::istream(&this->mStreamBuf)
+    {
+    }
+};
+
+
+/* A read-only memory mapping of a whole file. */
+class MappedFile {
+    const uint8_t *mData;
+    size_t mSize;
+#ifdef _WIN32
+    void *mFile;
+    void *mMapping;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+    MappedFile(const std::string &fname);
+    ~MappedFile();
+
+    const uint8_t *data() const { return mData; }
+    size_t size() const { return mSize; }
+
+    /* Releases this process's mapped pages, so they may be dropped from the
+     * OS cache. They are faulted back in on the next access.
+     */
+    void releasePages() const;
+
+    /* Asks the OS to start paging in the given range of the mapping. */
+    void prefetch(size_t offset, size_t size) const;
+};
+typedef std::shared_ptr<MappedFile> MappedFilePtr;
+
+/* Asks the OS to drop its cached pages of the named file, so the next reads
+ * come from the disk. Pages still mapped by a process are kept. Does nothing
+ * where unsupported.
+ */
+void drop_file_cache(const std::string &fname);
+
+/* Asks the OS to start reading the given range of the named file into its
+ * cache, without waiting for it. A size of 0 means the rest of the file. Does
+ * nothing where unsupported.
+ */
+void prefetch_file(const std::string &fname, uint64_t offset, uint64_t size);
+
+
+class MemoryStreamBuf : public std::streambuf {
+    IOStats *mStats;
+
+public:
+    MemoryStreamBuf(const uint8_t *data, size_t size, IOStats *stats=nullptr);
+
+    virtual std::streamsize xsgetn(char_type *s, std::streamsize count);
+
+    virtual pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode mode);
+};
+
+/* Reads directly out of memory, with an optional mapping kept alive for as
+ * long as the stream is.
+ */
+class MemoryStream : public std::istream {
+    MappedFilePtr mMapping;
+
+public:
+    MemoryStream(const uint8_t *data, size_t size, MappedFilePtr mapping=MappedFilePtr(),
+                 IOStats *stats=nullptr)
+        : std::istream(new MemoryStreamBuf(data, size, stats)), mMapping(std::move(mapping))
+    {
+    }
+
+    ~MemoryStream()
+    {
+        delete rdbuf();
+    }
+};
+
+
 class Archive {
+protected:
+    mutable IOStats mStats;
+
 public:
     virtual ~Archive() { }
+
+    IOStats &getStats() const { return mStats; }
+
     virtual IStreamPtr open(const char *name) = 0;
     virtual bool exists(const char *name) const = 0;
     virtual const std::set<std::string> &list() const = 0;
+    // The name the archive is reported by, usually its filename.
+    virtual const std::string &getName() const = 0;
+
+    /* Drops the archive's file data from the OS cache, for cold-cache
+     * measurements.
+     */
+    virtual void dropCache() { }
+
+    /* Retrieves the file offset range [start, end) of the named entry, for
+     * access traces. Returns false if unknown.
+     */
+    virtual bool getRange(const char *name, uint64_t &start, uint64_t &end) const
+    { return false; }
+    /* Asks the OS to start reading the given range of the archive's file. */
+    virtual void prefetch(uint64_t start, uint64_t end) const { }
 };
 
 } // namespace Archives
@@ -3,6 +3,7 @@
 
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 
 
 namespace Archives
@@ -27,18 +28,40 @@ void BsaArchive::loadIndexed(size_t count, std::istream &stream)
     if(!stream.good())
         throw std::runtime_error("Failed reading archive footer");
 
-    for(size_t id : idxs)
+    // Sort by ID, keeping the footer order for duplicates so the last one
+    // takes precedence.
+    std::vector<size_t> order(count);
+    for(size_t i = 0;i < count;++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+        [&idxs](size_t lhs, size_t rhs) { return idxs[lhs] < idxs[rhs]; }
+    );
+
+    mIds.reserve(count);
+    mEntries.reserve(count);
+    for(size_t i : order)
     {
-        if(!mLookupId.insert(id).second)
+        if(!mIds.empty() && mIds.back() == idxs[i])
         {
 #if 0
-            std::cerr<< "Duplicate entry ID "<<std::to_string(id)<<" in "+mFilename <<std::endl;
+            std::cerr<< "Duplicate entry ID "<<std::to_string(idxs[i])<<" in "+mFilename <<std::endl;
 #endif
+            mEntries.back() = entries[i];
+            continue;
         }
+        mIds.push_back(idxs[i]);
+        mEntries.push_back(entries[i]);
+    }
+    mLookupId.insert(mIds.begin(), mIds.end());
+
+    // Archive IDs are typically small enough that a direct table is cheaper
+    // than searching.
+    if(!mIds.empty() && (mIds.back() < 65536 || mIds.back()/8 < mIds.size()))
+    {
+        mIdIndex.assign(mIds.back()+1, 0);
+        for(size_t i = 0;i < mIds.size();++i)
+            mIdIndex[mIds[i]] = i+1;
     }
-    mEntries.resize(mLookupId.size());
-    for(size_t i = 0;i < count;++i)
-        mEntries[std::distance(mLookupId.begin(), mLookupId.find(idxs[i]))] = entries[i];
 }
 
 void BsaArchive::loadNamed(size_t count, std::istream& stream)
@@ -68,28 +91,60 @@ void BsaArchive::loadNamed(size_t count, std::istream& stream)
     if(!stream.good())
         throw std::runtime_error("Failed reading archive footer");
 
-    for(const std::string &name : names)
+    std::vector<size_t> order(count);
+    for(size_t i = 0;i < count;++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+        [&names](size_t lhs, size_t rhs) { return names[lhs] < names[rhs]; }
+    );
+
+    mNames.reserve(count);
+    mEntries.reserve(count);
+    for(size_t i : order)
     {
-        if(!mLookupName.insert(name).second)
-            throw std::runtime_error("Duplicate entry name \""+name+"\" in "+mFilename);
+        if(!mNames.empty() && mNames.back() == names[i])
+            throw std::runtime_error("Duplicate entry name \""+names[i]+"\" in "+mFilename);
+        mNames.push_back(std::move(names[i]));
+        mEntries.push_back(entries[i]);
     }
-    mEntries.resize(mLookupName.size());
-    for(size_t i = 0;i < count;++i)
-        mEntries[std::distance(mLookupName.begin(), mLookupName.find(names[i]))] = entries[i];
+    mLookupName.insert(mNames.begin(), mNames.end());
 }
 
-void BsaArchive::load(const std::string &fname)
+void BsaArchive::load(const std::string &fname, IOMode mode)
 {
     mFilename = fname;
+    mFile = nullptr;
+    mMapping = nullptr;
 
-    std::ifstream stream(mFilename.c_str(), std::ios::binary);
-    if(!stream.is_open())
-        throw std::runtime_error("Failed to open "+mFilename);
+    if(mode == IO_Mapped)
+    {
+        try {
+            mMapping = std::make_shared<MappedFile>(mFilename);
+        }
+        catch(std::exception&) {
+            // Fall back to positional reads
+            mode = IO_PRead;
+        }
+    }
+    if(mode == IO_PRead)
+        mFile = std::make_shared<FileHandle>(mFilename);
+
+    std::unique_ptr<std::istream> file;
+    if(mMapping)
+        file.reset(new MemoryStream(mMapping->data(), mMapping->size()));
+    else if(mFile)
+        file.reset(new PReadStream<>(mFile, 0, mFile->size()));
+    else
+    {
+        file.reset(new std::ifstream(mFilename.c_str(), std::ios::binary));
+        if(!static_cast<std::ifstream*>(file.get())->is_open())
+            throw std::runtime_error("Failed to open "+mFilename);
+    }
+    std::istream &stream = *file;
 
     size_t count = read_le16(stream);
     int type = read_le16(stream);
 
-    mEntries.reserve(count);
     if(type == 0x0100)
         loadNamed(count, stream);
     else if(type == 0x0200)
@@ -102,33 +157,127 @@ void BsaArchive::load(const std::string &fname)
     }
 }
 
+const BsaArchive::Entry *BsaArchive::findEntry(const char *name) const
+{
+    auto iter = std::lower_bound(mNames.begin(), mNames.end(), name,
+        [](const std::string &lhs, const char *rhs) { return lhs.compare(rhs) < 0; }
+    );
+    if(iter == mNames.end() || iter->compare(name) != 0)
+        return nullptr;
+    return &mEntries[std::distance(mNames.begin(), iter)];
+}
+
+const BsaArchive::Entry *BsaArchive::findEntry(size_t id) const
+{
+    if(!mIdIndex.empty())
+    {
+        if(id >= mIdIndex.size() || mIdIndex[id] == 0)
+            return nullptr;
+        return &mEntries[mIdIndex[id]-1];
+    }
+
+    auto iter = std::lower_bound(mIds.begin(), mIds.end(), id);
+    if(iter == mIds.end() || *iter != id)
+        return nullptr;
+    return &mEntries[std::distance(mIds.begin(), iter)];
+}
+
+
 IStreamPtr BsaArchive::open(const Entry &entry)
 {
+    ++mStats.mOpens;
+    if(mMapping)
+    {
+        if(entry.mEnd > (std::streamsize)mMapping->size())
+            return IStreamPtr(nullptr);
+        return IStreamPtr(new MemoryStream(mMapping->data()+entry.mStart,
+                                           entry.mEnd-entry.mStart, mMapping, &mStats));
+    }
+    if(mFile)
+        return std::make_shared<PReadStream<>>(mFile, entry.mStart, entry.mEnd, &mStats);
+
     std::unique_ptr<std::istream> stream(new std::ifstream(mFilename.c_str(), std::ios::binary));
     if(!stream->seekg(entry.mStart))
         return IStreamPtr(nullptr);
-    return IStreamPtr(new ConstrainedFileStream(std::move(stream), entry.mStart, entry.mEnd));
+    return IStreamPtr(new ConstrainedFileStream(std::move(stream), entry.mStart, entry.mEnd, &mStats));
 }
 
 IStreamPtr BsaArchive::open(const char *name)
 {
-    auto iter = mLookupName.find(name);
-    if(iter == mLookupName.end())
-        return IStreamPtr(nullptr);
-    return open(mEntries[std::distance(mLookupName.begin(), iter)]);
+    const Entry *entry = findEntry(name);
+    if(!entry) return IStreamPtr(nullptr);
+    return open(*entry);
 }
 
 IStreamPtr BsaArchive::open(size_t id)
 {
-    auto iter = mLookupId.find(id);
-    if(iter == mLookupId.end())
-        return IStreamPtr(nullptr);
-    return open(mEntries[std::distance(mLookupId.begin(), iter)]);
+    const Entry *entry = findEntry(id);
+    if(!entry) return IStreamPtr(nullptr);
+    return open(*entry);
+}
+
+bool BsaArchive::getView(const Entry &entry, EntryView &view) const
+{
+    if(!mMapping || entry.mEnd > (std::streamsize)mMapping->size())
+        return false;
+    view.mData = mMapping->data() + entry.mStart;
+    view.mSize = entry.mEnd - entry.mStart;
+    return true;
+}
+
+bool BsaArchive::getView(const char *name, EntryView &view) const
+{
+    const Entry *entry = findEntry(name);
+    return entry && getView(*entry, view);
+}
+
+bool BsaArchive::getView(size_t id, EntryView &view) const
+{
+    const Entry *entry = findEntry(id);
+    return entry && getView(*entry, view);
 }
 
+
 bool BsaArchive::exists(const char *name) const
 {
-    return (mLookupName.find(name) != mLookupName.end());
+    return findEntry(name) != nullptr;
+}
+
+void BsaArchive::dropCache()
+{
+    if(mMapping)
+        mMapping->releasePages();
+    drop_file_cache(mFilename);
+}
+
+bool BsaArchive::getRange(const char *name, uint64_t &start, uint64_t &end) const
+{
+    const Entry *entry = findEntry(name);
+    if(!entry) return false;
+    start = entry->mStart;
+    end = entry->mEnd;
+    return true;
+}
+
+bool BsaArchive::getRange(size_t id, uint64_t &start, uint64_t &end) const
+{
+    const Entry *entry = findEntry(id);
+    if(!entry) return false;
+    start = entry->mStart;
+    end = entry->mEnd;
+    return true;
+}
+
+void BsaArchive::prefetch(uint64_t start, uint64_t end) const
+{
+    if(end <= start)
+        return;
+    if(mMapping)
+        mMapping->prefetch(start, end-start);
+    else if(mFile)
+        mFile->prefetch(start, end-start);
+    else
+        prefetch_file(mFilename, start, end-start);
 }
 
 } // namespace Archives
@@ -12,7 +12,26 @@
 namespace Archives
 {
 
+/* A view of an entry's data in a mapped archive. Remains valid for as long as
+ * the archive stays loaded.
+ */
+struct EntryView {
+    const uint8_t *mData;
+    size_t mSize;
+};
+
 class BsaArchive : public Archive {
+public:
+    enum IOMode {
+        // Open a new file stream for each entry.
+        IO_Stream,
+        // Open the archive once, and read entries with positional reads.
+        IO_PRead,
+        // Map the archive into memory once, and read entries from there.
+        IO_Mapped
+    };
+
+private:
     std::set<std::string> mLookupName;
     std::set<size_t> mLookupId;
 
@@ -22,22 +41,54 @@ class BsaArchive : public Archive {
     };
     std::vector<Entry> mEntries;
 
+    /* Flat lookup tables, built once at load. For named archives, mNames is
+     * sorted and mNames[i] is stored at mEntries[i]. For indexed archives,
+     * mIdIndex maps an ID directly to its entry index+1 (0 if unused) when
+     * the IDs are dense enough, otherwise the sorted mIds is searched like
+     * mNames.
+     */
+    std::vector<std::string> mNames;
+    std::vector<size_t> mIds;
+    std::vector<uint32_t> mIdIndex;
+
     std::string mFilename;
+    FileHandlePtr mFile;
+    MappedFilePtr mMapping;
 
     void loadIndexed(size_t count, std::istream &stream);
     void loadNamed(size_t count, std::istream &stream);
 
+    const Entry *findEntry(const char *name) const;
+    const Entry *findEntry(size_t id) const;
+
     IStreamPtr open(const Entry &entry);
+    bool getView(const Entry &entry, EntryView &view) const;
 
 public:
-    void load(const std::string &fname);
+    /* Loads the archive's index. With IO_Mapped, falls back to IO_PRead if
+     * the file can't be mapped. */
+    void load(const std::string &fname, IOMode mode=IO_Mapped);
+
+    IOMode getIOMode() const { return mMapping ? IO_Mapped : mFile ? IO_PRead : IO_Stream; }
 
     virtual IStreamPtr open(const char *name);
     IStreamPtr open(size_t id);
 
+    /* Retrieves a direct view of an entry's data, without copying. Only
+     * available with IO_Mapped; returns false otherwise or if the entry
+     * doesn't exist. */
+    bool getView(const char *name, EntryView &view) const;
+    bool getView(size_t id, EntryView &view) const;
+
     virtual bool exists(const char *name) const;
+    virtual const std::string &getName() const final { return mFilename; }
 
     virtual const std::set<std::string> &list() const final { return mLookupName; };
+    virtual void dropCache() final;
+
+    virtual bool getRange(const char *name, uint64_t &start, uint64_t &end) const final;
+    bool getRange(size_t id, uint64_t &start, uint64_t &end) const;
+    virtual void prefetch(uint64_t start, uint64_t end) const final;
 
     const std::set<size_t> &getIds() const { return mLookupId; };
 };
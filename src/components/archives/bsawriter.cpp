@@ -0,0 +1,97 @@
+
+#include "bsawriter.hpp"
+
+#include <stdexcept>
+#include <array>
+#include <cstring>
+
+
+namespace
+{
+
+void write_le16(std::ostream &stream, uint16_t val)
+{
+    char buf[2] = { char(val&0xff), char((val>>8)&0xff) };
+    stream.write(buf, sizeof(buf));
+}
+
+void write_le32(std::ostream &stream, uint32_t val)
+{
+    char buf[4] = { char(val&0xff), char((val>>8)&0xff), char((val>>16)&0xff), char((val>>24)&0xff) };
+    stream.write(buf, sizeof(buf));
+}
+
+}
+
+
+namespace Archives
+{
+
+BsaWriter::BsaWriter(const std::string &fname, Type type)
+  : mFilename(fname), mType(type)
+{
+    mStream.open(mFilename.c_str(), std::ios_base::binary);
+    if(!mStream.is_open())
+        throw std::runtime_error("Failed to open "+mFilename+" for writing");
+
+    // The entry count is filled in by finish().
+    write_le16(mStream, 0);
+    write_le16(mStream, (mType == Type_Named) ? 0x0100 : 0x0200);
+}
+
+void BsaWriter::add(Entry&& entry, const char *data)
+{
+    // The count is 16-bit, so up to 65535 entries fit.
+    if(mEntries.size()+1 > 0xffff)
+        throw std::runtime_error("Too many entries for "+mFilename);
+    if(!mStream.write(data, entry.mSize))
+        throw std::runtime_error("Failed writing "+mFilename);
+    mEntries.push_back(std::move(entry));
+}
+
+void BsaWriter::add(const std::string &name, const char *data, size_t size)
+{
+    if(mType != Type_Named)
+        throw std::runtime_error("Cannot add named entry \""+name+"\" to indexed archive "+mFilename);
+    if(name.length() > 12)
+        throw std::runtime_error("Entry name \""+name+"\" is too long for "+mFilename);
+    if(size > 0xffffffff)
+        throw std::runtime_error("Entry \""+name+"\" is too large for "+mFilename);
+    add(Entry{name, 0, uint32_t(size)}, data);
+}
+
+void BsaWriter::add(size_t id, const char *data, size_t size)
+{
+    if(mType != Type_Indexed)
+        throw std::runtime_error("Cannot add entry ID "+std::to_string(id)+" to named archive "+mFilename);
+    if(id > 0xffffffff)
+        throw std::runtime_error("Entry ID "+std::to_string(id)+" is out of range for "+mFilename);
+    if(size > 0xffffffff)
+        throw std::runtime_error("Entry ID "+std::to_string(id)+" is too large for "+mFilename);
+    add(Entry{std::string(), uint32_t(id), uint32_t(size)}, data);
+}
+
+void BsaWriter::finish()
+{
+    for(const Entry &entry : mEntries)
+    {
+        if(mType == Type_Named)
+        {
+            std::array<char,12> name{};
+            memcpy(name.data(), entry.mName.data(), entry.mName.length());
+            mStream.write(name.data(), name.size());
+            write_le16(mStream, 0); // Not compressed
+        }
+        else
+            write_le32(mStream, entry.mId);
+        write_le32(mStream, entry.mSize);
+    }
+
+    mStream.seekp(0);
+    write_le16(mStream, uint16_t(mEntries.size()));
+    mStream.close();
+    if(mStream.fail())
+        throw std::runtime_error("Failed writing "+mFilename);
+}
+
+} // namespace Archives
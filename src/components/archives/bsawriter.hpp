@@ -0,0 +1,51 @@
+#ifndef COMPONENTS_ARCHIVES_BSAWRITER_HPP
+#define COMPONENTS_ARCHIVES_BSAWRITER_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace Archives
+{
+
+/* Writes a BSA archive that BsaArchive can load. Entry data is written as it
+ * is added, in the order it's added, and the footer is written by finish().
+ * An archive holds either named or ID-indexed entries, not both.
+ */
+class BsaWriter {
+public:
+    enum Type {
+        Type_Named,
+        Type_Indexed
+    };
+
+private:
+    struct Entry {
+        std::string mName;
+        uint32_t mId;
+        uint32_t mSize;
+    };
+
+    std::string mFilename;
+    std::ofstream mStream;
+    Type mType;
+    std::vector<Entry> mEntries;
+
+    void add(Entry&& entry, const char *data);
+
+public:
+    BsaWriter(const std::string &fname, Type type);
+
+    /* Adds a named entry. Names may be at most 12 characters. */
+    void add(const std::string &name, const char *data, size_t size);
+    void add(size_t id, const char *data, size_t size);
+
+    /* Writes the footer and header, completing the archive. */
+    void finish();
+};
+
+} // namespace Archives
+
+#endif /* COMPONENTS_ARCHIVES_BSAWRITER_HPP */
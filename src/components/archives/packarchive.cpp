@@ -0,0 +1,198 @@
+
+#include "packarchive.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+
+#include "misc/binaryreader.hpp"
+#include "misc/lz4.hpp"
+
+
+namespace
+{
+
+inline char fold_char(char c)
+{
+    if(c == '\\') return '/';
+    if(c >= 'A' && c <= 'Z') return c - 'A' + 'a';
+    return c;
+}
+
+/* Keeps an entry's decoded data alive for as long as the stream reading it. */
+struct DecodedData {
+    std::vector<uint8_t> mData;
+};
+
+class DecodedStream : private DecodedData, public Archives::MemoryStream {
+public:
+    DecodedStream(std::vector<uint8_t>&& data, Archives::IOStats *stats)
+      : DecodedData{std::move(data)}
+      , Archives::MemoryStream(mData.data(), mData.size(), Archives::MappedFilePtr(), stats)
+    { }
+};
+
+}
+
+
+namespace Archives
+{
+
+uint64_t PackArchive::hashName(const char *name)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(;*name;++name)
+    {
+        hash ^= uint8_t(fold_char(*name));
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool PackArchive::equalNames(const char *lhs, const char *rhs, size_t rhslen)
+{
+    for(size_t i = 0;i < rhslen;++i)
+    {
+        if(lhs[i] == '\0' || fold_char(lhs[i]) != fold_char(rhs[i]))
+            return false;
+    }
+    return lhs[rhslen] == '\0';
+}
+
+
+PackArchive::PackArchive()
+  : mBuckets(nullptr), mNumBuckets(0), mEntries(nullptr), mNumEntries(0)
+  , mNames(nullptr), mNamesSize(0)
+{
+}
+
+void PackArchive::load(const std::string &fname)
+{
+    mFilename = fname;
+    mMapping = std::make_shared<MappedFile>(mFilename);
+
+    Misc::BinaryReader reader(mMapping->data(), mMapping->size());
+    if(reader.size() < sHeaderSize || memcmp(reader.consume(4), "DFPK", 4) != 0)
+        throw std::runtime_error(mFilename+" is not a pack archive");
+    uint32_t version = reader.readLE32();
+    if(version != sVersion)
+        throw std::runtime_error("Unsupported pack version "+std::to_string(version)+" in "+mFilename);
+    reader.skip(4); // Alignment, only needed for writing
+    mNumEntries = reader.readLE32();
+    mNumBuckets = reader.readLE32();
+    mNamesSize = reader.readLE32();
+    reader.seek(sHeaderSize);
+
+    if(mNumBuckets == 0 || (mNumBuckets&(mNumBuckets-1)) != 0 || mNumBuckets <= mNumEntries)
+        throw std::runtime_error("Invalid bucket count "+std::to_string(mNumBuckets)+" in "+mFilename);
+
+    // BinaryReader throws if the directory doesn't fit in the file.
+    mBuckets = reader.consume(size_t(mNumBuckets)*4);
+    mEntries = reader.consume(size_t(mNumEntries)*sEntrySize);
+    mNames = reader.consume(mNamesSize);
+
+    mLookupName.clear();
+    for(uint32_t i = 0;i < mNumEntries;++i)
+    {
+        Misc::BinaryReader entry(mEntries + i*sEntrySize, sEntrySize);
+        entry.skip(24);
+        uint32_t nameoffset = entry.readLE32();
+        uint16_t namelen = entry.readLE16();
+        if(nameoffset > mNamesSize || namelen > mNamesSize-nameoffset)
+            throw std::runtime_error("Invalid name for entry "+std::to_string(i)+" in "+mFilename);
+        mLookupName.insert(std::string(reinterpret_cast<const char*>(mNames+nameoffset), namelen));
+    }
+}
+
+bool PackArchive::findEntry(const char *name, Entry &entry) const
+{
+    if(mNumBuckets == 0)
+        return false;
+
+    // A broken directory may have no empty bucket, so the probe can't go on
+    // past visiting every bucket once.
+    uint64_t hash = hashName(name);
+    uint32_t i = uint32_t(hash)&(mNumBuckets-1);
+    for(uint32_t probes = 0;probes < mNumBuckets;++probes, i = (i+1)&(mNumBuckets-1))
+    {
+        uint32_t idx = Misc::BinaryReader(mBuckets + i*4, 4).readLE32();
+        if(idx >= mNumEntries)
+            return false;
+
+        Misc::BinaryReader reader(mEntries + idx*sEntrySize, sEntrySize);
+        if(reader.readLE64() != hash)
+            continue;
+        entry.mOffset = reader.readLE64();
+        entry.mStoredSize = reader.readLE32();
+        entry.mSize = reader.readLE32();
+        uint32_t nameoffset = reader.readLE32();
+        uint16_t namelen = reader.readLE16();
+        entry.mFlags = reader.readLE16();
+        if(equalNames(name, reinterpret_cast<const char*>(mNames+nameoffset), namelen))
+            return true;
+    }
+    return false;
+}
+
+
+IStreamPtr PackArchive::open(const char *name)
+{
+    Entry entry;
+    if(!findEntry(name, entry) || entry.mOffset > mMapping->size() ||
+       entry.mStoredSize > mMapping->size()-entry.mOffset)
+        return IStreamPtr(nullptr);
+
+    ++mStats.mOpens;
+    const uint8_t *data = mMapping->data() + entry.mOffset;
+    if(!(entry.mFlags&Flag_LZ4))
+        return IStreamPtr(new MemoryStream(data, entry.mStoredSize, mMapping, &mStats));
+
+    std::vector<uint8_t> decoded(entry.mSize);
+    if(!Misc::LZ4::decompress(data, entry.mStoredSize, decoded.data(), decoded.size()))
+        return IStreamPtr(nullptr);
+    return IStreamPtr(new DecodedStream(std::move(decoded), &mStats));
+}
+
+const uint8_t *PackArchive::getMappedData(const char *name, size_t &size) const
+{
+    Entry entry;
+    if(!findEntry(name, entry) || (entry.mFlags&Flag_LZ4) || entry.mOffset > mMapping->size() ||
+       entry.mStoredSize > mMapping->size()-entry.mOffset)
+        return nullptr;
+
+    ++mStats.mOpens;
+    size = entry.mStoredSize;
+    return mMapping->data() + entry.mOffset;
+}
+
+bool PackArchive::exists(const char *name) const
+{
+    Entry entry;
+    return findEntry(name, entry);
+}
+
+void PackArchive::dropCache()
+{
+    if(mMapping)
+        mMapping->releasePages();
+    drop_file_cache(mFilename);
+}
+
+bool PackArchive::getRange(const char *name, uint64_t &start, uint64_t &end) const
+{
+    Entry entry;
+    if(!findEntry(name, entry))
+        return false;
+    start = entry.mOffset;
+    end = entry.mOffset + entry.mStoredSize;
+    return true;
+}
+
+void PackArchive::prefetch(uint64_t start, uint64_t end) const
+{
+    if(mMapping && end > start)
+        mMapping->prefetch(start, end-start);
+}
+
+} // namespace Archives
@@ -0,0 +1,85 @@
+#ifndef COMPONENTS_ARCHIVES_PACKARCHIVE_HPP
+#define COMPONENTS_ARCHIVES_PACKARCHIVE_HPP
+
+#include <string>
+#include <set>
+
+#include "archive.hpp"
+
+
+namespace Archives
+{
+
+/* The engine's own archive format, holding any number of named entries.
+ *
+ * A 32-byte header (magic "DFPK", version, entry alignment, entry count,
+ * bucket count, name table size) is followed by the directory: an open
+ * addressing hash table of entry indices, the entry records, and the name
+ * table. Each entry record holds the 64-bit hash of its name, its file
+ * offset, stored and decoded sizes, name location, and flags. Entry data
+ * follows, each entry starting on an alignment boundary, and optionally LZ4
+ * compressed.
+ *
+ * Names are hashed and compared case-insensitively, with '\' and '/' as
+ * equivalent separators. The whole file is mapped once at load, and lookups
+ * only probe the mapped directory.
+ */
+class PackArchive : public Archive {
+public:
+    static const uint32_t sVersion = 1;
+    static const size_t sHeaderSize = 32;
+    static const size_t sEntrySize = 32;
+    enum {
+        Flag_LZ4 = 1<<0
+    };
+
+    static uint64_t hashName(const char *name);
+    static bool equalNames(const char *lhs, const char *rhs, size_t rhslen);
+
+private:
+    struct Entry {
+        uint64_t mOffset;
+        uint32_t mStoredSize;
+        uint32_t mSize;
+        uint16_t mFlags;
+    };
+
+    std::string mFilename;
+    MappedFilePtr mMapping;
+
+    const uint8_t *mBuckets;
+    uint32_t mNumBuckets;
+    const uint8_t *mEntries;
+    uint32_t mNumEntries;
+    const uint8_t *mNames;
+    uint32_t mNamesSize;
+
+    std::set<std::string> mLookupName;
+
+    bool findEntry(const char *name, Entry &entry) const;
+
+public:
+    PackArchive();
+
+    void load(const std::string &fname);
+
+    virtual IStreamPtr open(const char *name);
+    virtual bool exists(const char *name) const;
+
+    /* Returns an uncompressed entry's data in the mapping, without copying,
+     * or null if it's missing or compressed. The data stays valid for the
+     * archive's lifetime.
+     */
+    const uint8_t *getMappedData(const char *name, size_t &size) const;
+
+    virtual const std::set<std::string> &list() const final { return mLookupName; }
+    virtual const std::string &getName() const final { return mFilename; }
+    virtual void dropCache() final;
+
+    virtual bool getRange(const char *name, uint64_t &start, uint64_t &end) const final;
+    virtual void prefetch(uint64_t start, uint64_t end) const final;
+};
+
+} // namespace Archives
+
+#endif /* COMPONENTS_ARCHIVES_PACKARCHIVE_HPP */
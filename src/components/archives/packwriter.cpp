@@ -0,0 +1,186 @@
+
+#include "packwriter.hpp"
+
+#include <stdexcept>
+#include <unordered_set>
+
+#include "misc/lz4.hpp"
+
+#include "packarchive.hpp"
+
+
+namespace
+{
+
+void write_le16(std::ostream &stream, uint16_t val)
+{
+    char buf[2] = { char(val&0xff), char((val>>8)&0xff) };
+    stream.write(buf, sizeof(buf));
+}
+
+void write_le32(std::ostream &stream, uint32_t val)
+{
+    char buf[4] = { char(val&0xff), char((val>>8)&0xff), char((val>>16)&0xff), char((val>>24)&0xff) };
+    stream.write(buf, sizeof(buf));
+}
+
+void write_le64(std::ostream &stream, uint64_t val)
+{
+    write_le32(stream, uint32_t(val));
+    write_le32(stream, uint32_t(val>>32));
+}
+
+std::string fold_name(const std::string &name)
+{
+    std::string ret = name;
+    for(char &c : ret)
+    {
+        if(c == '\\') c = '/';
+        else if(c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    }
+    return ret;
+}
+
+}
+
+
+namespace Archives
+{
+
+PackWriter::PackWriter(const std::string &fname, const std::vector<std::string> &names, uint32_t alignment)
+  : mFilename(fname), mAlignment(std::max<uint32_t>(alignment, 1)), mNumBuckets(1), mNext(0), mPos(0)
+{
+    if(names.size() >= 0x7fffffff)
+        throw std::runtime_error("Too many entries for "+mFilename);
+
+    // Keep the table at most half full, so probe chains stay short.
+    while(mNumBuckets < names.size()*2 || mNumBuckets <= names.size())
+        mNumBuckets <<= 1;
+
+    std::unordered_set<std::string> seen;
+    uint64_t namesize = 0;
+    mEntries.reserve(names.size());
+    for(const std::string &name : names)
+    {
+        if(name.empty() || name.length() > 0xffff)
+            throw std::runtime_error("Invalid entry name \""+name+"\" for "+mFilename);
+        if(!seen.insert(fold_name(name)).second)
+            throw std::runtime_error("Duplicate entry name \""+name+"\" for "+mFilename);
+        mEntries.push_back(Entry{name, 0, 0, 0, 0});
+        namesize += name.length();
+    }
+    if(namesize > 0xffffffff)
+        throw std::runtime_error("Entry names too large for "+mFilename);
+
+    mStream.open(mFilename.c_str(), std::ios_base::binary);
+    if(!mStream.is_open())
+        throw std::runtime_error("Failed to open "+mFilename+" for writing");
+
+    // The directory is written by finish(), so leave room for it.
+    fill(PackArchive::sHeaderSize + uint64_t(mNumBuckets)*4 +
+         mEntries.size()*PackArchive::sEntrySize + namesize);
+    fill((mPos+mAlignment-1) / mAlignment * mAlignment);
+}
+
+void PackWriter::fill(uint64_t newpos)
+{
+    static const char zeros[4096] = { };
+    while(mPos < newpos)
+    {
+        size_t count = std::min<uint64_t>(newpos-mPos, sizeof(zeros));
+        mStream.write(zeros, count);
+        mPos += count;
+    }
+}
+
+void PackWriter::add(const uint8_t *data, size_t size, bool compress)
+{
+    if(mNext >= mEntries.size())
+        throw std::runtime_error("Too many entries added to "+mFilename);
+    if(size > 0xffffffff)
+        throw std::runtime_error("Entry "+mEntries[mNext].mName+" is too large for "+mFilename);
+
+    Entry &entry = mEntries[mNext++];
+    entry.mOffset = mPos;
+    entry.mSize = uint32_t(size);
+
+    std::vector<uint8_t> packed;
+    if(compress && size > 0)
+        Misc::LZ4::compress(data, size, packed);
+    if(compress && size > 0 && packed.size() <= size - size/8)
+    {
+        entry.mFlags |= PackArchive::Flag_LZ4;
+        data = packed.data();
+        size = packed.size();
+    }
+    entry.mStoredSize = uint32_t(size);
+
+    if(!mStream.write(reinterpret_cast<const char*>(data), size))
+        throw std::runtime_error("Failed writing "+mFilename);
+    mPos += size;
+    if(mNext < mEntries.size())
+        fill((mPos+mAlignment-1) / mAlignment * mAlignment);
+}
+
+void PackWriter::finish()
+{
+    if(mNext != mEntries.size())
+        throw std::runtime_error("Only "+std::to_string(mNext)+" of "+std::to_string(mEntries.size())+
+                                 " entries added to "+mFilename);
+
+    std::vector<uint32_t> buckets(mNumBuckets, ~uint32_t(0));
+    std::vector<uint64_t> hashes(mEntries.size());
+    for(size_t i = 0;i < mEntries.size();++i)
+    {
+        hashes[i] = PackArchive::hashName(mEntries[i].mName.c_str());
+        uint32_t b = uint32_t(hashes[i]) & (mNumBuckets-1);
+        while(buckets[b] != ~uint32_t(0))
+            b = (b+1) & (mNumBuckets-1);
+        buckets[b] = uint32_t(i);
+    }
+
+    mStream.seekp(0);
+    mStream.write("DFPK", 4);
+    write_le32(mStream, PackArchive::sVersion);
+    write_le32(mStream, mAlignment);
+    write_le32(mStream, uint32_t(mEntries.size()));
+    write_le32(mStream, mNumBuckets);
+    uint64_t namesize = 0;
+    for(const Entry &entry : mEntries)
+        namesize += entry.mName.length();
+    write_le32(mStream, uint32_t(namesize));
+    write_le64(mStream, 0); // Reserved
+
+    for(uint32_t idx : buckets)
+        write_le32(mStream, idx);
+
+    uint32_t nameoffset = 0;
+    for(size_t i = 0;i < mEntries.size();++i)
+    {
+        const Entry &entry = mEntries[i];
+        write_le64(mStream, hashes[i]);
+        write_le64(mStream, entry.mOffset);
+        write_le32(mStream, entry.mStoredSize);
+        write_le32(mStream, entry.mSize);
+        write_le32(mStream, nameoffset);
+        write_le16(mStream, uint16_t(entry.mName.length()));
+        write_le16(mStream, entry.mFlags);
+        nameoffset += entry.mName.length();
+    }
+    for(const Entry &entry : mEntries)
+        mStream.write(entry.mName.data(), entry.mName.length());
+
+    mStream.close();
+    if(mStream.fail())
+        throw std::runtime_error("Failed writing "+mFilename);
+}
+
+size_t PackWriter::getCompressedCount() const
+{
+    size_t count = 0;
+    for(const Entry &entry : mEntries)
+        count += !!(entry.mFlags&PackArchive::Flag_LZ4);
+    return count;
+}
+
+} // namespace Archives
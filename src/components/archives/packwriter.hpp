@@ -0,0 +1,54 @@
+#ifndef COMPONENTS_ARCHIVES_PACKWRITER_HPP
+#define COMPONENTS_ARCHIVES_PACKWRITER_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace Archives
+{
+
+/* Writes a PackArchive. All entry names are given up front, so the size of
+ * the directory is known before any data is written. The data is then added
+ * in the same order, and streamed out as it is added.
+ */
+class PackWriter {
+    struct Entry {
+        std::string mName;
+        uint64_t mOffset;
+        uint32_t mStoredSize;
+        uint32_t mSize;
+        uint16_t mFlags;
+    };
+
+    std::string mFilename;
+    std::ofstream mStream;
+    uint32_t mAlignment;
+    uint32_t mNumBuckets;
+    std::vector<Entry> mEntries;
+    size_t mNext;
+    uint64_t mPos;
+
+    // Writes zeros up to the given file offset.
+    void fill(uint64_t newpos);
+
+public:
+    PackWriter(const std::string &fname, const std::vector<std::string> &names, uint32_t alignment=4096);
+
+    /* Adds the next entry's data. With compress, the data is stored LZ4
+     * compressed if that saves at least an eighth of its size.
+     */
+    void add(const uint8_t *data, size_t size, bool compress);
+
+    /* Writes the directory, completing the archive. */
+    void finish();
+
+    /* Number of entries that were stored compressed. */
+    size_t getCompressedCount() const;
+};
+
+} // namespace Archives
+
+#endif /* COMPONENTS_ARCHIVES_PACKWRITER_HPP */
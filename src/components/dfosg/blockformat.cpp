@@ -0,0 +1,280 @@
+
+#include "blockformat.hpp"
+
+#include <stdexcept>
+#include <string>
+
+#include "misc/binaryreader.hpp"
+
+
+namespace DFOSG
+{
+
+void RmbObject::load(Misc::BinaryReader &reader)
+{
+    mXPos = reader.readLE32();
+    mYPos = reader.readLE32();
+    mZPos = reader.readLE32();
+}
+
+void RmbSection3::load(Misc::BinaryReader &reader)
+{
+    RmbObject::load(reader);
+    mUnknown1 = reader.readLE16();
+    mUnknown2 = reader.readLE16();
+}
+
+void RmbDoor::load(Misc::BinaryReader &reader)
+{
+    RmbObject::load(reader);
+    mUnknown1 = reader.readLE16();
+    mRotation = reader.readLE16();
+    mUnknown2 = reader.readLE16();
+    mNullValue = reader.readU8();
+}
+
+void RmbFlat::load(Misc::BinaryReader &reader)
+{
+    RmbObject::load(reader);
+    mTexture = reader.readLE16();
+    mUnknown = reader.readLE16();
+    mFlags = reader.readU8();
+}
+
+void RmbPerson::load(Misc::BinaryReader &reader)
+{
+    RmbObject::load(reader);
+    mTexture = reader.readLE16();
+    mFactionId = reader.readLE16();
+}
+
+void RmbModel::load(Misc::BinaryReader &reader)
+{
+    mModelIdx  = (int)reader.readLE16() * 100;
+    mModelIdx += reader.readU8();
+    mUnknown1 = reader.readU8();
+    mUnknown2 = reader.readLE32();
+    mUnknown3 = reader.readLE32();
+    mUnknown4 = reader.readLE32();
+    mNullValue1 = reader.readLE32();
+    mNullValue2 = reader.readLE32();
+    mUnknownX = reader.readLE32();
+    mUnknownY = reader.readLE32();
+    mUnknownZ = reader.readLE32();
+    mXPos = reader.readLE32();
+    mYPos = reader.readLE32();
+    mZPos = reader.readLE32();
+    mNullValue3 = reader.readLE32();
+    mYRotation = reader.readLE16();
+    mUnknown5 = reader.readLE16();
+    mUnknown6 = reader.readLE32();
+    mUnknown8 = reader.readLE32();
+    mNullValue4 = reader.readLE16();
+}
+
+
+void RmbBlock::load(Misc::BinaryReader &reader)
+{
+    mModelCount = reader.readU8();
+    mFlatCount = reader.readU8();
+    mSection3Count = reader.readU8();
+    mPersonCount = reader.readU8();
+    mDoorCount = reader.readU8();
+    mUnknown1 = reader.readLE16();
+    mUnknown2 = reader.readLE16();
+    mUnknown3 = reader.readLE16();
+    mUnknown4 = reader.readLE16();
+    mUnknown5 = reader.readLE16();
+    mUnknown6 = reader.readLE16();
+
+    mModels.resize(mModelCount);
+    for(RmbModel &model : mModels)
+        model.load(reader);
+    mFlats.resize(mFlatCount);
+    for(RmbFlat &flat : mFlats)
+        flat.load(reader);
+    mSection3s.resize(mSection3Count);
+    for(RmbSection3 &sec3 : mSection3s)
+        sec3.load(reader);
+    mNpcs.resize(mPersonCount);
+    for(RmbPerson &npc : mNpcs)
+        npc.load(reader);
+    mDoors.resize(mDoorCount);
+    for(RmbDoor &door : mDoors)
+        door.load(reader);
+}
+
+
+void RmbBlockPosition::load(Misc::BinaryReader &reader)
+{
+    mUnknown1 = reader.readLE32();
+    mUnknown2 = reader.readLE32();
+    mX = reader.readLE32();
+    mZ = reader.readLE32();
+    mYRot = reader.readLE32();
+}
+
+void RmbBuilding::load(Misc::BinaryReader &reader)
+{
+    mNameSeed = reader.readLE16();
+    mNullValue1 = reader.readLE32();
+    mNullValue2 = reader.readLE32();
+    mNullValue3 = reader.readLE32();
+    mNullValue4 = reader.readLE32();
+    mFactionId = reader.readLE16();
+    mSector = reader.readLE16();
+    mLocationId = reader.readLE16();
+    mBuildingType = reader.readU8();
+    mQuality = reader.readU8();
+}
+
+void RmbHeader::load(Misc::BinaryReader &reader)
+{
+    mBlockCount = reader.readU8();
+    mModelCount = reader.readU8();
+    mFlatCount = reader.readU8();
+    if(mBlockCount > mBlockPositions.size())
+        throw std::runtime_error("Block count "+std::to_string(mBlockCount)+" exceeds "+
+                                 std::to_string(mBlockPositions.size()));
+
+    for(RmbBlockPosition &blockpos : mBlockPositions)
+        blockpos.load(reader);
+    for(RmbBuilding &building : mBuildings)
+        building.load(reader);
+    reader.readArray(mUnknown1);
+    reader.readArray(mBlockSizes);
+
+    reader.readArray(mUnknown2);
+    reader.readArray(mGroundTexture);
+    reader.readArray(mUnknown3);
+    reader.readArray(mAutomap);
+
+    // Unused list? An array of 33 8.3 filenames are here...
+    reader.skip(429);
+}
+
+void RmbFile::load(Misc::BinaryReader &reader)
+{
+    mHeader.load(reader);
+
+    mExteriorBlocks.resize(mHeader.mBlockCount);
+    mInteriorBlocks.resize(mHeader.mBlockCount);
+    for(size_t i = 0;i < mHeader.mBlockCount;++i)
+    {
+        size_t pos = reader.tell();
+        mExteriorBlocks[i].load(reader);
+        mInteriorBlocks[i].load(reader);
+        reader.seek(pos + mHeader.mBlockSizes[i]);
+    }
+
+    mModels.resize(mHeader.mModelCount);
+    for(RmbModel &model : mModels)
+        model.load(reader);
+    mFlats.resize(mHeader.mFlatCount);
+    for(RmbFlat &flat : mFlats)
+        flat.load(reader);
+}
+
+
+void RdbHeader::load(Misc::BinaryReader &reader)
+{
+    mUnknown1 = reader.readLE32();
+    mWidth = reader.readLE32();
+    mHeight = reader.readLE32();
+    mObjectRootOffset = reader.readLE32();
+    mUnknown2 = reader.readLE32();
+    reader.read(mModelData[0].data(), sizeof(mModelData));
+    reader.readArray(mUnknown3);
+}
+
+void RdbAction::load(Misc::BinaryReader &reader)
+{
+    reader.readArray(mData);
+    mTarget = reader.readLE32();
+    mType = reader.readU8();
+}
+
+void RdbModel::load(Misc::BinaryReader &reader)
+{
+    mXRot = reader.readLE32();
+    mYRot = reader.readLE32();
+    mZRot = reader.readLE32();
+
+    mModelIdx = reader.readLE16();
+    mActionFlags = reader.readLE32();
+    mSoundId = reader.readU8();
+    mActionOffset = reader.readLE32();
+}
+
+void RdbFlat::load(Misc::BinaryReader &reader)
+{
+    mTexture = reader.readLE16();
+    mGender = reader.readLE16();
+    mFactionId = reader.readLE16();
+    mActionOffset = reader.readLE32();
+    mUnknown = reader.readU8();
+}
+
+void RdbFile::load(Misc::BinaryReader &reader)
+{
+    mHeader.load(reader);
+
+    reader.seek(mHeader.mObjectRootOffset);
+    if((uint64_t)mHeader.mWidth*mHeader.mHeight > reader.remaining()/4)
+        throw std::runtime_error("Root list of "+std::to_string(mHeader.mWidth)+"x"+
+                                 std::to_string(mHeader.mHeight)+" exceeds data size");
+    std::vector<int32_t> rootoffsets(mHeader.mWidth*mHeader.mHeight);
+    reader.readArray(rootoffsets.data(), rootoffsets.size());
+
+    // Each object record takes at least 21 bytes, so more than this many
+    // means a list loops.
+    size_t remaining = reader.size() / 21;
+    mObjects.clear();
+    for(int32_t offset : rootoffsets)
+    {
+        while(offset > 0)
+        {
+            if(remaining-- == 0)
+                throw std::runtime_error("Object list loops at offset "+std::to_string(offset));
+
+            reader.seek(offset);
+            int32_t next = reader.readLE32();
+            /*int32_t prev =*/ reader.readLE32();
+
+            RdbObject obj = RdbObject();
+            obj.mOffset = offset;
+            obj.mXPos = reader.readLE32();
+            obj.mYPos = reader.readLE32();
+            obj.mZPos = reader.readLE32();
+            obj.mType = reader.readU8();
+            uint32_t objoffset = reader.readLE32();
+
+            int32_t actionoffset = 0;
+            if(obj.mType == RdbObject_Model)
+            {
+                reader.seek(objoffset);
+                obj.mModel.load(reader);
+                if(obj.mModel.mModelIdx >= mHeader.mModelData.size())
+                    throw std::runtime_error("Model index "+std::to_string(obj.mModel.mModelIdx)+
+                                             " exceeds "+std::to_string(mHeader.mModelData.size()));
+                actionoffset = obj.mModel.mActionOffset;
+            }
+            else if(obj.mType == RdbObject_Flat)
+            {
+                reader.seek(objoffset);
+                obj.mFlat.load(reader);
+                actionoffset = obj.mFlat.mActionOffset;
+            }
+            if(actionoffset > 0)
+            {
+                reader.seek(actionoffset);
+                obj.mAction.load(reader);
+            }
+            mObjects.push_back(obj);
+
+            offset = next;
+        }
+    }
+}
+
+} // namespace DFOSG
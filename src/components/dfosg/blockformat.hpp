@@ -0,0 +1,239 @@
+#ifndef COMPONENTS_DFOSG_BLOCKFORMAT_HPP
+#define COMPONENTS_DFOSG_BLOCKFORMAT_HPP
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+
+namespace Misc
+{
+    class BinaryReader;
+}
+
+namespace DFOSG
+{
+
+/* The records of the RMB (exterior) and RDB (dungeon) block files. These only
+ * depend on the reader, so tools can check files with them, and the world
+ * creates its objects from what they read.
+ */
+
+struct RmbObject {
+    int32_t mXPos, mYPos, mZPos;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbSection3 : public RmbObject {
+    uint16_t mUnknown1;
+    uint16_t mUnknown2;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbDoor : public RmbObject {
+    uint16_t mUnknown1;
+    int16_t mRotation;
+    uint16_t mUnknown2;
+    uint8_t mNullValue;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbFlat : public RmbObject {
+    uint16_t mTexture;
+    uint16_t mUnknown;
+    uint8_t mFlags;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbPerson : public RmbObject {
+    uint16_t mTexture;
+    uint16_t mFactionId;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbModel : public RmbObject {
+    uint32_t mModelIdx; /* le16*100 + byte */
+    uint8_t  mUnknown1;
+    uint32_t mUnknown2;
+    uint32_t mUnknown3;
+    uint32_t mUnknown4;
+    uint32_t mNullValue1;
+    uint32_t mNullValue2;
+    int32_t  mUnknownX, mUnknownY, mUnknownZ;
+    //int32_t  mXPos, mYPos, mZPos;
+    uint32_t mNullValue3;
+    int16_t  mYRotation;
+    uint16_t mUnknown5;
+    uint32_t mUnknown6;
+    uint32_t mUnknown8;
+    uint16_t mNullValue4;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbBlock {
+    uint8_t  mModelCount;
+    uint8_t  mFlatCount;
+    uint8_t  mSection3Count;
+    uint8_t  mPersonCount;
+    uint8_t  mDoorCount;
+    uint16_t mUnknown1;
+    uint16_t mUnknown2;
+    uint16_t mUnknown3;
+    uint16_t mUnknown4;
+    uint16_t mUnknown5;
+    uint16_t mUnknown6;
+
+    std::vector<RmbModel>    mModels;
+    std::vector<RmbFlat>     mFlats;
+    std::vector<RmbSection3> mSection3s;
+    std::vector<RmbPerson>   mNpcs;
+    std::vector<RmbDoor>     mDoors;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbBlockPosition {
+    uint32_t mUnknown1;
+    uint32_t mUnknown2;
+    int32_t mX;
+    int32_t mZ;
+    int32_t mYRot;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbBuilding {
+    uint16_t mNameSeed;
+    uint32_t mNullValue1;
+    uint32_t mNullValue2;
+    uint32_t mNullValue3;
+    uint32_t mNullValue4;
+    uint16_t mFactionId;
+    int16_t  mSector;
+    uint16_t mLocationId;
+    uint8_t  mBuildingType;
+    uint8_t  mQuality;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RmbHeader {
+    uint8_t mBlockCount;
+    uint8_t mModelCount;
+    uint8_t mFlatCount;
+
+    std::array<RmbBlockPosition,32> mBlockPositions;
+    std::array<RmbBuilding,32> mBuildings;
+    std::array<uint32_t,32> mUnknown1;
+    std::array<uint32_t,32> mBlockSizes;
+
+    std::array<uint8_t,8> mUnknown2;
+    // Ground texture byte format: IRTTTTTT
+    // I: Invert flag (flip texture on X/Y)
+    // R: Rotate flag (rotate 90 degrees)
+    // T: Texture index, [0-64). File depends on location and weather.
+    std::array<uint8_t,256> mGroundTexture;
+    std::array<uint8_t,256> mUnknown3;
+
+    std::array<uint8_t,4096> mAutomap;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+/* A whole RMB file. Each block has an exterior and an interior part, followed
+ * by the models and flats that belong to the file as a whole.
+ */
+struct RmbFile {
+    RmbHeader mHeader;
+
+    std::vector<RmbBlock> mExteriorBlocks;
+    std::vector<RmbBlock> mInteriorBlocks;
+
+    std::vector<RmbModel> mModels;
+    std::vector<RmbFlat> mFlats;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+
+enum RdbObjectType {
+    RdbObject_Model = 0x01,
+    RdbObject_Light = 0x02,
+    RdbObject_Flat = 0x03,
+};
+
+struct RdbHeader {
+    uint32_t mUnknown1;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mObjectRootOffset;
+    uint32_t mUnknown2;
+
+    std::array<std::array<char,8>,750> mModelData;
+    std::array<uint32_t,750> mUnknown3;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RdbAction {
+    std::array<uint8_t,5> mData;
+    int32_t mTarget;
+    uint8_t mType;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RdbModel {
+    int32_t mXRot, mYRot, mZRot;
+    uint16_t mModelIdx; // Into RdbHeader::mModelData
+    uint32_t mActionFlags;
+    uint8_t mSoundId; // Played when activated
+    int32_t mActionOffset;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+struct RdbFlat {
+    uint16_t mTexture;
+    uint16_t mGender; // Flags?
+    uint16_t mFactionId;
+    int32_t mActionOffset; // Maybe?
+    uint8_t mUnknown;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+/* An object of an RDB file. Objects are identified by the offset of their
+ * record, which is also how actions refer to their targets. Only models and
+ * flats have their data read, and their action if they have one.
+ */
+struct RdbObject {
+    int32_t mOffset;
+    int32_t mXPos, mYPos, mZPos;
+    uint8_t mType;
+
+    RdbModel mModel;
+    RdbFlat mFlat;
+    RdbAction mAction;
+};
+
+/* A whole RDB file. Objects are stored in the file as an array of
+ * (width*height) root offsets, each the start of a linked list of objects.
+ * They're kept here in list order.
+ */
+struct RdbFile {
+    RdbHeader mHeader;
+    std::vector<RdbObject> mObjects;
+
+    void load(Misc::BinaryReader &reader);
+};
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_BLOCKFORMAT_HPP */
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <cstddef>
 #include <cstdint>
 
 
@@ -12,6 +13,11 @@ namespace osg
     class Node;
 }
 
+namespace Misc
+{
+    class BinaryReader;
+}
+
 namespace DFOSG
 {
 
@@ -40,7 +46,7 @@ class MdlHeader {
     uint32_t mPlaneListOffset;
 
 public:
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 
     uint32_t getVersion() const { return mVersion; }
 
@@ -56,7 +62,7 @@ class MdlPoint {
     int32_t mX, mY, mZ;
 
 public:
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 
     int32_t x() const { return mX; }
     int32_t y() const { return mY; }
@@ -69,7 +75,7 @@ class MdlPlanePoint {
     float mV;
 
 public:
-    void load(std::istream &stream, uint32_t offset_scale);
+    void load(Misc::BinaryReader &reader, uint32_t offset_scale);
 
     int32_t getIndex() const { return mIndex; }
     float& u() { return mU; }
@@ -88,9 +94,9 @@ class MdlPlane {
     MdlPoint mNormal;
 
 public:
-    void load(std::istream &stream, uint32_t offset_scale);
+    void load(Misc::BinaryReader &reader, uint32_t offset_scale);
 
-    void loadNormal(std::istream &stream);
+    void loadNormal(Misc::BinaryReader &reader);
 
     void fixUVs(const std::vector<MdlPoint> &points);
 
@@ -105,7 +111,7 @@ class Mesh {
     std::vector<MdlPlane> mPlanes;
 
 public:
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 
     const MdlHeader &getHeader() const { return mHeader; }
     const std::vector<MdlPoint> &getPoints() const { return mPoints; }
@@ -0,0 +1,169 @@
+
+#include "mipgen.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+#include <osg/Image>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <emmintrin.h>
+#define HAVE_SSE2_PATH 1
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#include <emmintrin.h>
+#define HAVE_SSE2_PATH 1
+#define TARGET_SSE2
+#endif
+
+
+namespace
+{
+
+/* Averages four texels, weighting the colors by alpha. With all four opaque
+ * this is a plain rounded average, (sum+2)/4.
+ */
+inline void filter_texel(const uint8_t *a, const uint8_t *b, const uint8_t *c, const uint8_t *d, uint8_t *dst)
+{
+    unsigned int alpha = a[3] + b[3] + c[3] + d[3];
+    if(alpha == 0)
+    {
+        memset(dst, 0, 4);
+        return;
+    }
+    for(int i = 0;i < 3;++i)
+        dst[i] = (a[i]*a[3] + b[i]*b[3] + c[i]*c[3] + d[i]*d[3] + alpha/2) / alpha;
+    dst[3] = (alpha+2) / 4;
+}
+
+/* Filters dst texels [start, end) of one row, from source rows row0 and
+ * row1 of the given width.
+ */
+void filter_row_scalar(const uint8_t *row0, const uint8_t *row1, size_t width, size_t start, size_t end,
+                       uint8_t *dst)
+{
+    for(size_t x = start;x < end;++x)
+    {
+        size_t x0 = std::min(x*2, width-1);
+        size_t x1 = std::min(x*2+1, width-1);
+        filter_texel(row0 + x0*4, row0 + x1*4, row1 + x0*4, row1 + x1*4, dst + x*4);
+    }
+}
+
+#ifdef HAVE_SSE2_PATH
+/* Filters four texels at a time from eight pairs of source texels. Groups
+ * that are all opaque, the common case, are averaged with 16-bit adds, and
+ * the rest take the weighted scalar filter. Needs width >= 2.
+ */
+TARGET_SSE2 void filter_row_sse2(const uint8_t *row0, const uint8_t *row1, size_t width, size_t dstwidth,
+                                 uint8_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+    size_t x = 0;
+    for(;x+4 <= dstwidth;x += 4)
+    {
+        const uint8_t *src0 = row0 + x*8;
+        const uint8_t *src1 = row1 + x*8;
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 16));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 16));
+
+        __m128i all = _mm_and_si128(_mm_and_si128(a0, b0), _mm_and_si128(a1, b1));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, opaque), opaque)) != 0xffff)
+        {
+            filter_row_scalar(row0, row1, width, x, x+4, dst);
+            continue;
+        }
+
+        // Split each row into its even and odd texels.
+        __m128i even0 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(b0), _MM_SHUFFLE(2,0,2,0)));
+        __m128i odd0  = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(b0), _MM_SHUFFLE(3,1,3,1)));
+        __m128i even1 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a1), _mm_castsi128_ps(b1), _MM_SHUFFLE(2,0,2,0)));
+        __m128i odd1  = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a1), _mm_castsi128_ps(b1), _MM_SHUFFLE(3,1,3,1)));
+
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero)),
+                                   _mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero)),
+                                   _mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), _mm_packus_epi16(lo, hi));
+    }
+    filter_row_scalar(row0, row1, width, x, dstwidth, dst);
+}
+#endif
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+void downsample_rgba(ExpandPath path, const uint8_t *src, size_t width, size_t height, uint8_t *dst)
+{
+    size_t dstwidth = std::max<size_t>(width/2, 1);
+    size_t dstheight = std::max<size_t>(height/2, 1);
+    for(size_t y = 0;y < dstheight;++y)
+    {
+        const uint8_t *row0 = src + std::min(y*2, height-1)*width*4;
+        const uint8_t *row1 = src + std::min(y*2+1, height-1)*width*4;
+        uint8_t *out = dst + y*dstwidth*4;
+#ifdef HAVE_SSE2_PATH
+        if(path != Expand_Scalar && width >= 2)
+        {
+            filter_row_sse2(row0, row1, width, dstwidth, out);
+            continue;
+        }
+#endif
+        filter_row_scalar(row0, row1, width, 0, dstwidth, out);
+    }
+}
+
+void downsample_rgba(const uint8_t *src, size_t width, size_t height, uint8_t *dst)
+{
+    downsample_rgba(get_expand_path(), src, width, height, dst);
+}
+
+
+bool build_mipmaps(osg::Image *image)
+{
+    size_t width = image->s(), height = image->t();
+    if(image->getPixelFormat() != GL_RGBA || image->getDataType() != GL_UNSIGNED_BYTE ||
+       image->r() != 1 || image->getRowSizeInBytes() != width*4 || width == 0 || height == 0)
+        return false;
+
+    osg::Image::MipmapDataType offsets;
+    size_t total = width*height*4;
+    for(size_t w = width, h = height;w > 1 || h > 1;)
+    {
+        w = std::max<size_t>(w/2, 1);
+        h = std::max<size_t>(h/2, 1);
+        offsets.push_back(total);
+        total += w*h*4;
+    }
+    if(offsets.empty())
+        return true;
+
+    unsigned char *data = new unsigned char[total];
+    memcpy(data, image->data(), width*height*4);
+    size_t w = width, h = height;
+    const uint8_t *level = data;
+    for(unsigned int offset : offsets)
+    {
+        downsample_rgba(level, w, h, data + offset);
+        level = data + offset;
+        w = std::max<size_t>(w/2, 1);
+        h = std::max<size_t>(h/2, 1);
+    }
+
+    image->setImage(width, height, 1, image->getInternalTextureFormat(), GL_RGBA, GL_UNSIGNED_BYTE,
+                    data, osg::Image::USE_NEW_DELETE);
+    image->setMipmapLevels(offsets);
+    return true;
+}
+
+} // namespace DFOSG
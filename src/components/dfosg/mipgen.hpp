@@ -0,0 +1,39 @@
+#ifndef COMPONENTS_DFOSG_MIPGEN_HPP
+#define COMPONENTS_DFOSG_MIPGEN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "palexpand.hpp"
+
+
+namespace osg
+{
+    class Image;
+}
+
+namespace DFOSG
+{
+
+/* Mipmap generation for RGBA images, on the CPU, so the driver doesn't have
+ * to on upload. Each level halves the one before (rounding down, to no less
+ * than 1) with a 2x2 box filter weighted by alpha: transparent texels only
+ * lower the alpha, and don't bleed their color into the opaque ones.
+ */
+
+/* Writes the next level of a tightly packed width x height RGBA image to
+ * dst. This uses the expansion paths' CPU support, with AVX2 using the SSE2
+ * kernel. All paths give identical results.
+ */
+void downsample_rgba(ExpandPath path, const uint8_t *src, size_t width, size_t height, uint8_t *dst);
+void downsample_rgba(const uint8_t *src, size_t width, size_t height, uint8_t *dst);
+
+/* Replaces an RGBA image's data with its full mip chain, stored in the
+ * image's mipmap data, so uploading it is a plain copy of each level.
+ * Returns false, leaving the image alone, for other formats or padded rows.
+ */
+bool build_mipmaps(osg::Image *image);
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_MIPGEN_HPP */
@@ -0,0 +1,173 @@
+
+#include "palexpand.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SSE2_PATH 1
+#define HAVE_AVX2_PATH 1
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#include <intrin.h>
+#include <immintrin.h>
+#define HAVE_SSE2_PATH 1
+#define HAVE_AVX2_PATH 1
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+
+namespace
+{
+
+void expand_scalar(const uint8_t *src, size_t count, const uint32_t *table, uint8_t *dst)
+{
+    for(size_t i = 0;i < count;++i)
+        memcpy(dst + i*4, &table[src[i]], 4);
+}
+
+#ifdef HAVE_SSE2_PATH
+/* SSE2 has no gather, so this looks up four colors at a time and writes
+ * them as one 16-byte store.
+ */
+TARGET_SSE2 void expand_sse2(const uint8_t *src, size_t count, const uint32_t *table, uint8_t *dst)
+{
+    size_t i = 0;
+    for(;i+4 <= count;i += 4)
+    {
+        __m128i px = _mm_set_epi32(table[src[i+3]], table[src[i+2]], table[src[i+1]], table[src[i]]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i*4), px);
+    }
+    expand_scalar(src+i, count-i, table, dst + i*4);
+}
+#endif
+
+#ifdef HAVE_AVX2_PATH
+/* Widens eight indices to 32-bit and gathers their colors in one go. */
+TARGET_AVX2 void expand_avx2(const uint8_t *src, size_t count, const uint32_t *table, uint8_t *dst)
+{
+    const int *colors = reinterpret_cast<const int*>(table);
+    size_t i = 0;
+    for(;i+8 <= count;i += 8)
+    {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        __m256i px = _mm256_i32gather_epi32(colors, idx, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i*4), px);
+    }
+    expand_scalar(src+i, count-i, table, dst + i*4);
+}
+#endif
+
+
+bool cpu_has_avx2()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    // The OS has to save the AVX registers, too.
+    if(!(info[2] & (1<<27)) || (_xgetbv(0)&6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5)) != 0;
+#else
+    return false;
+#endif
+}
+
+bool cpu_has_sse2()
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+    return true;
+#elif defined(__GNUC__) && defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+PaletteTable::PaletteTable(const Resource::Palette &palette, int transparent)
+{
+    for(size_t i = 0;i < mColors.size();++i)
+    {
+        const uint8_t rgba[4] = {
+            palette[i].r, palette[i].g, palette[i].b,
+            (uint8_t)(((int)i == transparent) ? 0 : 255)
+        };
+        memcpy(&mColors[i], rgba, 4);
+    }
+}
+
+
+bool is_expand_path_supported(ExpandPath path)
+{
+    static const bool sse2 = cpu_has_sse2();
+    static const bool avx2 = cpu_has_avx2();
+    switch(path)
+    {
+        case Expand_Scalar: return true;
+#ifdef HAVE_SSE2_PATH
+        case Expand_SSE2: return sse2;
+#endif
+#ifdef HAVE_AVX2_PATH
+        case Expand_AVX2: return avx2;
+#endif
+        default: break;
+    }
+    return false;
+}
+
+ExpandPath get_expand_path()
+{
+    static const ExpandPath path = is_expand_path_supported(Expand_AVX2) ? Expand_AVX2 :
+                                   is_expand_path_supported(Expand_SSE2) ? Expand_SSE2 :
+                                   Expand_Scalar;
+    return path;
+}
+
+const char *get_expand_path_name(ExpandPath path)
+{
+    static const char *const names[Expand_Count] = { "scalar", "sse2", "avx2" };
+    return (path < Expand_Count) ? names[path] : "unknown";
+}
+
+
+void expand_row(ExpandPath path, const uint8_t *src, size_t count, const PaletteTable &table, uint8_t *dst)
+{
+    switch(path)
+    {
+#ifdef HAVE_AVX2_PATH
+        case Expand_AVX2:
+            expand_avx2(src, count, table.data(), dst);
+            return;
+#endif
+#ifdef HAVE_SSE2_PATH
+        case Expand_SSE2:
+            expand_sse2(src, count, table.data(), dst);
+            return;
+#endif
+        default:
+            expand_scalar(src, count, table.data(), dst);
+            return;
+    }
+}
+
+void expand_row(const uint8_t *src, size_t count, const PaletteTable &table, uint8_t *dst)
+{
+    expand_row(get_expand_path(), src, count, table, dst);
+}
+
+} // namespace DFOSG
@@ -0,0 +1,51 @@
+#ifndef COMPONENTS_DFOSG_PALEXPAND_HPP
+#define COMPONENTS_DFOSG_PALEXPAND_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "components/resource/texturemanager.hpp"
+
+
+namespace DFOSG
+{
+
+/* A palette as packed RGBA colors, in memory order, for expanding indexed
+ * pixels. The transparent index (if any) gets an alpha of 0, the rest 255.
+ */
+class PaletteTable {
+    std::array<uint32_t,256> mColors;
+
+public:
+    explicit PaletteTable(const Resource::Palette &palette, int transparent=0);
+
+    const uint32_t *data() const { return mColors.data(); }
+    uint32_t operator[](size_t idx) const { return mColors[idx]; }
+};
+
+enum ExpandPath {
+    Expand_Scalar,
+    Expand_SSE2,
+    Expand_AVX2,
+
+    Expand_Count
+};
+
+/* Returns the fastest expansion path the CPU supports. This is checked once,
+ * on first use.
+ */
+ExpandPath get_expand_path();
+bool is_expand_path_supported(ExpandPath path);
+const char *get_expand_path_name(ExpandPath path);
+
+/* Expands count palette indices to RGBA pixels, 4 bytes each, at dst. The
+ * first form uses the fastest supported path. All paths give identical
+ * results.
+ */
+void expand_row(const uint8_t *src, size_t count, const PaletteTable &table, uint8_t *dst);
+void expand_row(ExpandPath path, const uint8_t *src, size_t count, const PaletteTable &table, uint8_t *dst);
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_PALEXPAND_HPP */
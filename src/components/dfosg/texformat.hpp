@@ -0,0 +1,111 @@
+#ifndef COMPONENTS_DFOSG_TEXFORMAT_HPP
+#define COMPONENTS_DFOSG_TEXFORMAT_HPP
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+#include "misc/binaryreader.hpp"
+
+
+namespace DFOSG
+{
+
+/* The headers of a TEXTURE.nnn file. These only depend on the reader, so
+ * tools can use them to check files without the rest of the engine.
+ */
+class TexEntryHeader {
+    uint8_t mUnknown1;
+    uint8_t mColor;
+    uint32_t mOffset;
+    uint16_t mUnknown2;
+    uint32_t mUnknown3;
+    uint16_t mNullValue[2];
+
+public:
+    void load(Misc::BinaryReader &reader)
+    {
+        mUnknown1 = reader.readU8();
+        mColor = reader.readU8();
+        mOffset = reader.readLE32();
+        mUnknown2 = reader.readLE16();
+        mUnknown3 = reader.readLE32();
+        mNullValue[0] = reader.readLE32();
+        mNullValue[1] = reader.readLE32();
+    }
+
+    uint8_t getColor() const { return mColor; }
+    uint32_t getOffset() const { return mOffset; }
+};
+
+class TexFileHeader {
+    uint16_t mImageCount;
+    std::array<char,24> mName;
+
+    std::vector<TexEntryHeader> mHeaders;
+
+public:
+    void load(Misc::BinaryReader &reader)
+    {
+        mImageCount = reader.readLE16();
+        reader.read(mName.data(), mName.size());
+
+        mHeaders.resize(mImageCount);
+        for(TexEntryHeader &hdr : mHeaders)
+            hdr.load(reader);
+    }
+
+    uint16_t getImageCount() const { return mImageCount; }
+    const std::vector<TexEntryHeader> &getHeaders() const { return mHeaders; }
+};
+
+class TexHeader {
+    int16_t mOffsetX;
+    int16_t mOffsetY;
+    uint16_t mWidth;
+    uint16_t mHeight;
+    uint16_t mCompression;
+    uint32_t mRecordSize;
+    uint32_t mDataOffset;
+    uint16_t mIsNormal;
+    uint16_t mFrameCount;
+    uint16_t mUnknown;
+    int16_t mXScale;
+    int16_t mYScale;
+
+public:
+    //static const uint16_t sUncompressed  = 0x0000;
+    static const uint16_t sRleCompressed = 0x0002;
+    static const uint16_t sImageRle  = 0x0108;
+    static const uint16_t sRecordRle = 0x1108;
+    void load(Misc::BinaryReader &reader)
+    {
+        mOffsetX = reader.readLE16();
+        mOffsetY = reader.readLE16();
+        mWidth = reader.readLE16();
+        mHeight = reader.readLE16();
+        mCompression = reader.readLE16();
+        mRecordSize = reader.readLE32();
+        mDataOffset = reader.readLE32();
+        mIsNormal = reader.readLE16();
+        mFrameCount = reader.readLE16();
+        mUnknown = reader.readLE16();
+        mXScale = reader.readLE16();
+        mYScale = reader.readLE16();
+    }
+
+    int16_t getXOffset() const { return mOffsetX; }
+    int16_t getYOffset() const { return mOffsetY; }
+    uint16_t getWidth() const { return mWidth; }
+    uint16_t getHeight() const { return mHeight; }
+    uint16_t getCompression() const { return mCompression; }
+    uint32_t getDataOffset() const { return mDataOffset; }
+    uint16_t getIsNormal() const { return mIsNormal; }
+    uint16_t getFrameCount() const { return mFrameCount; }
+    int16_t getXScale() const { return mXScale; }
+    int16_t getYScale() const { return mYScale; }
+};
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_TEXFORMAT_HPP */
@@ -2,110 +2,27 @@
 #include "texloader.hpp"
 
 #include <vector>
-#include <sstream>
-#include <iomanip>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
 
 #include <osg/Image>
 
-#include "components/vfs/manager.hpp"
-
-
-namespace
-{
-
-class TexEntryHeader {
-    uint8_t mUnknown1;
-    uint8_t mColor;
-    uint32_t mOffset;
-    uint16_t mUnknown2;
-    uint32_t mUnknown3;
-    uint16_t mNullValue[2];
-
-public:
-    void load(std::istream &stream)
-    {
-        mUnknown1 = stream.get();
-        mColor = stream.get();
-        mOffset = VFS::read_le32(stream);
-        mUnknown2 = VFS::read_le16(stream);
-        mUnknown3 = VFS::read_le32(stream);
-        mNullValue[0] = VFS::read_le32(stream);
-        mNullValue[1] = VFS::read_le32(stream);
-    }
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
 
-    uint8_t getColor() const { return mColor; }
-    uint32_t getOffset() const { return mOffset; }
-};
-
-class TexFileHeader {
-    uint16_t mImageCount;
-    std::array<char,24> mName;
-
-    std::vector<TexEntryHeader> mHeaders;
-
-public:
-    void load(std::istream &stream)
-    {
-        mImageCount = VFS::read_le16(stream);
-        stream.read(mName.data(), mName.size());
-
-        mHeaders.resize(mImageCount);
-        for(TexEntryHeader &hdr : mHeaders)
-            hdr.load(stream);
-    }
+#include "misc/binaryreader.hpp"
 
-    uint16_t getImageCount() const { return mImageCount; }
-    const std::vector<TexEntryHeader> &getHeaders() const { return mHeaders; }
-};
+#include "texformat.hpp"
+#include "palexpand.hpp"
+#include "texrle.hpp"
 
-class TexHeader {
-    int16_t mOffsetX;
-    int16_t mOffsetY;
-    uint16_t mWidth;
-    uint16_t mHeight;
-    uint16_t mCompression;
-    uint32_t mRecordSize;
-    uint32_t mDataOffset;
-    uint16_t mIsNormal;
-    uint16_t mFrameCount;
-    uint16_t mUnknown;
-    int16_t mXScale;
-    int16_t mYScale;
-
-public:
-    //static const uint16_t sUncompressed  = 0x0000;
-    static const uint16_t sRleCompressed = 0x0002;
-    static const uint16_t sImageRle  = 0x0108;
-    static const uint16_t sRecordRle = 0x1108;
-    void load(std::istream &stream)
-    {
-        mOffsetX = VFS::read_le16(stream);
-        mOffsetY = VFS::read_le16(stream);
-        mWidth = VFS::read_le16(stream);
-        mHeight = VFS::read_le16(stream);
-        mCompression = VFS::read_le16(stream);
-        mRecordSize = VFS::read_le32(stream);
-        mDataOffset = VFS::read_le32(stream);
-        mIsNormal = VFS::read_le16(stream);
-        mFrameCount = VFS::read_le16(stream);
-        mUnknown = VFS::read_le16(stream);
-        mXScale = VFS::read_le16(stream);
-        mYScale = VFS::read_le16(stream);
-    }
-
-    int16_t getXOffset() const { return mOffsetX; }
-    int16_t getYOffset() const { return mOffsetY; }
-    uint16_t getWidth() const { return mWidth; }
-    uint16_t getHeight() const { return mHeight; }
-    uint16_t getCompression() const { return mCompression; }
-    uint32_t getDataOffset() const { return mDataOffset; }
-    uint16_t getIsNormal() const { return mIsNormal; }
-    uint16_t getFrameCount() const { return mFrameCount; }
-    int16_t getXScale() const { return mXScale; }
-    int16_t getYScale() const { return mYScale; }
-};
-
-} // namespace
+#include "components/vfs/manager.hpp"
+#include "components/resource/texturecache.hpp"
 
 
 namespace DFOSG
@@ -123,10 +40,22 @@ TexLoader::~TexLoader()
 }
 
 
-osg::Image *TexLoader::createDummyImage()
+osg::Image *TexLoader::createDummyImage(const PaletteTable *table)
 {
     osg::Image *image = new osg::Image();
 
+    if(!table)
+    {
+        // Stripes of two arbitrary (but opaque) palette indices.
+        image->allocateImage(2, 2, 1, GL_RED, GL_UNSIGNED_BYTE);
+        image->setInternalTextureFormat(GL_R8);
+        unsigned char *dst = image->data(0, 0);
+        dst[0] = 0x0f; dst[1] = 0xf0;
+        dst = image->data(0, 1);
+        dst[0] = 0xf0; dst[1] = 0x0f;
+        return image;
+    }
+
     // Yellow/black diagonal stripes
     image->allocateImage(2, 2, 1, GL_RGBA, GL_UNSIGNED_BYTE);
     unsigned char *dst = image->data(0, 0);
@@ -151,177 +80,351 @@ osg::Image *TexLoader::createDummyImage()
     return image;
 }
 
-
-osg::Image *TexLoader::loadUncompressedSingle(size_t width, size_t height, const Resource::Palette &palette, std::istream &stream)
+osg::Image *TexLoader::createImage(size_t width, size_t height, const PaletteTable *table)
 {
     osg::Image *image = new osg::Image();
-    image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    if(table)
+        image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    else
+    {
+        image->allocateImage(width, height, 1, GL_RED, GL_UNSIGNED_BYTE);
+        image->setInternalTextureFormat(GL_R8);
+    }
+    return image;
+}
+
+void TexLoader::writeRow(const uint8_t *src, size_t count, const PaletteTable *table, unsigned char *dst)
+{
+    if(table)
+        expand_row(src, count, *table, dst);
+    else
+        memcpy(dst, src, count);
+}
+
+
+osg::Image *TexLoader::loadUncompressedSingle(size_t width, size_t height, const PaletteTable *table, Misc::BinaryReader &reader)
+{
+    osg::Image *image = createImage(width, height, table);
 
+    // Rows are stored 256 bytes apart, regardless of the image width.
+    size_t base = reader.tell();
     for(size_t y = 0;y < height;++y)
     {
-        std::array<uint8_t,256> line;
-        stream.read(reinterpret_cast<char*>(line.data()), line.size());
-
-        unsigned char *dst = image->data(0, y);
-        for(size_t x = 0;x < width;++x)
-        {
-            const Resource::PaletteEntry &color = palette[line[x]];
-            *(dst++) = color.r;
-            *(dst++) = color.g;
-            *(dst++) = color.b;
-            *(dst++) = (line[x]==0) ? 0 : 255;
-        }
+        reader.seek(base + y*256);
+        const uint8_t *line = reader.consume(width);
+        writeRow(line, width, table, image->data(0, y));
     }
 
     return image;
 }
 
-void TexLoader::loadUncompressedMulti(osg::Image *image, const Resource::Palette &palette, std::istream &stream)
+void TexLoader::loadUncompressedMulti(osg::Image *image, const PaletteTable *table, Misc::BinaryReader &reader)
 {
-    size_t width = VFS::read_le16(stream);
-    size_t height = VFS::read_le16(stream);
+    size_t width = reader.readLE16();
+    size_t height = reader.readLE16();
+    // Don't write past the image, if a frame claims to be bigger.
+    size_t maxwidth = std::min<size_t>(width, image->s());
+    height = std::min<size_t>(height, image->t());
 
-    for(uint32_t y = 0;y < height && stream;++y)
+    for(uint32_t y = 0;y < height && !reader.eof();++y)
     {
         bool isZero = true;
-        uint8_t c = stream.get();
+        uint8_t c = reader.readU8();
 
+        unsigned char *dst = image->data(0, y);
         uint32_t x = 0;
         do {
-            if(isZero)
-            {
-                for(uint32_t i = 0;i < c;++i)
-                {
-                    unsigned char *dst = image->data(x++, y);
-                    *(dst++) = palette[0].r;
-                    *(dst++) = palette[0].g;
-                    *(dst++) = palette[0].b;
-                    *(dst++) = 0;
-                }
-            }
-            else for(uint32_t i = 0;i < c;++i)
+            size_t count = std::min<size_t>(c, (x < maxwidth) ? maxwidth-x : 0);
+            if(isZero && !table)
+                memset(dst, 0, count);
+            else if(isZero)
             {
-                unsigned char *dst = image->data(x++, y);
-                uint8_t idx = stream.get();
-                *(dst++) = palette[idx].r;
-                *(dst++) = palette[idx].g;
-                *(dst++) = palette[idx].b;
-                *(dst++) = (idx==0) ? 0 : 255;
+                const uint32_t color = (*table)[0];
+                for(size_t i = 0;i < count;++i)
+                    memcpy(dst + i*4, &color, 4);
             }
-            if(x < width || (x >= width && isZero))
-                c = stream.get();
+            else
+                writeRow(reader.consume(c), count, table, dst);
+            dst += count * (table ? 4 : 1);
+            x += c;
+            if((x < width || (x >= width && isZero)) && !reader.eof())
+                c = reader.readU8();
             isZero = !isZero;
-        } while(x < width && stream);
+        } while(x < width && !reader.eof());
     }
 }
 
+/* Decodes a frame of an RLE image. Indexed images are decoded in place, and
+ * others are decoded to indices first, then expanded a row at a time.
+ * Returns null if the data is broken.
+ */
+osg::Image *TexLoader::loadRle(const TexHeader &texhdr, const uint8_t *record, size_t reclen, size_t frame,
+                               const PaletteTable *table)
+{
+    size_t width = texhdr.getWidth();
+    size_t height = texhdr.getHeight();
+    osg::ref_ptr<osg::Image> image(createImage(width, height, table));
+
+    std::vector<uint8_t> indices;
+    uint8_t *dst = image->data();
+    size_t stride = image->getRowSizeInBytes();
+    if(table)
+    {
+        indices.resize(width * height);
+        dst = indices.data();
+        stride = width;
+    }
 
-ImagePtrArray TexLoader::load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
-                              const Resource::Palette& palette)
+    bool ok;
+    if(texhdr.getCompression() == texhdr.sRleCompressed)
+    {
+        size_t offset = texhdr.getDataOffset();
+        ok = offset <= reclen && decode_rle(record+offset, reclen-offset, width, height, dst, stride);
+    }
+    else
+    {
+        // Each frame has its own table of row headers.
+        size_t rowtable = texhdr.getDataOffset() + height*frame*4;
+        ok = decode_row_rle(record, reclen, rowtable, width, height, dst, stride);
+    }
+    if(!ok)
+        return nullptr;
+
+    if(table)
+    {
+        for(size_t y = 0;y < height;++y)
+            writeRow(&indices[y*width], width, table, image->data(0, y));
+    }
+    return image.release();
+}
+
+
+struct TexLoader::TexFile {
+    VFS::BlobPtr mData;
+    TexFileHeader mHeader;
+};
+
+TexLoader::TexFilePtr TexLoader::getFile(size_t fileidx)
 {
-    std::stringstream sstr; sstr.fill('0');
-    sstr<<"TEXTURE."<<std::setw(3)<<(idx>>7);
+    std::unique_lock<std::mutex> lock(mMutex);
+    for(auto iter = mFiles.begin();iter != mFiles.end();++iter)
+    {
+        if(iter->first == fileidx)
+        {
+            mFiles.splice(mFiles.begin(), mFiles, iter);
+            return iter->second;
+        }
+    }
+    // Read and parse without holding the lock.
+    lock.unlock();
 
-    VFS::IStreamPtr stream = VFS::Manager::get().open(sstr.str());
+    std::array<char,16> name;
+    snprintf(name.data(), name.size(), "TEXTURE.%03u", (unsigned int)fileidx);
 
-    TexFileHeader hdr;
-    hdr.load(*stream);
+    std::shared_ptr<TexFile> file(new TexFile());
+    file->mData = VFS::Manager::get().readAll(name.data());
+    if(!file->mData) throw std::runtime_error(std::string("Failed to open ")+name.data());
+
+    Misc::BinaryReader reader(file->mData->data(), file->mData->size());
+    file->mHeader.load(reader);
+
+    lock.lock();
+    for(auto iter = mFiles.begin();iter != mFiles.end();++iter)
+    {
+        // Another thread loaded it meanwhile.
+        if(iter->first == fileidx)
+            return iter->second;
+    }
+    mFiles.emplace_front(fileidx, file);
+    if(mFiles.size() > sMaxFiles)
+        mFiles.pop_back();
+    return file;
+}
+
+size_t TexLoader::getImageCount(size_t fileidx)
+{
+    return getFile(fileidx)->mHeader.getImageCount();
+}
 
-    const TexEntryHeader &entryhdr = hdr.getHeaders().at(idx&0x7f);
+TexImageInfo TexLoader::getImageInfo(size_t fileidx, size_t imgidx)
+{
+    TexFilePtr file = getFile(fileidx);
+    TexImageInfo info{1, 1, 0, 0, 0, 0};
+
+    const TexEntryHeader &entryhdr = file->mHeader.getHeaders().at(imgidx);
     if(entryhdr.getOffset() == 0)
+        return info;
+
+    Misc::BinaryReader reader(file->mData->data(), file->mData->size());
+    reader.seek(entryhdr.getOffset());
+    TexHeader texhdr;
+    texhdr.load(reader);
+
+    info.mXOffset = texhdr.getXOffset();
+    info.mYOffset = texhdr.getYOffset();
+    info.mXScale = texhdr.getXScale();
+    info.mYScale = texhdr.getYScale();
+    if(texhdr.getFrameCount() == 0)
+        info.mWidth = info.mHeight = 2;
+    else
     {
-        osg::ref_ptr<osg::Image> image(new osg::Image());
+        info.mWidth = texhdr.getWidth();
+        info.mHeight = texhdr.getHeight();
+    }
+    return info;
+}
 
+uint64_t TexLoader::getFileHash(size_t fileidx)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mFileHashes.find(fileidx);
+        if(iter != mFileHashes.end())
+            return iter->second;
+    }
+
+    TexFilePtr file = getFile(fileidx);
+    uint64_t hash = Resource::TextureCache::hash(file->mData->data(), file->mData->size());
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFileHashes[fileidx] = hash;
+    return hash;
+}
+
+void TexLoader::clearCache()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFiles.clear();
+}
+
+
+TexImage TexLoader::loadImage(const TexFile &file, size_t imgidx, const PaletteTable *table)
+{
+    Misc::BinaryReader reader(file.mData->data(), file.mData->size());
+    TexImage result{ImagePtrArray(), 0, 0, 0, 0};
+    ImagePtrArray &images = result.mImages;
+
+    const TexEntryHeader &entryhdr = file.mHeader.getHeaders().at(imgidx);
+    if(entryhdr.getOffset() == 0)
+    {
         // Solid color "texture".
-        image->allocateImage(1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        osg::ref_ptr<osg::Image> image(createImage(1, 1, table));
         uint8_t idx = entryhdr.getColor();
-        unsigned char *dst = image->data(0, 0);
-        *(dst++) = palette[idx].r;
-        *(dst++) = palette[idx].g;
-        *(dst++) = palette[idx].b;
-        *(dst++) = (idx==0) ? 0 : 255;
+        writeRow(&idx, 1, table, image->data(0, 0));
 
-        std::vector<osg::ref_ptr<osg::Image>> images(1, image);
-        return images;
+        images.push_back(image);
+        return result;
     }
 
-    if(!stream->seekg(entryhdr.getOffset()))
-        throw std::runtime_error("Failed to seek to texture offset");
+    if(entryhdr.getOffset() > file.mData->size())
+        throw std::runtime_error("Image "+std::to_string(imgidx)+" offset exceeds file size");
+    const uint8_t *record = file.mData->data() + entryhdr.getOffset();
+    size_t reclen = file.mData->size() - entryhdr.getOffset();
 
+    reader.seek(entryhdr.getOffset());
     TexHeader texhdr;
-    texhdr.load(*stream);
+    texhdr.load(reader);
 
-    *xoffset = texhdr.getXOffset();
-    *yoffset = texhdr.getYOffset();
-    *xscale = texhdr.getXScale();
-    *yscale = texhdr.getYScale();
+    result.mXOffset = texhdr.getXOffset();
+    result.mYOffset = texhdr.getYOffset();
+    result.mXScale = texhdr.getXScale();
+    result.mYScale = texhdr.getYScale();
 
     // Would be nice to load a multiframe texture as a 3D Image, but such an
     // image can't be properly loaded into a Texture2DArray (it wants to load
     // a 2D Image for each individual layer).
-    ImagePtrArray images;
     if(texhdr.getFrameCount() == 0)
     {
         // Allocate a dummy image
-        images.push_back(createDummyImage());
+        images.push_back(createDummyImage(table));
     }
     else if(texhdr.getFrameCount() == 1)
     {
         osg::ref_ptr<osg::Image> image;
 
-        if(texhdr.getCompression() == texhdr.sRleCompressed)
-            std::cerr<< "Unhandled RleCompressed compression type"<< std::endl;
-        else if(texhdr.getCompression() == texhdr.sImageRle)
-            std::cerr<< "Unhandled ImageRle compression type"<< std::endl;
-        else if(texhdr.getCompression() == texhdr.sRecordRle)
-            std::cerr<< "Unhandled RecordRle compression type"<< std::endl;
+        if(texhdr.getCompression() == texhdr.sRleCompressed ||
+           texhdr.getCompression() == texhdr.sImageRle ||
+           texhdr.getCompression() == texhdr.sRecordRle)
+        {
+            image = loadRle(texhdr, record, reclen, 0, table);
+            if(!image)
+                std::cerr<< "Broken RLE data in image "<<imgidx<< std::endl;
+        }
         else //if(texhdr.getCompression() == texhdr.sUncompressed)
         {
-            if(!stream->seekg(entryhdr.getOffset() + texhdr.getDataOffset()))
-                throw std::runtime_error("Failed to seek to image offset");
-
-            image = loadUncompressedSingle(texhdr.getWidth(), texhdr.getHeight(), palette, *stream);
+            reader.seek(entryhdr.getOffset() + texhdr.getDataOffset());
+            image = loadUncompressedSingle(texhdr.getWidth(), texhdr.getHeight(), table, reader);
         }
 
         if(!image)
-            image = createDummyImage();
+            image = createDummyImage(table);
 
         images.push_back(image);
     }
     else
     {
         if(texhdr.getCompression() == texhdr.sRleCompressed)
-            std::cerr<< "Unhandled RleCompressed compression type"<< std::endl;
-        else if(texhdr.getCompression() == texhdr.sImageRle)
-            std::cerr<< "Unhandled ImageRle compression type"<< std::endl;
-        else if(texhdr.getCompression() == texhdr.sRecordRle)
-            std::cerr<< "Unhandled RecordRle compression type"<< std::endl;
+            std::cerr<< "Unhandled multiframe RleCompressed compression type"<< std::endl;
+        else if(texhdr.getCompression() == texhdr.sImageRle ||
+                texhdr.getCompression() == texhdr.sRecordRle)
+        {
+            for(size_t frame = 0;frame < texhdr.getFrameCount();++frame)
+            {
+                osg::Image *image = loadRle(texhdr, record, reclen, frame, table);
+                if(!image)
+                {
+                    std::cerr<< "Broken RLE data in image "<<imgidx<<", frame "<<frame<< std::endl;
+                    break;
+                }
+                images.push_back(image);
+            }
+        }
         else //if(texhdr.getCompression() == texhdr.sUncompressed)
         {
-            if(!stream->seekg(entryhdr.getOffset() + texhdr.getDataOffset()))
-                throw std::runtime_error("Failed to seek to image offset");
+            reader.seek(entryhdr.getOffset() + texhdr.getDataOffset());
             std::vector<uint32_t> offsets(texhdr.getFrameCount());
-            for(uint32_t &offset : offsets)
-                offset = VFS::read_le32(*stream);
+            reader.readArray(offsets.data(), offsets.size());
 
             for(uint32_t offset : offsets)
             {
-                if(!stream->seekg(entryhdr.getOffset() + texhdr.getDataOffset() + offset))
-                    throw std::runtime_error("Failed to seek to frame offset");
-                images.push_back(new osg::Image());
+                reader.seek(entryhdr.getOffset() + texhdr.getDataOffset() + offset);
+                images.push_back(createImage(texhdr.getWidth(), texhdr.getHeight(), table));
 
                 osg::Image *image = images.back();
-                image->allocateImage(texhdr.getWidth(), texhdr.getHeight(), 1,
-                                     GL_RGBA, GL_UNSIGNED_BYTE);
-
-                loadUncompressedMulti(image, palette, *stream);
+                loadUncompressedMulti(image, table, reader);
             }
         }
 
         if(images.empty())
-            images.push_back(createDummyImage());
+            images.push_back(createDummyImage(table));
     }
 
+    return result;
+}
+
+ImagePtrArray TexLoader::load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
+                              const Resource::Palette *palette)
+{
+    TexFilePtr file = getFile(idx>>7);
+    std::unique_ptr<PaletteTable> table(palette ? new PaletteTable(*palette) : nullptr);
+    TexImage image = loadImage(*file, idx&0x7f, table.get());
+
+    *xoffset = image.mXOffset;
+    *yoffset = image.mYOffset;
+    *xscale = image.mXScale;
+    *yscale = image.mYScale;
+    return image.mImages;
+}
+
+std::vector<TexImage> TexLoader::loadBatch(size_t fileidx, const std::vector<size_t> &imgidxs, const Resource::Palette *palette)
+{
+    TexFilePtr file = getFile(fileidx);
+    std::unique_ptr<PaletteTable> table(palette ? new PaletteTable(*palette) : nullptr);
+
+    std::vector<TexImage> images;
+    images.reserve(imgidxs.size());
+    for(size_t imgidx : imgidxs)
+        images.push_back(loadImage(*file, imgidx, table.get()));
     return images;
 }
 
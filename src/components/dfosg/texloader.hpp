@@ -2,6 +2,10 @@
 #define COMPONENTS_DFOSG_TEXLOADER_HPP
 
 #include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #include <osg/ref_ptr>
 
@@ -13,32 +17,99 @@ namespace osg
     class Image;
 }
 
+namespace Misc
+{
+    class BinaryReader;
+}
+
 namespace DFOSG
 {
 
+class PaletteTable;
+class TexHeader;
+
 typedef std::vector<osg::ref_ptr<osg::Image>> ImagePtrArray;
 
+/* The frames of one texture image, and its offsets and scales. */
+struct TexImage {
+    ImagePtrArray mImages;
+    int16_t mXOffset, mYOffset;
+    int16_t mXScale, mYScale;
+};
+
+/* An image's size, offsets and scales, known from its headers alone. */
+struct TexImageInfo {
+    size_t mWidth, mHeight;
+    int16_t mXOffset, mYOffset;
+    int16_t mXScale, mYScale;
+};
+
 class TexLoader {
     static TexLoader sLoader;
 
+    /* A TEXTURE.nnn file's data, and its parsed header. */
+    struct TexFile;
+    typedef std::shared_ptr<const TexFile> TexFilePtr;
+
+    // Recently used files, most recent first.
+    std::list<std::pair<size_t,TexFilePtr>> mFiles;
+    std::map<size_t,uint64_t> mFileHashes;
+    std::mutex mMutex;
+
+    static const size_t sMaxFiles = 32;
+
     TexLoader(const TexLoader&) = delete;
     TexLoader& operator=(const TexLoader&) = delete;
 
     TexLoader();
     ~TexLoader();
 
-    osg::Image *createDummyImage();
+    osg::Image *createDummyImage(const PaletteTable *table);
+    osg::Image *createImage(size_t width, size_t height, const PaletteTable *table);
+    void writeRow(const uint8_t *src, size_t count, const PaletteTable *table, unsigned char *dst);
 
     osg::Image *loadUncompressedSingle(size_t width, size_t height,
-                                       const Resource::Palette &palette,
-                                       std::istream &stream);
-    void loadUncompressedMulti(osg::Image *image, const Resource::Palette &palette,
-                               std::istream &stream);
+                                       const PaletteTable *table,
+                                       Misc::BinaryReader &reader);
+    void loadUncompressedMulti(osg::Image *image, const PaletteTable *table,
+                               Misc::BinaryReader &reader);
+    osg::Image *loadRle(const TexHeader &texhdr, const uint8_t *record, size_t reclen, size_t frame,
+                        const PaletteTable *table);
 
-public:
-    ImagePtrArray load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale, const Resource::Palette &palette);
+    TexFilePtr getFile(size_t fileidx);
+    TexImage loadImage(const TexFile &file, size_t imgidx, const PaletteTable *table);
 
-    ImagePtrArray load(size_t idx, const Resource::Palette &palette)
+public:
+    /* Loads the given image, expanded to RGBA with the palette. Without a
+     * palette, the image keeps its 8-bit palette indices (GL_R8), for
+     * shaders to look up.
+     */
+    ImagePtrArray load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale, const Resource::Palette *palette);
+
+    /* Loads several images of one TEXTURE file (the upper nine bits of a
+     * texture index), given by their image indices (the lower seven bits),
+     * reading and parsing the file only once.
+     */
+    std::vector<TexImage> loadBatch(size_t fileidx, const std::vector<size_t> &imgidxs, const Resource::Palette *palette);
+
+    /* Returns the number of images in a TEXTURE file. */
+    size_t getImageCount(size_t fileidx);
+
+    /* Returns what load() would give for an image, less the pixels, without
+     * decoding it. Broken images may still load as a differently sized
+     * dummy.
+     */
+    TexImageInfo getImageInfo(size_t fileidx, size_t imgidx);
+
+    /* Returns a hash of a TEXTURE file's contents, for keying images derived
+     * from it. Each file is only hashed once.
+     */
+    uint64_t getFileHash(size_t fileidx);
+
+    /* Forgets the cached file headers. */
+    void clearCache();
+
+    ImagePtrArray load(size_t idx, const Resource::Palette *palette)
     {
         int16_t xoffset, yoffset, xscale, yscale;
         return load(idx, &xoffset, &yoffset, &xscale, &yscale, palette);
@@ -0,0 +1,155 @@
+
+#include "texrle.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+
+inline uint16_t read_le16(const uint8_t *src)
+{
+    return src[0] | (src[1]<<8);
+}
+
+/* Decodes one encoded row, clipping it to width. The row may claim a
+ * different width than the image; any part it doesn't cover is cleared.
+ */
+bool decode_rle_row(const uint8_t *src, const uint8_t *end, size_t width, uint8_t *dst)
+{
+    if(end-src < 2)
+        return false;
+    size_t rowwidth = read_le16(src);
+    src += 2;
+
+    size_t x = 0;
+    while(x < rowwidth)
+    {
+        if(end-src < 2)
+            return false;
+        int16_t code = (int16_t)read_le16(src);
+        src += 2;
+
+        size_t count;
+        if(code < 0)
+        {
+            count = -(int)code;
+            if(src == end)
+                return false;
+            uint8_t value = *(src++);
+            if(x < width)
+                memset(dst+x, value, std::min(count, width-x));
+        }
+        else
+        {
+            count = code;
+            if((size_t)(end-src) < count)
+                return false;
+            if(x < width)
+                memcpy(dst+x, src, std::min(count, width-x));
+            src += count;
+        }
+        x += count;
+    }
+    if(x < width)
+        memset(dst+x, 0, width-x);
+    return true;
+}
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+bool decode_rle(const uint8_t *src, size_t len, size_t width, size_t height, uint8_t *dst, size_t stride)
+{
+    const uint8_t *end = src + len;
+    size_t x = 0, y = 0;
+    if(width == 0)
+        return true;
+
+    while(y < height)
+    {
+        if(src == end)
+            return false;
+        uint8_t code = *(src++);
+
+        size_t count;
+        const uint8_t *literal = nullptr;
+        uint8_t value = 0;
+        if(code < 0x80)
+        {
+            count = code + 1;
+            if((size_t)(end-src) < count)
+                return false;
+            literal = src;
+            src += count;
+        }
+        else
+        {
+            count = code - 0x7f;
+            if(src == end)
+                return false;
+            value = *(src++);
+        }
+
+        // Split the run where it crosses into the next row.
+        while(count > 0 && y < height)
+        {
+            size_t n = std::min(count, width-x);
+            if(literal)
+            {
+                memcpy(dst+x, literal, n);
+                literal += n;
+            }
+            else
+                memset(dst+x, value, n);
+            count -= n;
+            x += n;
+            if(x == width)
+            {
+                dst += stride;
+                x = 0;
+                ++y;
+            }
+        }
+    }
+    return true;
+}
+
+bool decode_row_rle(const uint8_t *record, size_t len, size_t rowtable, size_t width, size_t height,
+                    uint8_t *dst, size_t stride)
+{
+    if(rowtable > len || (len-rowtable)/4 < height)
+        return false;
+
+    const uint8_t *end = record + len;
+    const uint8_t *header = record + rowtable;
+    for(size_t y = 0;y < height;++y)
+    {
+        size_t offset = read_le16(header);
+        uint16_t encoding = read_le16(header+2);
+        header += 4;
+
+        if(offset > len)
+            return false;
+        const uint8_t *src = record + offset;
+        if(encoding == sRowIsRle)
+        {
+            if(!decode_rle_row(src, end, width, dst))
+                return false;
+        }
+        else
+        {
+            if((size_t)(end-src) < width)
+                return false;
+            memcpy(dst, src, width);
+        }
+        dst += stride;
+    }
+    return true;
+}
+
+} // namespace DFOSG
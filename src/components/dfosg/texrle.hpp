@@ -0,0 +1,37 @@
+#ifndef COMPONENTS_DFOSG_TEXRLE_HPP
+#define COMPONENTS_DFOSG_TEXRLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace DFOSG
+{
+
+/* Decoders for the run-length encoded TEXTURE images. They write 8-bit
+ * palette indices to dst, whose rows are stride bytes apart, and only read
+ * within the given data. They return false if the data ends early or is
+ * otherwise broken, in which case the image is incomplete.
+ */
+
+/* RleCompressed: a code byte below 0x80 is followed by code+1 literal bytes,
+ * and any other is followed by a byte repeated code-0x7f times. Runs carry
+ * on from one row to the next.
+ */
+bool decode_rle(const uint8_t *src, size_t len, size_t width, size_t height, uint8_t *dst, size_t stride);
+
+/* ImageRle and RecordRle: a table of four-byte row headers, at rowtable
+ * bytes into the record, giving the offset of each row's data from the
+ * record start and whether the row is encoded. An encoded row starts with
+ * its width, followed by 16-bit codes: a negative one is followed by a byte
+ * repeated -code times, a positive one by that many literal bytes. Other
+ * rows are stored as width raw bytes.
+ */
+bool decode_row_rle(const uint8_t *record, size_t len, size_t rowtable, size_t width, size_t height,
+                    uint8_t *dst, size_t stride);
+
+static const uint16_t sRowIsRle = 0x8000;
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_TEXRLE_HPP */
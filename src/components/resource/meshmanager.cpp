@@ -6,6 +6,7 @@
 #include <osg/Billboard>
 #include <osg/Geometry>
 #include <osg/Texture>
+#include <osg/Texture2DArray>
 #include <osg/AlphaFunc>
 #include <osgDB/ReadFile>
 
@@ -65,29 +66,72 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
 
     DFOSG::Mesh *mesh = DFOSG::MeshLoader::get().load(idx);
 
-    osg::ref_ptr<osg::Geode> geode(new osg::Geode());
+    // Get all the textures up front, so their files are only parsed once.
+    // Planes are sorted by texture, so the layers come in the same order as
+    // the texture changes below.
+    std::vector<size_t> texids;
+    for(const DFOSG::MdlPlane &plane : mesh->getPlanes())
+    {
+        if(texids.empty() || texids.back() != plane.getTextureId())
+            texids.push_back(plane.getTextureId());
+    }
+    std::vector<TextureLayer> layers = TextureManager::get().getTextureLayers(texids);
+    auto nextlayer = layers.begin();
+
+    /* Planes with textures in the same texture array go into one geometry,
+     * with the layer as the third texture coordinate, so they can be drawn
+     * together.
+     */
+    struct Batch {
+        osg::ref_ptr<osg::Texture> mTexture;
+        osg::ref_ptr<osg::Vec3Array> mVertices;
+        osg::ref_ptr<osg::Vec3Array> mNormals;
+        osg::ref_ptr<osg::Vec3Array> mTexCoords;
+        osg::ref_ptr<osg::Vec4ubArray> mColors;
+        osg::ref_ptr<osg::DrawElementsUShort> mIndices;
+    };
+    std::map<size_t,Batch> batches;
+
     for(auto iter = mesh->getPlanes().begin();iter != mesh->getPlanes().end();)
     {
-        osg::ref_ptr<osg::Vec3Array> vtxs(new osg::Vec3Array());
-        osg::ref_ptr<osg::Vec3Array> nrms(new osg::Vec3Array());
-        osg::ref_ptr<osg::Vec2Array> texcrds(new osg::Vec2Array());
-        osg::ref_ptr<osg::Vec4ubArray> colors(new osg::Vec4ubArray());
-        osg::ref_ptr<osg::DrawElementsUShort> idxs(new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES));
         uint16_t texid = iter->getTextureId();
+        const TextureLayer &layer = *(nextlayer++);
+        if(!layer.mTexture)
+        {
+            while(++iter != mesh->getPlanes().end() && iter->getTextureId() == texid) { }
+            continue;
+        }
 
-        osg::ref_ptr<osg::Texture> tex = TextureManager::get().getTexture(texid);
-        float width = tex->getTextureWidth();
-        float height = tex->getTextureHeight();
+        Batch &batch = batches[layer.mArrayKey];
+        if(!batch.mVertices)
+        {
+            batch.mTexture = layer.mTexture;
+            batch.mVertices = new osg::Vec3Array();
+            batch.mNormals = new osg::Vec3Array();
+            batch.mTexCoords = new osg::Vec3Array();
+            batch.mColors = new osg::Vec4ubArray();
+            batch.mIndices = new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+        }
+        osg::Vec3Array *vtxs = batch.mVertices;
+        osg::Vec3Array *nrms = batch.mNormals;
+        osg::Vec3Array *texcrds = batch.mTexCoords;
+        osg::Vec4ubArray *colors = batch.mColors;
+        osg::DrawElementsUShort *idxs = batch.mIndices;
+
+        float width = layer.mWidth;
+        float height = layer.mHeight;
 
         do {
             const std::vector<DFOSG::MdlPlanePoint> &pts = iter->getPoints();
             size_t last_total = vtxs->size();
+            size_t last_idxs = idxs->size();
 
             vtxs->resize(last_total + pts.size());
             nrms->resize(last_total + pts.size());
             texcrds->resize(last_total + pts.size());
             colors->resize(last_total + pts.size());
-            idxs->resize((last_total + pts.size() - 2) * 3);
+            if(pts.size() > 2)
+                idxs->resize(last_idxs + (pts.size() - 2) * 3);
 
             size_t j = last_total;
             for(const DFOSG::MdlPlanePoint &pt : pts)
@@ -104,45 +148,53 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
 
                 (*texcrds)[j].x() = pt.u() / width;
                 (*texcrds)[j].y() = pt.v() / height;
+                (*texcrds)[j].z() = layer.mLayer;
 
                 (*colors)[j] = osg::Vec4ub(255, 255, 255, 255);
 
                 if(j >= last_total+2)
                 {
-                    (*idxs)[(j-2)*3 + 0] = last_total;
-                    (*idxs)[(j-2)*3 + 1] = j-1;
-                    (*idxs)[(j-2)*3 + 2] = j;
+                    size_t k = last_idxs + (j-last_total-2)*3;
+                    (*idxs)[k + 0] = last_total;
+                    (*idxs)[k + 1] = j-1;
+                    (*idxs)[k + 2] = j;
                 }
 
                 ++j;
             }
         } while(++iter != mesh->getPlanes().end() && iter->getTextureId() == texid);
+    }
+
+    osg::ref_ptr<osg::Geode> geode(new osg::Geode());
+    for(auto &item : batches)
+    {
+        Batch &batch = item.second;
 
         osg::ref_ptr<osg::VertexBufferObject> vbo(new osg::VertexBufferObject());
-        vtxs->setVertexBufferObject(vbo);
-        nrms->setVertexBufferObject(vbo);
-        texcrds->setVertexBufferObject(vbo);
-        colors->setVertexBufferObject(vbo);
-        colors->setNormalize(true);
+        batch.mVertices->setVertexBufferObject(vbo);
+        batch.mNormals->setVertexBufferObject(vbo);
+        batch.mTexCoords->setVertexBufferObject(vbo);
+        batch.mColors->setVertexBufferObject(vbo);
+        batch.mColors->setNormalize(true);
 
         osg::ref_ptr<osg::ElementBufferObject> ebo(new osg::ElementBufferObject());
-        idxs->setElementBufferObject(ebo);
+        batch.mIndices->setElementBufferObject(ebo);
 
         osg::ref_ptr<osg::Geometry> geometry(new osg::Geometry);
-        geometry->setVertexArray(vtxs);
-        geometry->setNormalArray(nrms, osg::Array::BIND_PER_VERTEX);
-        geometry->setTexCoordArray(0, texcrds, osg::Array::BIND_PER_VERTEX);
-        geometry->setColorArray(colors, osg::Array::BIND_PER_VERTEX);
+        geometry->setVertexArray(batch.mVertices);
+        geometry->setNormalArray(batch.mNormals, osg::Array::BIND_PER_VERTEX);
+        geometry->setTexCoordArray(0, batch.mTexCoords, osg::Array::BIND_PER_VERTEX);
+        geometry->setColorArray(batch.mColors, osg::Array::BIND_PER_VERTEX);
         geometry->setUseDisplayList(false);
         geometry->setUseVertexBufferObjects(true);
 
-        geometry->addPrimitiveSet(idxs);
+        geometry->addPrimitiveSet(batch.mIndices);
 
-        /* Cache the stateset used for this texture, so it can be reused for
-         * multiple models (should help OSG batch together objects with similar
-         * state).
+        /* Cache the stateset used for this texture array, so it can be reused
+         * for multiple models (should help OSG batch together objects with
+         * similar state).
          */
-        auto &stateiter = mStateSetCache[texid];
+        auto &stateiter = mStateSetCache[item.first];
         osg::ref_ptr<osg::StateSet> ss;
         if(stateiter.lock(ss) && ss)
             geometry->setStateSet(ss);
@@ -151,7 +203,8 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
             ss = geometry->getOrCreateStateSet();
             ss->setAttributeAndModes(mModelProgram);
             ss->addUniform(new osg::Uniform("diffuseTex", 0));
-            ss->setTextureAttributeAndModes(0, tex);
+            ss->setTextureAttributeAndModes(0, batch.mTexture);
+            TextureManager::get().addPaletteState(ss);
             stateiter = ss;
         }
 
@@ -174,7 +227,11 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
         {
             if(num_frames)
             {
-                osg::ref_ptr<osg::Texture> tex = TextureManager::get().getTexture(texid);
+                int16_t xoffset, yoffset;
+                float xscale, yscale;
+                osg::ref_ptr<osg::Texture> tex = TextureManager::get().requestTexture(
+                    texid, &xoffset, &yoffset, &xscale, &yscale
+                );
                 *num_frames = tex->getTextureDepth();
             }
             return node;
@@ -190,7 +247,8 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
 
     int16_t xoffset, yoffset;
     float xscale, yscale;
-    osg::ref_ptr<osg::Texture> tex = TextureManager::get().getTexture(
+    // The sprite only needs the texture's size, so the image can come later.
+    osg::ref_ptr<osg::Texture> tex = TextureManager::get().requestTexture(
         texid, &xoffset, &yoffset, &xscale, &yscale
     );
     if(num_frames)
@@ -253,6 +311,7 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
     ss->setAttributeAndModes(new osg::AlphaFunc(osg::AlphaFunc::LESS, 0.5f));
     ss->addUniform(new osg::Uniform("diffuseTex", 0));
     ss->setTextureAttributeAndModes(0, tex);
+    TextureManager::get().addPaletteState(ss);
 
     if(centered)
         bb->addDrawable(geometry);
@@ -0,0 +1,329 @@
+
+#include "texturecache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <osg/Image>
+
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+
+#include "components/archives/packarchive.hpp"
+#include "components/archives/packwriter.hpp"
+#include "components/dfosg/texloader.hpp"
+#include "misc/binaryreader.hpp"
+
+
+namespace
+{
+
+const char sVersionName[] = "version";
+
+/* Each entry starts with the image size, frame count, and format (0 for
+ * RGBA, 1 for 8-bit indices), then the offsets and scales, all 16-bit. The
+ * frames' pixels follow, tightly packed.
+ */
+const size_t sEntryHeaderSize = 16;
+
+std::string make_name(size_t idx, uint64_t srchash, uint64_t palhash)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%05x-%016llx-%016llx", (unsigned int)idx,
+             (unsigned long long)srchash, (unsigned long long)palhash);
+    return name;
+}
+
+void put_le16(std::vector<uint8_t> &out, uint16_t value)
+{
+    out.push_back(value&0xff);
+    out.push_back(value>>8);
+}
+
+bool encode_entry(const DFOSG::TexImage &image, std::vector<uint8_t> &out)
+{
+    if(image.mImages.empty() || image.mImages.size() > 0xffff)
+        return false;
+
+    const osg::Image *first = image.mImages[0];
+    bool indexed = (first->getPixelFormat() == GL_RED);
+    size_t bpp = indexed ? 1 : 4;
+    size_t width = first->s(), height = first->t();
+    for(const osg::ref_ptr<osg::Image> &frame : image.mImages)
+    {
+        // Only frames of one size and format, without row padding, can be
+        // stored as is.
+        if((size_t)frame->s() != width || (size_t)frame->t() != height ||
+           frame->getPixelFormat() != first->getPixelFormat() ||
+           frame->getRowSizeInBytes() != width*bpp)
+            return false;
+    }
+
+    out.clear();
+    out.reserve(sEntryHeaderSize + width*height*bpp*image.mImages.size());
+    put_le16(out, width);
+    put_le16(out, height);
+    put_le16(out, image.mImages.size());
+    put_le16(out, indexed ? 1 : 0);
+    put_le16(out, image.mXOffset);
+    put_le16(out, image.mYOffset);
+    put_le16(out, image.mXScale);
+    put_le16(out, image.mYScale);
+    for(const osg::ref_ptr<osg::Image> &frame : image.mImages)
+        out.insert(out.end(), frame->data(), frame->data() + width*height*bpp);
+    return true;
+}
+
+bool decode_entry(const uint8_t *data, size_t size, DFOSG::TexImage &image)
+{
+    if(size < sEntryHeaderSize)
+        return false;
+    Misc::BinaryReader reader(data, size);
+    size_t width = reader.readLE16();
+    size_t height = reader.readLE16();
+    size_t frames = reader.readLE16();
+    uint16_t format = reader.readLE16();
+    image.mXOffset = reader.readLE16();
+    image.mYOffset = reader.readLE16();
+    image.mXScale = reader.readLE16();
+    image.mYScale = reader.readLE16();
+
+    size_t bpp = format ? 1 : 4;
+    size_t framesize = width*height*bpp;
+    if(format > 1 || frames == 0 || (size-sEntryHeaderSize)/frames < framesize)
+        return false;
+
+    image.mImages.clear();
+    const uint8_t *src = data + sEntryHeaderSize;
+    for(size_t i = 0;i < frames;++i)
+    {
+        osg::ref_ptr<osg::Image> frame(new osg::Image());
+        if(format == 0)
+            frame->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        else
+        {
+            frame->allocateImage(width, height, 1, GL_RED, GL_UNSIGNED_BYTE);
+            frame->setInternalTextureFormat(GL_R8);
+        }
+        memcpy(frame->data(), src, framesize);
+        src += framesize;
+        image.mImages.push_back(frame);
+    }
+    return true;
+}
+
+} // namespace
+
+
+namespace Resource
+{
+
+TextureCache::TextureCache()
+  : mPendingBytes(0), mBudget(0), mHits(0), mMisses(0)
+{
+}
+
+TextureCache::~TextureCache()
+{
+}
+
+
+uint64_t TextureCache::hash(const uint8_t *data, size_t size)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0;i < size;++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+void TextureCache::open(const std::string &fname, size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFilename = fname;
+    mBudget = budget;
+    mArchive.reset();
+
+    FILE *file = fopen(mFilename.c_str(), "rb");
+    if(!file) return;
+    fclose(file);
+
+    std::unique_ptr<Archives::PackArchive> archive(new Archives::PackArchive());
+    try {
+        archive->load(mFilename);
+    }
+    catch(std::exception&) {
+        // A broken or foreign store is replaced on the next flush.
+        return;
+    }
+
+    size_t size = 0;
+    const uint8_t *version = archive->getMappedData(sVersionName, size);
+    if(!version || size != 4 || Misc::BinaryReader(version, size).readLE32() != sVersion)
+        return;
+    mArchive = std::move(archive);
+}
+
+
+bool TextureCache::load(size_t idx, uint64_t srchash, uint64_t palhash, DFOSG::TexImage &image)
+{
+    std::string name = make_name(idx, srchash, palhash);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    auto pending = mPending.find(name);
+    if(pending != mPending.end())
+    {
+        data = pending->second.data();
+        size = pending->second.size();
+    }
+    else if(mArchive)
+        data = mArchive->getMappedData(name.c_str(), size);
+
+    if(!data || !decode_entry(data, size, image))
+    {
+        ++mMisses;
+        return false;
+    }
+    ++mHits;
+    mUsed.insert(name);
+    return true;
+}
+
+void TextureCache::store(size_t idx, uint64_t srchash, uint64_t palhash, const DFOSG::TexImage &image)
+{
+    std::vector<uint8_t> data;
+    if(!encode_entry(image, data))
+        return;
+
+    std::string name = make_name(idx, srchash, palhash);
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mArchive && mArchive->exists(name.c_str()))
+        return;
+    // Images past the budget couldn't all be written anyway, so don't hold
+    // on to them until the flush.
+    size_t size = data.size();
+    if(size > mBudget-mPendingBytes)
+        return;
+    if(mPending.emplace(name, std::move(data)).second)
+    {
+        mPendingBytes += size;
+        mUsed.insert(name);
+    }
+}
+
+
+void TextureCache::flush()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!isOpen() || mPending.empty())
+        return;
+
+    // Images used this run come first, then new ones, then the rest, for as
+    // long as they fit.
+    std::vector<std::string> names;
+    std::vector<std::pair<const uint8_t*,size_t>> datas;
+    size_t total = 0;
+    auto add = [&](const std::string &name, const uint8_t *data, size_t size)
+    {
+        if(!data || size > mBudget-total)
+            return;
+        names.push_back(name);
+        datas.push_back(std::make_pair(data, size));
+        total += size;
+    };
+    if(mArchive)
+    {
+        for(const std::string &name : mArchive->list())
+        {
+            if(name == sVersionName || !mUsed.count(name))
+                continue;
+            size_t size = 0;
+            const uint8_t *data = mArchive->getMappedData(name.c_str(), size);
+            add(name, data, size);
+        }
+    }
+    for(const auto &item : mPending)
+        add(item.first, item.second.data(), item.second.size());
+    if(mArchive)
+    {
+        for(const std::string &name : mArchive->list())
+        {
+            if(name == sVersionName || mUsed.count(name))
+                continue;
+            size_t size = 0;
+            const uint8_t *data = mArchive->getMappedData(name.c_str(), size);
+            add(name, data, size);
+        }
+    }
+
+    const uint8_t version[4] = {
+        uint8_t(sVersion), uint8_t(sVersion>>8), uint8_t(sVersion>>16), uint8_t(sVersion>>24)
+    };
+    names.insert(names.begin(), sVersionName);
+    datas.insert(datas.begin(), std::make_pair(version, sizeof(version)));
+
+    std::string tmpname = mFilename + ".tmp";
+    try {
+        Archives::PackWriter writer(tmpname, names, 16);
+        for(const auto &data : datas)
+            writer.add(data.first, data.second, false);
+        writer.finish();
+    }
+    catch(...) {
+        remove(tmpname.c_str());
+        throw;
+    }
+
+    // The old store can't be replaced while it's mapped on some systems.
+    mArchive.reset();
+#ifdef _WIN32
+    remove(mFilename.c_str());
+#endif
+    if(rename(tmpname.c_str(), mFilename.c_str()) != 0)
+    {
+        remove(tmpname.c_str());
+        throw std::runtime_error("Failed to replace "+mFilename);
+    }
+    mPending.clear();
+    mPendingBytes = 0;
+
+    std::unique_ptr<Archives::PackArchive> archive(new Archives::PackArchive());
+    archive->load(mFilename);
+    mArchive = std::move(archive);
+}
+
+
+TextureCacheStats TextureCache::getStats()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    TextureCacheStats stats{mPending.size(), mPendingBytes, mHits, mMisses};
+    if(mArchive)
+    {
+        for(const std::string &name : mArchive->list())
+        {
+            uint64_t start, end;
+            if(name != sVersionName && mArchive->getRange(name.c_str(), start, end))
+            {
+                ++stats.mEntries;
+                stats.mBytes += end - start;
+            }
+        }
+    }
+    return stats;
+}
+
+void TextureCache::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHits = mMisses = 0;
+}
+
+} // namespace Resource
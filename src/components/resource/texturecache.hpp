@@ -0,0 +1,88 @@
+#ifndef COMPONENTS_RESOURCE_TEXTURECACHE_HPP
+#define COMPONENTS_RESOURCE_TEXTURECACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+
+namespace Archives
+{
+    class PackArchive;
+}
+
+namespace DFOSG
+{
+    struct TexImage;
+}
+
+namespace Resource
+{
+
+struct TextureCacheStats {
+    size_t mEntries;
+    size_t mBytes;
+    size_t mHits;
+    size_t mMisses;
+};
+
+/* A persistent store of decoded texture images, so later runs can skip
+ * decoding them. It's a pack archive (see Archives::PackArchive) mapped at
+ * open, with one uncompressed entry per image, named by the texture index,
+ * a hash of its TEXTURE file, and a hash of the palette it was expanded with
+ * (0 for indexed images). A changed file or palette thus just misses.
+ *
+ * New images are kept in memory until flush(), which writes the whole store
+ * to a temporary file and renames it over the old one, so a crash never
+ * leaves a partial store. A store of another version is ignored. The store
+ * is limited to a budget in bytes, and new images past it aren't kept.
+ */
+class TextureCache {
+    std::string mFilename;
+    std::unique_ptr<Archives::PackArchive> mArchive;
+
+    std::map<std::string,std::vector<uint8_t>> mPending;
+    std::set<std::string> mUsed;
+    size_t mPendingBytes;
+    size_t mBudget;
+    size_t mHits, mMisses;
+
+    std::mutex mMutex;
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+public:
+    static const uint32_t sVersion = 1;
+
+    TextureCache();
+    ~TextureCache();
+
+    /* Opens the store, if it exists and is valid, limiting it to budget
+     * bytes. Without a successful open, the cache starts out empty.
+     */
+    void open(const std::string &fname, size_t budget);
+    bool isOpen() const { return !mFilename.empty(); }
+
+    /* Retrieves an image, returning false if it isn't cached. */
+    bool load(size_t idx, uint64_t srchash, uint64_t palhash, DFOSG::TexImage &image);
+    void store(size_t idx, uint64_t srchash, uint64_t palhash, const DFOSG::TexImage &image);
+
+    /* Writes the store with the new images. If it would exceed the budget,
+     * images unused this run are dropped first, then new ones.
+     */
+    void flush();
+
+    TextureCacheStats getStats();
+    void resetStats();
+
+    static uint64_t hash(const uint8_t *data, size_t size);
+};
+
+} // namespace Resource
+
+#endif /* COMPONENTS_RESOURCE_TEXTURECACHE_HPP */
@@ -1,16 +1,149 @@
 
 #include "texturemanager.hpp"
 
-#include <sstream>
-#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <chrono>
 
 #include <osg/Vec3ub>
 #include <osg/Image>
 #include <osg/Texture2D>
 #include <osg/Texture2DArray>
+#include <osg/StateSet>
+#include <osg/Uniform>
+#include <osg/State>
+#include <osg/GLExtensions>
 
 #include "components/vfs/manager.hpp"
 #include "components/dfosg/texloader.hpp"
+#include "components/dfosg/mipgen.hpp"
+#include "misc/threadpool.hpp"
+
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+
+
+namespace
+{
+
+void configure_texture(osg::Texture *tex, bool palettized)
+{
+    tex->setResizeNonPowerOfTwoHint(false);
+    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::REPEAT);
+    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::REPEAT);
+    tex->setUnRefImageDataAfterApply(true);
+    // Filter should be configurable. Defaults to nearest to retain DF's pixely
+    // look (with linear mipmapping to reduce aliasing). Palette indices can't
+    // be filtered or averaged into mipmaps, so those are only sampled nearest.
+    tex->setFilter(osg::Texture::MIN_FILTER, palettized ? osg::Texture::NEAREST :
+                                                          osg::Texture::NEAREST_MIPMAP_LINEAR);
+    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+}
+
+osg::ref_ptr<osg::Texture> create_texture(const DFOSG::ImagePtrArray &images, bool palettized)
+{
+    osg::ref_ptr<osg::Texture> tex;
+    if(images.size() == 1)
+    {
+        osg::ref_ptr<osg::Texture2D> tex2d(new osg::Texture2D(images[0]));
+        tex2d->setTextureSize(images[0]->s(), images[0]->t());
+        tex = tex2d;
+    }
+    else
+    {
+        /* Multiframe textures would ideally be loaded as a Texture2DArray and
+         * animated by offseting the R texture coord. However, they don't work
+         * in the fixed-function pipeline.
+         */
+#if 0
+        osg::ref_ptr<osg::Texture2DArray> tex2darr(new osg::Texture2DArray());
+        tex2darr->setTextureSize(images[0]->s(), images[0]->t(), images.size());
+        tex2darr->setResizeNonPowerOfTwoHint(false);
+        for(size_t i = 0;i < images.size();++i)
+            tex2darr->setImage(i, images[i]);
+        tex = tex2darr;
+#else
+        osg::ref_ptr<osg::Texture2D> tex2d(new osg::Texture2D(images[0]));
+        tex2d->setTextureSize(images[0]->s(), images[0]->t());
+        tex = tex2d;
+#endif
+    }
+
+    configure_texture(tex, palettized);
+    return tex;
+}
+
+/* Estimates the GPU memory of a texture: a byte per texel for palette
+ * indices, or four plus a third more for mipmaps for RGBA, as with texmem.
+ */
+size_t estimate_bytes(const osg::Texture *tex, bool palettized)
+{
+    size_t texels = size_t(tex->getTextureWidth()) * tex->getTextureHeight() * tex->getTextureDepth();
+    return palettized ? texels : (texels*4*4/3);
+}
+
+/* A fully transparent image, standing in for one still being decoded. It
+ * gets mipmaps like the real image will, so texture array layers agree.
+ */
+osg::ref_ptr<osg::Image> create_blank_image(size_t width, size_t height, bool palettized, bool mipmaps)
+{
+    osg::ref_ptr<osg::Image> image(new osg::Image());
+    if(palettized)
+    {
+        // Index 0 is transparent for sprites, as is black for models.
+        image->allocateImage(width, height, 1, GL_RED, GL_UNSIGNED_BYTE);
+        image->setInternalTextureFormat(GL_R8);
+    }
+    else
+        image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    memset(image->data(), 0, image->getTotalSizeInBytes());
+    if(mipmaps)
+        DFOSG::build_mipmaps(image);
+    return image;
+}
+
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+
+/* Allocates the bound texture's storage, mipmaps included if its filter uses
+ * them, cleared to transparent. Arrays need the state's extensions.
+ */
+void allocate_blank(GLenum target, const osg::Texture &texture, int width, int height, int depth,
+                    osg::State &state)
+{
+    GLint intformat = texture.getInternalFormat();
+    GLenum format = (intformat == GL_R8) ? GL_RED : GL_RGBA;
+    size_t bpp = (format == GL_RED) ? 1 : 4;
+    GLint minfilter = texture.getFilter(osg::Texture::MIN_FILTER);
+    bool mipmaps = (minfilter != osg::Texture::NEAREST && minfilter != osg::Texture::LINEAR);
+
+    std::vector<uint8_t> zeros(width*height*depth*bpp);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(int level = 0;;++level)
+    {
+        if(target == GL_TEXTURE_2D_ARRAY)
+            state.get<osg::GLExtensions>()->glTexImage3D(target, level, intformat, width, height, depth, 0, format,
+                                     GL_UNSIGNED_BYTE, zeros.data());
+        else
+            glTexImage2D(target, level, intformat, width, height, 0, format, GL_UNSIGNED_BYTE, zeros.data());
+        if(!mipmaps || (width == 1 && height == 1))
+            break;
+        width = std::max(width/2, 1);
+        height = std::max(height/2, 1);
+    }
+}
+
+bool is_ready(const std::future<std::vector<DFOSG::TexImage>> &future)
+{
+    // Deferred decodes, without a decode pool, are run by get().
+    return future.wait_for(std::chrono::seconds(0)) != std::future_status::timeout;
+}
+
+} // namespace
 
 
 namespace Resource
@@ -20,6 +153,14 @@ TextureManager TextureManager::sManager;
 
 
 TextureManager::TextureManager()
+  : mPaletteHash(0)
+  , mLoadTime(0)
+  , mLazyDecode(false)
+  , mCpuMipmaps(true)
+  , mReferenced(0)
+  , mDecoded(0)
+  , mArrayBatching(true)
+  , mPalettized(false)
 {
 }
 
@@ -28,6 +169,47 @@ TextureManager::~TextureManager()
 }
 
 
+/* Allocates a lazily decoded texture blank when it's first drawn, and
+ * queues it to be decoded. Runs on the draw thread.
+ */
+class TextureManager::LazyTextureCallback : public osg::Texture2D::SubloadCallback {
+    size_t mIndex;
+
+public:
+    LazyTextureCallback(size_t idx) : mIndex(idx) { }
+
+    virtual void load(const osg::Texture2D &texture, osg::State &state) const
+    {
+        allocate_blank(GL_TEXTURE_2D, texture, texture.getTextureWidth(), texture.getTextureHeight(), 1, state);
+
+        TextureManager &texmgr = TextureManager::get();
+        std::lock_guard<std::mutex> lock(texmgr.mDrawnMutex);
+        texmgr.mDrawnTextures.push_back(mIndex);
+    }
+
+    virtual void subload(const osg::Texture2D&, osg::State&) const { }
+};
+
+class TextureManager::LazyArrayCallback : public osg::Texture2DArray::SubloadCallback {
+    size_t mArrayKey;
+
+public:
+    LazyArrayCallback(size_t key) : mArrayKey(key) { }
+
+    virtual void load(const osg::Texture2DArray &texture, osg::State &state) const
+    {
+        allocate_blank(GL_TEXTURE_2D_ARRAY, texture, texture.getTextureWidth(), texture.getTextureHeight(),
+                       texture.getTextureDepth(), state);
+
+        TextureManager &texmgr = TextureManager::get();
+        std::lock_guard<std::mutex> lock(texmgr.mDrawnMutex);
+        texmgr.mDrawnArrays.push_back(mArrayKey);
+    }
+
+    virtual void subload(const osg::Texture2DArray&, osg::State&) const { }
+};
+
+
 void TextureManager::initialize()
 {
     VFS::IStreamPtr stream = VFS::Manager::get().open("PAL.PAL");
@@ -48,18 +230,138 @@ void TextureManager::initialize()
     if(len != sizeof(mCurrentPalette))
         throw std::runtime_error("Invalid palette size (expected 768 or 776 bytes)");
 
-    stream->read(reinterpret_cast<char*>(mCurrentPalette.data()), sizeof(mCurrentPalette));
+    Palette palette;
+    stream->read(reinterpret_cast<char*>(palette.data()), sizeof(palette));
+    setPalette(palette);
+}
+
+
+void TextureManager::setPalettized(bool palettized)
+{
+    finishPending();
+    mPalettized = palettized;
+    mTexCache.clear();
+    mArrayCache.clear();
+    mResidency.clear();
+    // Undrawn textures were made for the old format, and stay blank.
+    mLazyTextures.clear();
+    mLazyArrays.clear();
+    if(mPalettizedUniform)
+        mPalettizedUniform->set(mPalettized);
+}
+
+void TextureManager::setPalette(const Palette &palette)
+{
+    finishPending();
+    mCurrentPalette = palette;
+    mPaletteHash = TextureCache::hash(reinterpret_cast<const uint8_t*>(mCurrentPalette.data()),
+                                      sizeof(mCurrentPalette));
+    if(!mPaletteImage)
+    {
+        mPaletteImage = new osg::Image();
+        mPaletteImage->allocateImage(256, 1, 1, GL_RGB, GL_UNSIGNED_BYTE);
+
+        mPaletteTexture = new osg::Texture2D(mPaletteImage);
+        mPaletteTexture->setTextureSize(256, 1);
+        mPaletteTexture->setResizeNonPowerOfTwoHint(false);
+        mPaletteTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        mPaletteTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        mPaletteTexture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        mPaletteTexture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        // Keep the image, so a palette change is one small upload.
+        mPaletteTexture->setUnRefImageDataAfterApply(false);
+
+        mPaletteUniform = new osg::Uniform("paletteTex", 1);
+        mPalettizedUniform = new osg::Uniform("palettized", mPalettized);
+    }
+    memcpy(mPaletteImage->data(), mCurrentPalette.data(), sizeof(mCurrentPalette));
+    mPaletteImage->dirty();
+
+    // Expanded textures have the old colors baked in.
+    if(!mPalettized)
+    {
+        mTexCache.clear();
+        mArrayCache.clear();
+        mResidency.clear();
+    }
+}
+
+void TextureManager::setArrayBatching(bool batching)
+{
+    finishPending();
+    mArrayBatching = batching;
+    mArrayCache.clear();
+    mResidency.clear();
+}
+
+void TextureManager::addPaletteState(osg::StateSet *ss)
+{
+    // The palette is bound even when unused, so paletteTex never defaults to
+    // unit 0, where a sampler of another type (the texture array) may be.
+    ss->addUniform(mPalettizedUniform);
+    ss->addUniform(mPaletteUniform);
+    ss->setTextureAttributeAndModes(1, mPaletteTexture);
+}
+
+TextureStats TextureManager::getStats()
+{
+    TextureStats stats{0, 0};
+    for(auto iter = mTexCache.begin();iter != mTexCache.end();)
+    {
+        osg::ref_ptr<osg::Texture> tex;
+        if(!iter->second.mTexture.lock(tex))
+            iter = mTexCache.erase(iter);
+        else
+        {
+            ++stats.mCount;
+            stats.mTexels += iter->second.mTexels;
+            ++iter;
+        }
+    }
+    for(const auto &file : mArrayCache)
+    {
+        for(const TextureFileArrays::Array &array : file.second.mArrays)
+        {
+            osg::ref_ptr<osg::Texture2DArray> tex;
+            if(array.mTexture.lock(tex))
+            {
+                ++stats.mCount;
+                stats.mTexels += array.mWidth * array.mHeight * array.mDepth;
+            }
+        }
+    }
+    return stats;
+}
+
+
+osg::ref_ptr<osg::Texture> TextureManager::createTexture(size_t idx, const DFOSG::ImagePtrArray &images,
+                                                         int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale)
+{
+    osg::ref_ptr<osg::Texture> tex = create_texture(images, mPalettized);
+
+    // Only the first frame is uploaded (see create_texture).
+    size_t texels = images[0]->s() * images[0]->t();
+
+    mTexCache[idx] = TextureInfo{
+        tex, xoffset, yoffset, 1.0f + xscale/256.0f, 1.0f + yscale/256.0f, texels
+    };
+    ++mReferenced;
+    useTexture(idx, tex, false);
+    return tex;
 }
 
 
 osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale)
 {
+    waitTexture(idx);
+
     auto iter = mTexCache.find(idx);
     if(iter != mTexCache.end())
     {
         osg::ref_ptr<osg::Texture> tex;
         if(iter->second.mTexture.lock(tex))
         {
+            useTexture(idx, tex, true);
             *xoffset = iter->second.mXOffset;
             *yoffset = iter->second.mYOffset;
             *xscale = iter->second.mXScale;
@@ -68,59 +370,309 @@ osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx, int16_t *xoffs
         }
     }
 
-    int16_t x_offset, y_offset, x_scale, y_scale;
-    std::vector<osg::ref_ptr<osg::Image>> images = DFOSG::TexLoader::get().load(
-        idx, &x_offset, &y_offset, &x_scale, &y_scale, mCurrentPalette
-    );
-    *xoffset = x_offset;
-    *yoffset = y_offset;
-    *xscale = 1.0f + x_scale/256.0f;
-    *yscale = 1.0f + y_scale/256.0f;
-    if(images.empty())
+    DFOSG::TexImage image = loadImages(idx>>7, std::vector<size_t>(1, idx&0x7f))[0];
+    *xoffset = image.mXOffset;
+    *yoffset = image.mYOffset;
+    *xscale = 1.0f + image.mXScale/256.0f;
+    *yscale = 1.0f + image.mYScale/256.0f;
+    if(image.mImages.empty())
         return osg::ref_ptr<osg::Texture>();
 
-    osg::ref_ptr<osg::Texture> tex;
-    if(images.size() == 1)
+    return createTexture(idx, image.mImages, image.mXOffset, image.mYOffset, image.mXScale, image.mYScale);
+}
+
+std::vector<osg::ref_ptr<osg::Texture>> TextureManager::getTextures(const std::vector<size_t> &idxs)
+{
+    std::vector<osg::ref_ptr<osg::Texture>> textures(idxs.size());
+
+    // Group the uncached indices by file, so each file is parsed once.
+    std::map<size_t,std::vector<size_t>> todo;
+    for(size_t i = 0;i < idxs.size();++i)
     {
-        osg::ref_ptr<osg::Texture2D> tex2d(new osg::Texture2D(images[0]));
-        tex2d->setTextureSize(images[0]->s(), images[0]->t());
-        tex = tex2d;
+        waitTexture(idxs[i]);
+        auto iter = mTexCache.find(idxs[i]);
+        if(iter == mTexCache.end() || !iter->second.mTexture.lock(textures[i]))
+            todo[idxs[i]>>7].push_back(i);
+        else
+            useTexture(idxs[i], textures[i], true);
+    }
+
+    for(const auto &file : todo)
+    {
+        std::vector<size_t> imgidxs;
+        imgidxs.reserve(file.second.size());
+        for(size_t i : file.second)
+            imgidxs.push_back(idxs[i]&0x7f);
+
+        std::vector<DFOSG::TexImage> images = loadImages(file.first, imgidxs);
+        for(size_t j = 0;j < images.size();++j)
+        {
+            size_t i = file.second[j];
+            // The same index may be listed more than once.
+            auto iter = mTexCache.find(idxs[i]);
+            if(iter != mTexCache.end() && iter->second.mTexture.lock(textures[i]))
+                continue;
+            if(images[j].mImages.empty())
+                continue;
+
+            const DFOSG::TexImage &image = images[j];
+            textures[i] = createTexture(idxs[i], image.mImages, image.mXOffset, image.mYOffset,
+                                        image.mXScale, image.mYScale);
+        }
+    }
+
+    return textures;
+}
+
+
+std::vector<DFOSG::TexImage> TextureManager::loadImages(size_t fileidx, const std::vector<size_t> &imgidxs)
+{
+    // Indexed images don't depend on the palette.
+    return loadImages(fileidx, imgidxs, mPalettized ? nullptr : &mCurrentPalette,
+                      mPalettized ? 0 : mPaletteHash);
+}
+
+std::vector<DFOSG::TexImage> TextureManager::loadImages(size_t fileidx, const std::vector<size_t> &imgidxs,
+                                                        const Palette *palette, uint64_t palhash)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DFOSG::TexImage> images(imgidxs.size());
+
+    uint64_t srchash = 0;
+    std::vector<size_t> missing;
+    if(mDiskCache.isOpen())
+    {
+        srchash = DFOSG::TexLoader::get().getFileHash(fileidx);
+        for(size_t i = 0;i < imgidxs.size();++i)
+        {
+            if(!mDiskCache.load((fileidx<<7) | imgidxs[i], srchash, palhash, images[i]))
+                missing.push_back(i);
+        }
     }
     else
     {
-        /* Multiframe textures would ideally be loaded as a Texture2DArray and
-         * animated by offseting the R texture coord. However, they don't work
-         * in the fixed-function pipeline.
-         */
-#if 0
-        osg::ref_ptr<osg::Texture2DArray> tex2darr(new osg::Texture2DArray());
-        tex2darr->setTextureSize(images[0]->s(), images[0]->t(), images.size());
-        tex2darr->setResizeNonPowerOfTwoHint(false);
-        for(size_t i = 0;i < images.size();++i)
-            tex2darr->setImage(i, images[i]);
-        tex = tex2darr;
-#else
-        osg::ref_ptr<osg::Texture2D> tex2d(new osg::Texture2D(images[0]));
-        tex2d->setTextureSize(images[0]->s(), images[0]->t());
-        tex = tex2d;
-#endif
+        missing.resize(imgidxs.size());
+        std::iota(missing.begin(), missing.end(), 0);
     }
 
-    tex->setResizeNonPowerOfTwoHint(false);
-    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::REPEAT);
-    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::REPEAT);
-    tex->setUnRefImageDataAfterApply(true);
-    // Filter should be configurable. Defaults to nearest to retain DF's pixely
-    // look (with linear mipmapping to reduce aliasing).
-    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST_MIPMAP_LINEAR);
-    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    if(!missing.empty())
+    {
+        std::vector<size_t> todo;
+        todo.reserve(missing.size());
+        for(size_t i : missing)
+            todo.push_back(imgidxs[i]);
 
-    mTexCache[idx] = TextureInfo{
-        tex, x_offset, y_offset, 1.0f + x_scale/256.0f, 1.0f + y_scale/256.0f
-    };
-    return tex;
+        std::vector<DFOSG::TexImage> decoded = DFOSG::TexLoader::get().loadBatch(fileidx, todo, palette);
+        for(size_t j = 0;j < decoded.size();++j)
+        {
+            if(mDiskCache.isOpen())
+                mDiskCache.store((fileidx<<7) | todo[j], srchash, palhash, decoded[j]);
+            images[missing[j]] = std::move(decoded[j]);
+        }
+    }
+
+    // Build the mipmaps here, often on a decode thread, rather than have the
+    // driver do it on upload. Indexed images have none.
+    if(palette && mCpuMipmaps)
+    {
+        for(DFOSG::TexImage &image : images)
+        {
+            for(const osg::ref_ptr<osg::Image> &frame : image.mImages)
+                DFOSG::build_mipmaps(frame);
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    mLoadTime += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    mDecoded += imgidxs.size();
+    return images;
 }
 
+/* Builds the file's arrays that aren't in live. The first time, this loads
+ * every image to sort them into arrays by size. After that, only the images
+ * of expired arrays are reloaded. With a decode pool or lazy decoding, the
+ * arrays are instead laid out from the image headers, and their images are
+ * decoded later.
+ */
+void TextureManager::loadArrays(size_t fileidx, TextureFileArrays &arrays, std::vector<osg::ref_ptr<osg::Texture2DArray>> &live)
+{
+    bool first = arrays.mLayers.empty();
+    std::vector<size_t> imgidxs;
+    if(first)
+    {
+        imgidxs.resize(DFOSG::TexLoader::get().getImageCount(fileidx));
+        std::iota(imgidxs.begin(), imgidxs.end(), 0);
+    }
+    else for(size_t i = 0;i < arrays.mLayers.size();++i)
+    {
+        if(arrays.mLayers[i].first >= 0 && !live[arrays.mLayers[i].first])
+            imgidxs.push_back(i);
+    }
+
+    // Multiframe textures only use their first frame, as with getTexture. A
+    // size of 0 marks an image that failed to load.
+    bool deferred = (mDecodePool || mLazyDecode);
+    std::vector<DFOSG::TexImage> images;
+    std::vector<std::pair<int,int>> sizes(imgidxs.size(), std::make_pair(0, 0));
+    if(deferred)
+    {
+        for(size_t j = 0;j < imgidxs.size();++j)
+        {
+            DFOSG::TexImageInfo info = DFOSG::TexLoader::get().getImageInfo(fileidx, imgidxs[j]);
+            sizes[j] = std::make_pair((int)info.mWidth, (int)info.mHeight);
+        }
+    }
+    else
+    {
+        images = loadImages(fileidx, imgidxs);
+        for(size_t j = 0;j < images.size();++j)
+        {
+            if(!images[j].mImages.empty())
+                sizes[j] = std::make_pair(images[j].mImages[0]->s(), images[j].mImages[0]->t());
+        }
+    }
+
+    if(first)
+    {
+        arrays.mLayers.assign(imgidxs.size(), std::make_pair(-1, -1));
+        std::map<std::pair<int,int>,int> keys;
+        for(size_t j = 0;j < sizes.size();++j)
+        {
+            if(sizes[j].first == 0)
+                continue;
+            std::pair<int,int> key = mArrayBatching ? sizes[j] : std::make_pair(-1-(int)j, 0);
+            auto ins = keys.insert(std::make_pair(key, (int)arrays.mArrays.size()));
+            if(ins.second)
+            {
+                arrays.mArrays.push_back(TextureFileArrays::Array{
+                    osg::observer_ptr<osg::Texture2DArray>(), sizes[j].first, sizes[j].second, 0
+                });
+                live.emplace_back();
+            }
+            TextureFileArrays::Array &array = arrays.mArrays[ins.first->second];
+            arrays.mLayers[imgidxs[j]] = std::make_pair(ins.first->second, array.mDepth++);
+        }
+    }
+
+    std::vector<osg::ref_ptr<osg::Texture2DArray>> built(arrays.mArrays.size());
+    std::vector<ArrayImages> todo(arrays.mArrays.size());
+    for(size_t j = 0;j < imgidxs.size();++j)
+    {
+        const std::pair<int,int> &layer = arrays.mLayers[imgidxs[j]];
+        if(layer.first < 0 || live[layer.first] || sizes[j].first == 0)
+            continue;
+
+        const TextureFileArrays::Array &array = arrays.mArrays[layer.first];
+        osg::ref_ptr<osg::Texture2DArray> &tex = built[layer.first];
+        if(!tex)
+        {
+            tex = new osg::Texture2DArray();
+            tex->setTextureSize(array.mWidth, array.mHeight, array.mDepth);
+            configure_texture(tex, mPalettized);
+        }
+        if(!deferred)
+            tex->setImage(layer.second, images[j].mImages[0]);
+        else
+        {
+            todo[layer.first].mImages.push_back(imgidxs[j]);
+            todo[layer.first].mLayers.push_back(layer.second);
+        }
+        ++mReferenced;
+    }
+
+    for(size_t i = 0;i < built.size();++i)
+    {
+        if(!built[i]) continue;
+        arrays.mArrays[i].mTexture = built[i];
+        live[i] = built[i];
+        if(!deferred) continue;
+
+        const TextureFileArrays::Array &array = arrays.mArrays[i];
+        ArrayImages &arrimages = todo[i];
+        arrimages.mTexture = built[i];
+        arrimages.mFile = fileidx;
+        arrimages.mWidth = array.mWidth;
+        arrimages.mHeight = array.mHeight;
+        if(mLazyDecode)
+        {
+            size_t key = (fileidx<<7) | i;
+            built[i]->setInternalFormat(mPalettized ? GL_R8 : GL_RGBA);
+            built[i]->setSubloadCallback(new LazyArrayCallback(key));
+            mLazyArrays[key] = std::move(arrimages);
+        }
+        else
+        {
+            osg::ref_ptr<osg::Image> blank = create_blank_image(array.mWidth, array.mHeight, mPalettized, mCpuMipmaps);
+            for(int layer : arrimages.mLayers)
+                built[i]->setImage(layer, blank);
+            decodeArray(arrimages);
+        }
+    }
+}
+
+std::vector<TextureLayer> TextureManager::getTextureLayers(const std::vector<size_t> &idxs)
+{
+    std::vector<TextureLayer> layers(idxs.size());
+
+    std::map<size_t,std::vector<size_t>> files;
+    for(size_t i = 0;i < idxs.size();++i)
+        files[idxs[i]>>7].push_back(i);
+
+    for(const auto &file : files)
+    {
+        TextureFileArrays &arrays = mArrayCache[file.first];
+
+        std::vector<osg::ref_ptr<osg::Texture2DArray>> live(arrays.mArrays.size());
+        for(size_t i = 0;i < live.size();++i)
+            arrays.mArrays[i].mTexture.lock(live[i]);
+
+        bool missing = arrays.mLayers.empty();
+        for(size_t i : file.second)
+        {
+            size_t imgidx = idxs[i]&0x7f;
+            if(imgidx < arrays.mLayers.size() && arrays.mLayers[imgidx].first >= 0 &&
+               !live[arrays.mLayers[imgidx].first])
+                missing = true;
+        }
+        std::vector<bool> hit(live.size());
+        for(size_t i = 0;i < live.size();++i)
+            hit[i] = bool(live[i]);
+        if(missing)
+            loadArrays(file.first, arrays, live);
+
+        std::vector<bool> used(live.size());
+        for(size_t i : file.second)
+        {
+            size_t imgidx = idxs[i]&0x7f;
+            if(imgidx >= arrays.mLayers.size() || arrays.mLayers[imgidx].first < 0)
+                continue;
+
+            const std::pair<int,int> &layer = arrays.mLayers[imgidx];
+            if(!used[layer.first])
+            {
+                used[layer.first] = true;
+                mResidency.use((file.first<<7) | layer.first, true, live[layer.first],
+                               estimate_bytes(live[layer.first], mPalettized),
+                               layer.first < (int)hit.size() && hit[layer.first]);
+            }
+            const TextureFileArrays::Array &array = arrays.mArrays[layer.first];
+            layers[i] = TextureLayer{
+                live[layer.first], (file.first<<7) | layer.first, layer.second,
+                array.mWidth, array.mHeight
+            };
+        }
+    }
+
+    return layers;
+}
+
+
+void TextureManager::useTexture(size_t idx, osg::Texture *tex, bool hit)
+{
+    mResidency.use(idx, false, tex, estimate_bytes(tex, mPalettized), hit);
+}
+
+
 osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx)
 {
     int16_t xoffset, yoffset;
@@ -129,4 +681,254 @@ osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx)
 }
 
 
+void TextureManager::setDecodeThreads(size_t count)
+{
+    finishPending();
+    mDecodePool.reset();
+    if(count > 0)
+        mDecodePool.reset(new Misc::ThreadPool(count));
+}
+
+osg::ref_ptr<osg::Texture> TextureManager::requestTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale)
+{
+    if(!mDecodePool && !mLazyDecode)
+        return getTexture(idx, xoffset, yoffset, xscale, yscale);
+
+    auto iter = mTexCache.find(idx);
+    if(iter != mTexCache.end())
+    {
+        osg::ref_ptr<osg::Texture> tex;
+        if(iter->second.mTexture.lock(tex))
+        {
+            useTexture(idx, tex, true);
+            *xoffset = iter->second.mXOffset;
+            *yoffset = iter->second.mYOffset;
+            *xscale = iter->second.mXScale;
+            *yscale = iter->second.mYScale;
+            return tex;
+        }
+    }
+
+    // The headers give the size and placement, so the placeholder can be
+    // laid out like the real image.
+    DFOSG::TexImageInfo info = DFOSG::TexLoader::get().getImageInfo(idx>>7, idx&0x7f);
+    *xoffset = info.mXOffset;
+    *yoffset = info.mYOffset;
+    *xscale = 1.0f + info.mXScale/256.0f;
+    *yscale = 1.0f + info.mYScale/256.0f;
+
+    if(!mLazyDecode)
+    {
+        osg::ref_ptr<osg::Texture> tex = createTexture(
+            idx, DFOSG::ImagePtrArray(1, create_blank_image(info.mWidth, info.mHeight, mPalettized, mCpuMipmaps)),
+            info.mXOffset, info.mYOffset, info.mXScale, info.mYScale
+        );
+        decodeTexture(idx, static_cast<osg::Texture2D*>(tex.get()));
+        return tex;
+    }
+
+    osg::ref_ptr<osg::Texture2D> tex(new osg::Texture2D());
+    tex->setTextureSize(info.mWidth, info.mHeight);
+    tex->setInternalFormat(mPalettized ? GL_R8 : GL_RGBA);
+    configure_texture(tex, mPalettized);
+    tex->setSubloadCallback(new LazyTextureCallback(idx));
+
+    // Nothing is uploaded until it's drawn.
+    mTexCache[idx] = TextureInfo{
+        tex.get(), *xoffset, *yoffset, *xscale, *yscale, 0
+    };
+    mLazyTextures[idx] = tex;
+    ++mReferenced;
+    useTexture(idx, tex, false);
+    return tex;
+}
+
+/* Starts decoding a texture's image, on the decode pool if there is one.
+ * Otherwise, the decode is deferred to when update() or waitTexture gets it.
+ */
+void TextureManager::decodeTexture(size_t idx, osg::Texture2D *tex)
+{
+    // The job gets its own copy of the palette, as it may change meanwhile.
+    std::shared_ptr<const Palette> palette(mPalettized ? nullptr : new Palette(mCurrentPalette));
+    uint64_t palhash = mPalettized ? 0 : mPaletteHash;
+    size_t fileidx = idx>>7, imgidx = idx&0x7f;
+    auto job = [this, fileidx, imgidx, palette, palhash]()
+    {
+        return loadImages(fileidx, std::vector<size_t>(1, imgidx), palette.get(), palhash);
+    };
+
+    PendingDecode &pending = mPending[idx];
+    pending.mTexture = tex;
+    pending.mImages = mDecodePool ? mDecodePool->submit(job) : std::async(std::launch::deferred, job);
+}
+
+void TextureManager::decodeArray(ArrayImages &images)
+{
+    PendingArray pending;
+    if(!images.mTexture.lock(pending.mTexture))
+        return;
+    pending.mWidth = images.mWidth;
+    pending.mHeight = images.mHeight;
+    pending.mLayers = std::move(images.mLayers);
+
+    std::shared_ptr<const Palette> palette(mPalettized ? nullptr : new Palette(mCurrentPalette));
+    uint64_t palhash = mPalettized ? 0 : mPaletteHash;
+    size_t fileidx = images.mFile;
+    std::vector<size_t> imgidxs = std::move(images.mImages);
+    auto job = [this, fileidx, imgidxs, palette, palhash]()
+    {
+        return loadImages(fileidx, imgidxs, palette.get(), palhash);
+    };
+    pending.mImages = mDecodePool ? mDecodePool->submit(job) : std::async(std::launch::deferred, job);
+    mPendingArrays.push_back(std::move(pending));
+}
+
+void TextureManager::applyPending(size_t idx, PendingDecode &pending)
+{
+    std::vector<DFOSG::TexImage> images;
+    try {
+        images = pending.mImages.get();
+    }
+    catch(std::exception &e) {
+        std::cerr<< "Failed to decode texture "<<idx<<": "<<e.what()<< std::endl;
+        return;
+    }
+    if(images.empty() || images[0].mImages.empty())
+        return;
+
+    // Only the first frame is uploaded (see create_texture). A broken image
+    // may have become a dummy of another size, so the texture is remade
+    // rather than updated.
+    osg::Image *first = images[0].mImages[0];
+    pending.mTexture->setSubloadCallback(nullptr);
+    pending.mTexture->setTextureSize(first->s(), first->t());
+    pending.mTexture->setImage(first);
+    pending.mTexture->dirtyTextureObject();
+
+    auto iter = mTexCache.find(idx);
+    if(iter != mTexCache.end())
+        iter->second.mTexels = first->s() * first->t();
+}
+
+void TextureManager::applyPending(PendingArray &pending)
+{
+    std::vector<DFOSG::TexImage> images;
+    try {
+        images = pending.mImages.get();
+    }
+    catch(std::exception &e) {
+        std::cerr<< "Failed to decode texture array images: "<<e.what()<< std::endl;
+        return;
+    }
+
+    osg::ref_ptr<osg::Image> blank;
+    for(size_t j = 0;j < pending.mLayers.size();++j)
+    {
+        // A broken image may have become a dummy of another size, which the
+        // array can't take. Its layer stays blank.
+        osg::Image *image = nullptr;
+        if(j < images.size() && !images[j].mImages.empty())
+            image = images[j].mImages[0];
+        if(!image || image->s() != pending.mWidth || image->t() != pending.mHeight)
+        {
+            if(!blank)
+                blank = create_blank_image(pending.mWidth, pending.mHeight, mPalettized, mCpuMipmaps);
+            image = blank;
+        }
+        pending.mTexture->setImage(pending.mLayers[j], image);
+    }
+    pending.mTexture->setSubloadCallback(nullptr);
+    pending.mTexture->dirtyTextureObject();
+}
+
+size_t TextureManager::update()
+{
+    std::vector<size_t> textures, arrays;
+    {
+        std::lock_guard<std::mutex> lock(mDrawnMutex);
+        textures.swap(mDrawnTextures);
+        arrays.swap(mDrawnArrays);
+    }
+    for(size_t idx : textures)
+    {
+        auto iter = mLazyTextures.find(idx);
+        if(iter == mLazyTextures.end())
+            continue;
+        osg::ref_ptr<osg::Texture2D> tex;
+        if(iter->second.lock(tex))
+            decodeTexture(idx, tex);
+        mLazyTextures.erase(iter);
+    }
+    for(size_t key : arrays)
+    {
+        auto iter = mLazyArrays.find(key);
+        if(iter == mLazyArrays.end())
+            continue;
+        decodeArray(iter->second);
+        mLazyArrays.erase(iter);
+    }
+
+    size_t count = 0;
+    for(auto iter = mPendingArrays.begin();iter != mPendingArrays.end();)
+    {
+        if(!is_ready(iter->mImages))
+            ++iter;
+        else
+        {
+            applyPending(*iter);
+            count += iter->mLayers.size();
+            iter = mPendingArrays.erase(iter);
+        }
+    }
+    for(auto iter = mPending.begin();iter != mPending.end();)
+    {
+        if(!is_ready(iter->second.mImages))
+            ++iter;
+        else
+        {
+            applyPending(iter->first, iter->second);
+            iter = mPending.erase(iter);
+            ++count;
+        }
+    }
+    return count;
+}
+
+size_t TextureManager::getPendingCount() const
+{
+    size_t count = mPending.size();
+    for(const PendingArray &pending : mPendingArrays)
+        count += pending.mLayers.size();
+    return count;
+}
+
+void TextureManager::waitTexture(size_t idx)
+{
+    auto lazy = mLazyTextures.find(idx);
+    if(lazy != mLazyTextures.end())
+    {
+        osg::ref_ptr<osg::Texture2D> tex;
+        if(lazy->second.lock(tex))
+            decodeTexture(idx, tex);
+        mLazyTextures.erase(lazy);
+    }
+
+    auto iter = mPending.find(idx);
+    if(iter != mPending.end())
+    {
+        applyPending(iter->first, iter->second);
+        mPending.erase(iter);
+    }
+}
+
+void TextureManager::finishPending()
+{
+    for(PendingArray &pending : mPendingArrays)
+        applyPending(pending);
+    mPendingArrays.clear();
+    for(auto &pending : mPending)
+        applyPending(pending.first, pending.second);
+    mPending.clear();
+}
+
 } // namespace Resource
@@ -2,17 +2,41 @@
 #define COMPONENTS_RESOURCE_TEXTUREMANAGER_HPP
 
 #include <string>
+#include <vector>
 #include <array>
 #include <map>
+#include <list>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <mutex>
 #include <cstdint>
 
 #include <osg/ref_ptr>
 #include <osg/observer_ptr>
 
+#include "texturecache.hpp"
+#include "textureresidency.hpp"
+
 
 namespace osg
 {
     class Texture;
+    class Texture2D;
+    class Texture2DArray;
+    class Image;
+    class StateSet;
+    class Uniform;
+}
+
+namespace DFOSG
+{
+    struct TexImage;
+}
+
+namespace Misc
+{
+    class ThreadPool;
 }
 
 namespace Resource
@@ -28,6 +52,40 @@ struct TextureInfo {
 
     int16_t mXOffset, mYOffset;
     float mXScale, mYScale;
+
+    // Texels uploaded for the texture.
+    size_t mTexels;
+};
+
+/* An image of a TEXTURE file, as a layer of a texture array. */
+struct TextureLayer {
+    osg::ref_ptr<osg::Texture2DArray> mTexture;
+    // Identifies mTexture, for sharing state between models using it.
+    size_t mArrayKey;
+    int mLayer;
+    int mWidth, mHeight;
+};
+
+/* The texture arrays built for a TEXTURE file, one for each image size. */
+struct TextureFileArrays {
+    struct Array {
+        osg::observer_ptr<osg::Texture2DArray> mTexture;
+        int mWidth, mHeight, mDepth;
+    };
+    std::vector<Array> mArrays;
+
+    // The array and layer of each image, or -1 if the image has none.
+    std::vector<std::pair<int,int>> mLayers;
+};
+
+struct TextureStats {
+    size_t mCount;
+    size_t mTexels;
+};
+
+struct TextureUsageStats {
+    size_t mReferenced;
+    size_t mDecoded;
 };
 
 class TextureManager {
@@ -35,8 +93,98 @@ class TextureManager {
 
     Palette mCurrentPalette;
     static_assert(sizeof(Palette)==768, "Palette is not 768 bytes");
+    uint64_t mPaletteHash;
+
+    TextureCache mDiskCache;
+    // Time spent getting images, from the disk cache or decoding them, in
+    // microseconds. Background decodes add to it, too.
+    std::atomic<uint64_t> mLoadTime;
+
+    /* A texture requested with requestTexture, whose image is still being
+     * decoded. It shows a blank image of the same size until then.
+     */
+    struct PendingDecode {
+        osg::ref_ptr<osg::Texture2D> mTexture;
+        std::future<std::vector<DFOSG::TexImage>> mImages;
+    };
+    std::map<size_t,PendingDecode> mPending;
+
+    /* The images of a texture array built by loadArrays, that have yet to
+     * be decoded into its layers.
+     */
+    struct ArrayImages {
+        osg::observer_ptr<osg::Texture2DArray> mTexture;
+        size_t mFile;
+        int mWidth, mHeight;
+        std::vector<size_t> mImages;
+        std::vector<int> mLayers;
+    };
+    struct PendingArray {
+        osg::ref_ptr<osg::Texture2DArray> mTexture;
+        int mWidth, mHeight;
+        std::vector<int> mLayers;
+        std::future<std::vector<DFOSG::TexImage>> mImages;
+    };
+    std::list<PendingArray> mPendingArrays;
+    std::unique_ptr<Misc::ThreadPool> mDecodePool;
+
+    /* With lazy decoding, textures start out with only their size, and a
+     * subload callback that allocates them blank when first drawn and
+     * queues their decode. Textures and arrays (by array key) that haven't
+     * been drawn yet are kept here, the drawn ones are queued from the draw
+     * thread for update() to decode.
+     */
+    bool mLazyDecode;
+    // Build RGBA textures' mipmaps when decoding them, instead of on upload.
+    bool mCpuMipmaps;
+    class LazyTextureCallback;
+    class LazyArrayCallback;
+    std::map<size_t,osg::observer_ptr<osg::Texture2D>> mLazyTextures;
+    std::map<size_t,ArrayImages> mLazyArrays;
+    std::vector<size_t> mDrawnTextures, mDrawnArrays;
+    std::mutex mDrawnMutex;
+
+    // Images handed out as textures or array layers, and images decoded (or
+    // loaded from the disk cache), since the last reset.
+    size_t mReferenced;
+    std::atomic<size_t> mDecoded;
 
     std::map<size_t,TextureInfo> mTexCache;
+    std::map<size_t,TextureFileArrays> mArrayCache;
+    // Keeps recently used textures and arrays alive, as the caches above
+    // don't.
+    TextureResidency mResidency;
+
+    // Pack the images of a TEXTURE file into shared arrays. When unset, each
+    // image gets an array of its own.
+    bool mArrayBatching;
+
+    /* In palettized mode, textures keep their 8-bit palette indices, and the
+     * shaders look the colors up in a shared 256x1 palette texture.
+     */
+    bool mPalettized;
+    osg::ref_ptr<osg::Image> mPaletteImage;
+    osg::ref_ptr<osg::Texture2D> mPaletteTexture;
+    osg::ref_ptr<osg::Uniform> mPaletteUniform;
+    osg::ref_ptr<osg::Uniform> mPalettizedUniform;
+
+    osg::ref_ptr<osg::Texture> createTexture(size_t idx, const std::vector<osg::ref_ptr<osg::Image>> &images,
+                                             int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale);
+
+    /* Gets images of a TEXTURE file, from the disk cache if possible. The
+     * images are expanded with the given palette, or left indexed without
+     * one. This may run on a decode thread.
+     */
+    std::vector<DFOSG::TexImage> loadImages(size_t fileidx, const std::vector<size_t> &imgidxs,
+                                            const Palette *palette, uint64_t palhash);
+    std::vector<DFOSG::TexImage> loadImages(size_t fileidx, const std::vector<size_t> &imgidxs);
+
+    void decodeTexture(size_t idx, osg::Texture2D *tex);
+    void decodeArray(ArrayImages &images);
+    void applyPending(size_t idx, PendingDecode &pending);
+    void applyPending(PendingArray &pending);
+    void loadArrays(size_t fileidx, TextureFileArrays &arrays, std::vector<osg::ref_ptr<osg::Texture2DArray>> &live);
+    void useTexture(size_t idx, osg::Texture *tex, bool hit);
 
     TextureManager(const TextureManager&) = delete;
     TextureManager& operator=(const TextureManager&) = delete;
@@ -47,13 +195,117 @@ class TextureManager {
 public:
     void initialize();
 
+    /* Selects palettized or RGBA textures. Set it before loading textures,
+     * as it clears the texture cache.
+     */
+    void setPalettized(bool palettized);
+    bool isPalettized() const { return mPalettized; }
+
+    /* Selects whether a TEXTURE file's same-sized images share an array
+     * (see getTextureLayers). Clears the array cache.
+     */
+    void setArrayBatching(bool batching);
+    bool isArrayBatching() const { return mArrayBatching; }
+
     const Palette &getCurrentPalette() const { return mCurrentPalette; }
 
+    /* Changes the palette. In palettized mode this only updates the palette
+     * texture. Otherwise, textures loaded after this use the new palette.
+     */
+    void setPalette(const Palette &palette);
+
+    /* Adds the palette texture (on unit 1) and uniforms the object and
+     * sprite shaders need, to a stateset using them. They're added in RGBA
+     * mode too, to keep the palette sampler off the diffuse texture's unit.
+     */
+    void addPaletteState(osg::StateSet *ss);
+
+    /* Returns the number of live textures, and their total texels. */
+    TextureStats getStats();
+
+    /* Opens the store of decoded images, used from then on, limited to budget
+     * bytes.
+     */
+    void openDiskCache(const std::string &fname, size_t budget) { mDiskCache.open(fname, budget); }
+    /* Writes newly decoded images to the store. */
+    void flushDiskCache() { mDiskCache.flush(); }
+    TextureCache &getDiskCache() { return mDiskCache; }
+
+    /* Sets the estimated GPU bytes of recently used textures to keep alive
+     * after their last user lets go of them (see TextureResidency).
+     */
+    void setResidentBudget(size_t bytes) { mResidency.setBudget(bytes); }
+    TextureResidency &getResidency() { return mResidency; }
+
+    /* Returns the seconds spent getting images since the last reset. */
+    double getLoadTime() const { return mLoadTime / 1000000.0; }
+    void resetLoadTime() { mLoadTime = 0; }
+
+    /* Sets the number of threads requestTexture and getTextureLayers decode
+     * on. With none, they decode right away (or when first drawn, with lazy
+     * decoding). Waits for pending decodes.
+     */
+    void setDecodeThreads(size_t count);
+
+    /* Selects whether requestTexture and getTextureLayers leave decoding
+     * images until they're first drawn. Textures never drawn are never
+     * decoded.
+     */
+    void setLazyDecode(bool lazy) { mLazyDecode = lazy; }
+    bool isLazyDecode() const { return mLazyDecode; }
+
+    /* Selects whether RGBA textures get their mipmaps built with the images
+     * (see DFOSG::build_mipmaps), or left to the driver. Set it before
+     * loading textures.
+     */
+    void setCpuMipmaps(bool cpumipmaps) { finishPending(); mCpuMipmaps = cpumipmaps; }
+    bool isCpuMipmaps() const { return mCpuMipmaps; }
+
+    /* Returns how many images were handed out, and how many of those were
+     * decoded, since the last reset.
+     */
+    TextureUsageStats getUsageStats() const { return TextureUsageStats{mReferenced, mDecoded}; }
+    void resetUsageStats() { mReferenced = 0; mDecoded = 0; }
+
+    /* Swaps the images of finished decodes into their textures. Call it on
+     * the main thread, once a frame. Returns the number of images swapped
+     * in.
+     */
+    size_t update();
+    /* Waits for all pending decodes, and swaps their images in. */
+    void finishPending();
+    /* Returns the number of images still being decoded. */
+    size_t getPendingCount() const;
+
     // The index has the TEXTURE.??? file number in the upper nine bits, and
     // the image index in the lower 7 bits.
     osg::ref_ptr<osg::Texture> getTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale);
     osg::ref_ptr<osg::Texture> getTexture(size_t idx);
 
+    /* Like getTexture, but decodes the image on a decode thread, or when
+     * it's first drawn with lazy decoding. Until update() finds it done,
+     * the texture is blank, at the right size. getTexture for the same index
+     * decodes and waits for it instead.
+     */
+    osg::ref_ptr<osg::Texture> requestTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale);
+    /* Waits for a requested texture's image, if it's still pending or not
+     * yet drawn.
+     */
+    void waitTexture(size_t idx);
+
+    /* Gets several textures at once, loading those of the same TEXTURE file
+     * together. Textures that fail to load are left null.
+     */
+    std::vector<osg::ref_ptr<osg::Texture>> getTextures(const std::vector<size_t> &idxs);
+
+    /* Gets textures as layers of texture arrays. A TEXTURE file's images of
+     * the same size share an array, so geometry using them can be drawn
+     * together. Textures that fail to load have a null mTexture. With decode
+     * threads or lazy decoding, new arrays are blank until update() fills
+     * them in.
+     */
+    std::vector<TextureLayer> getTextureLayers(const std::vector<size_t> &idxs);
+
     static TextureManager &get() { return sManager; }
 };
 
@@ -0,0 +1,99 @@
+
+#include "textureresidency.hpp"
+
+#include <osg/Texture>
+
+
+namespace Resource
+{
+
+TextureResidency::TextureResidency()
+  : mBytes(0), mBudget(128<<20), mHits(0), mMisses(0), mKept(0), mEvictions(0)
+{
+}
+
+TextureResidency::~TextureResidency()
+{
+}
+
+
+void TextureResidency::trim()
+{
+    while(mBytes > mBudget && !mItems.empty())
+    {
+        const Item &item = mItems.back();
+        mBytes -= item.mBytes;
+        mLookup.erase(std::make_pair(item.mKey, item.mArray));
+        mItems.pop_back();
+        ++mEvictions;
+    }
+}
+
+void TextureResidency::use(size_t key, bool array, osg::Texture *tex, size_t bytes, bool hit)
+{
+    if(hit) ++mHits;
+    else ++mMisses;
+
+    auto iter = mLookup.find(std::make_pair(key, array));
+    if(iter != mLookup.end() && iter->second->mTexture == tex)
+    {
+        // Ours and the caller's.
+        if(hit && tex->referenceCount() <= 2)
+            ++mKept;
+        mItems.splice(mItems.begin(), mItems, iter->second);
+        return;
+    }
+    if(iter != mLookup.end())
+    {
+        // A texture remade for the same key replaces the old one.
+        mBytes -= iter->second->mBytes;
+        mItems.erase(iter->second);
+        mLookup.erase(iter);
+    }
+    if(bytes > mBudget)
+        return;
+
+    mItems.push_front(Item{key, array, tex, bytes});
+    mLookup[std::make_pair(key, array)] = mItems.begin();
+    mBytes += bytes;
+    trim();
+}
+
+
+void TextureResidency::setBudget(size_t bytes)
+{
+    mBudget = bytes;
+    trim();
+}
+
+void TextureResidency::clear()
+{
+    mLookup.clear();
+    mItems.clear();
+    mBytes = 0;
+}
+
+
+TextureResidencyStats TextureResidency::getStats() const
+{
+    return TextureResidencyStats{mHits, mMisses, mKept, mEvictions, mItems.size(), mBytes, mBudget};
+}
+
+void TextureResidency::resetStats()
+{
+    mHits = mMisses = mKept = 0;
+    mEvictions = 0;
+}
+
+std::vector<ResidentTexture> TextureResidency::list() const
+{
+    std::vector<ResidentTexture> textures;
+    textures.reserve(mItems.size());
+    for(const Item &item : mItems)
+        textures.push_back(ResidentTexture{
+            item.mKey, item.mArray, item.mBytes, item.mTexture->referenceCount()-1
+        });
+    return textures;
+}
+
+} // namespace Resource
@@ -0,0 +1,94 @@
+#ifndef COMPONENTS_RESOURCE_TEXTURERESIDENCY_HPP
+#define COMPONENTS_RESOURCE_TEXTURERESIDENCY_HPP
+
+#include <vector>
+#include <list>
+#include <map>
+#include <cstddef>
+
+#include <osg/ref_ptr>
+
+
+namespace osg
+{
+    class Texture;
+}
+
+namespace Resource
+{
+
+struct TextureResidencyStats {
+    size_t mHits;
+    size_t mMisses;
+    // Hits on textures nothing but the residency kept alive.
+    size_t mKept;
+    size_t mEvictions;
+    size_t mEntries;
+    size_t mBytes;
+    size_t mBudget;
+};
+
+struct ResidentTexture {
+    // A texture index, or an array key for texture arrays.
+    size_t mKey;
+    bool mArray;
+    size_t mBytes;
+    // References held outside the residency.
+    int mUsers;
+};
+
+/* Keeps the most recently used textures alive, up to a budget of estimated
+ * GPU bytes, so textures whose users went away needn't be loaded again when
+ * they're next wanted. The least recently used ones are let go first.
+ * Textures still in use elsewhere stay alive after being let go, and
+ * aren't counted against the budget until they're used again.
+ */
+class TextureResidency {
+    struct Item {
+        size_t mKey;
+        bool mArray;
+        osg::ref_ptr<osg::Texture> mTexture;
+        size_t mBytes;
+    };
+
+    std::list<Item> mItems; // Most recently used first
+    std::map<std::pair<size_t,bool>,std::list<Item>::iterator> mLookup;
+    size_t mBytes;
+    size_t mBudget;
+    size_t mHits, mMisses, mKept;
+    size_t mEvictions;
+
+    void trim();
+
+    TextureResidency(const TextureResidency&) = delete;
+    TextureResidency& operator=(const TextureResidency&) = delete;
+
+public:
+    TextureResidency();
+    ~TextureResidency();
+
+    /* Marks a texture as just used, adding it if it isn't resident. A hit
+     * means it was found alive, otherwise it was just made. The caller is
+     * expected to hold a reference to it.
+     */
+    void use(size_t key, bool array, osg::Texture *tex, size_t bytes, bool hit);
+
+    /* Sets the budget in bytes, letting go of the least recently used
+     * textures over it. With 0, nothing is kept.
+     */
+    void setBudget(size_t bytes);
+    size_t getBudget() const { return mBudget; }
+
+    /* Lets go of every texture. */
+    void clear();
+
+    TextureResidencyStats getStats() const;
+    void resetStats();
+
+    /* Returns the resident textures, most recently used first. */
+    std::vector<ResidentTexture> list() const;
+};
+
+} // namespace Resource
+
+#endif /* COMPONENTS_RESOURCE_TEXTURERESIDENCY_HPP */
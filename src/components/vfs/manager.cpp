@@ -14,11 +14,24 @@
 #include <sstream>
 #include <vector>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <cstring>
 
 #include <osgDB/Registry>
 
+#include "misc/threadpool.hpp"
+
 #include "components/archives/archive.hpp"
 #include "components/archives/bsaarchive.hpp"
+#include "components/archives/packarchive.hpp"
 
 #include "osg_callbacks.hpp"
 
@@ -33,6 +46,377 @@ std::vector<std::unique_ptr<Archives::Archive>> gArchives;
 // special handling.
 Archives::BsaArchive gArchitecture;
 Archives::BsaArchive gSound;
+// Set if any packs were added, which may also hold ID-indexed entries.
+bool gHavePacks = false;
+// The IDs of the ID-indexed archives and of the pack entries standing in for
+// them.
+std::set<size_t> gArchIds;
+std::set<size_t> gSoundIds;
+
+/* Where a name in the index resolves to. Archive entries keep the archive
+ * and the name it knows the entry by, loose files keep their full path and
+ * the index of the data path they're in.
+ */
+struct IndexEntry {
+    std::string mName;
+    Archives::Archive *mArchive;
+    std::string mPath;
+    size_t mRoot;
+};
+// Keyed by normalized name, so lookups don't depend on case or separators.
+std::unordered_map<std::string,IndexEntry> gIndex;
+// The listed names of the index, sorted, so glob patterns can skip straight
+// to the names sharing their literal prefix.
+std::vector<std::string> gSortedNames;
+
+// Number of calls the manager made into the filesystem.
+std::atomic<size_t> gFsCallCount(0);
+
+// Set once registration is done. Nothing above may change after that, which
+// is what lets the read paths run on any thread without locking.
+std::atomic<bool> gFrozen(false);
+
+// Runs asynchronous reads. Created when the VFS is frozen.
+std::unique_ptr<Misc::ThreadPool> gIOPool;
+
+
+/* Least-recently-used cache of whole entries. Keys are normalized names,
+ * which are always lower case, or "ARCH3D.BSA:<id>" for architecture IDs so
+ * the two can't collide.
+ */
+class BlobCache {
+    typedef std::pair<std::string,VFS::BlobPtr> Item;
+
+    mutable std::mutex mMutex;
+    std::list<Item> mItems; // Most recently used first
+    std::unordered_map<std::string,std::list<Item>::iterator> mLookup;
+    size_t mBytes;
+    size_t mBudget;
+    size_t mHits;
+    size_t mMisses;
+
+    void trim()
+    {
+        while(mBytes > mBudget && !mItems.empty())
+        {
+            const Item &item = mItems.back();
+            mBytes -= item.second->size();
+            mLookup.erase(item.first);
+            mItems.pop_back();
+        }
+    }
+
+public:
+    BlobCache() : mBytes(0), mBudget(64<<20), mHits(0), mMisses(0) { }
+
+    VFS::BlobPtr get(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mLookup.find(key);
+        if(iter == mLookup.end())
+        {
+            ++mMisses;
+            return VFS::BlobPtr();
+        }
+        ++mHits;
+        mItems.splice(mItems.begin(), mItems, iter->second);
+        return iter->second->second;
+    }
+
+    /* Adds a blob, returning the one already cached if another thread got
+     * there first.
+     */
+    VFS::BlobPtr insert(const std::string &key, VFS::BlobPtr blob)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mLookup.find(key);
+        if(iter != mLookup.end())
+            return iter->second->second;
+        if(blob->size() > mBudget)
+            return blob;
+
+        mItems.emplace_front(key, blob);
+        mLookup[key] = mItems.begin();
+        mBytes += blob->size();
+        trim();
+        return blob;
+    }
+
+    void setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBudget = bytes;
+        trim();
+    }
+
+    VFS::CacheStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return VFS::CacheStats{mHits, mMisses, mItems.size(), mBytes, mBudget};
+    }
+
+    void resetStats()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mHits = mMisses = 0;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLookup.clear();
+        mItems.clear();
+        mBytes = 0;
+    }
+};
+BlobCache gCache;
+
+
+/* Collects opens, bytes, and latencies by source and by extension. Archive
+ * reads and seeks are counted by the archives themselves, and merged in when
+ * the statistics are retrieved.
+ */
+class IOTracker {
+    mutable std::mutex mMutex;
+    std::map<std::string,VFS::AccessStats> mSources;
+    std::map<std::string,VFS::AccessStats> mExtensions;
+
+    static void add(VFS::AccessStats &stats, uint64_t usec, size_t bytes)
+    {
+        size_t bucket = 0;
+        while(bucket < VFS::AccessStats::sNumBuckets-1 && (usec>>bucket) != 0)
+            ++bucket;
+
+        ++stats.mOpens;
+        stats.mBytes += bytes;
+        stats.mTotalUsec += usec;
+        stats.mMaxUsec = std::max(stats.mMaxUsec, usec);
+        ++stats.mLatency[bucket];
+    }
+
+public:
+    void record(const std::string &source, const std::string &ext, std::chrono::steady_clock::time_point start, size_t bytes)
+    {
+        uint64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        add(mSources[source], usec, bytes);
+        add(mExtensions[ext], usec, bytes);
+    }
+
+    VFS::IOStatsReport get() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return VFS::IOStatsReport{mSources, mExtensions};
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSources.clear();
+        mExtensions.clear();
+    }
+};
+IOTracker gIOTracker;
+
+
+/* The entries read since tracing started, in the order they were first read.
+ * Loose files have an empty range.
+ */
+class AccessTrace {
+    struct Entry {
+        std::string mSource;
+        std::string mName;
+        uint64_t mStart, mEnd;
+    };
+
+    mutable std::mutex mMutex;
+    std::atomic<bool> mEnabled;
+    std::unordered_set<std::string> mSeen;
+    std::vector<Entry> mEntries;
+
+public:
+    AccessTrace() : mEnabled(false) { }
+
+    bool isEnabled() const { return mEnabled.load(); }
+    void setEnabled(bool enabled) { mEnabled.store(enabled); }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSeen.clear();
+        mEntries.clear();
+    }
+
+    void record(const std::string &source, const std::string &name, uint64_t start, uint64_t end)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mSeen.insert(source+'\t'+name).second)
+            mEntries.push_back(Entry{source, name, start, end});
+    }
+
+    void write(std::ostream &out) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        out<< "# opendf VFS access trace: source, name, start offset, end offset\n";
+        for(const Entry &entry : mEntries)
+            out<< entry.mSource<<'\t'<<entry.mName<<'\t'<<entry.mStart<<'\t'<<entry.mEnd<<'\n';
+    }
+};
+AccessTrace gTrace;
+
+VFS::BlobPtr read_blob(VFS::IStreamPtr stream)
+{
+    if(!stream) return VFS::BlobPtr();
+    return std::make_shared<const std::vector<uint8_t>>(VFS::read_all(*stream));
+}
+
+std::string normalize_name(const char *name)
+{
+    while(name[0] == '.' && (name[1] == '/' || name[1] == '\\'))
+        name += 2;
+
+    std::string ret;
+    ret.reserve(strlen(name));
+    for(;*name;++name)
+    {
+        char c = *name;
+        if(c == '\\') c = '/';
+        else if(c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+        if(c == '/' && !ret.empty() && ret.back() == '/')
+            continue;
+        ret += c;
+    }
+    return ret;
+}
+
+/* Returns the extension of a normalized name, the part after the last dot in
+ * its last path component. Numbered extensions, like TEXTURE.001's, are all
+ * reported as "nnn" so each format shows up once.
+ */
+std::string extension_of(const std::string &name)
+{
+    size_t pos = name.find_last_of("./");
+    if(pos == std::string::npos || name[pos] != '.')
+        return "(none)";
+
+    std::string ext = name.substr(pos+1);
+    if(!ext.empty() && ext.find_first_not_of("0123456789") == std::string::npos)
+        return "nnn";
+    return ext;
+}
+
+const std::string &source_of(const IndexEntry &entry)
+{
+    if(entry.mArchive)
+        return entry.mArchive->getName();
+    return gRootPaths[entry.mRoot];
+}
+
+void trace_entry(const IndexEntry &entry)
+{
+    if(!gTrace.isEnabled())
+        return;
+
+    uint64_t start = 0, end = 0;
+    if(entry.mArchive)
+        entry.mArchive->getRange(entry.mName.c_str(), start, end);
+    gTrace.record(source_of(entry), entry.mName, start, end);
+}
+
+void trace_id(const Archives::BsaArchive &archive, size_t id)
+{
+    if(!gTrace.isEnabled())
+        return;
+
+    uint64_t start = 0, end = 0;
+    archive.getRange(id, start, end);
+    gTrace.record(archive.getName(), std::to_string(id), start, end);
+}
+
+VFS::IStreamPtr open_entry(const IndexEntry &entry)
+{
+    if(entry.mArchive)
+        return entry.mArchive->open(entry.mName.c_str());
+
+    std::unique_ptr<std::ifstream> stream(new std::ifstream());
+    ++gFsCallCount;
+    stream->open(entry.mPath.c_str(), std::ios_base::binary);
+    if(!stream->good()) return VFS::IStreamPtr();
+    return VFS::IStreamPtr(std::move(stream));
+}
+
+/* Opens an entry of an ID-indexed archive, and traces it. Packs hold these
+ * entries as "<archive>/<id>", and take precedence over the archive. Sets
+ * source to where the entry was found.
+ */
+VFS::IStreamPtr open_id(Archives::BsaArchive &archive, const char *packname, size_t id, const std::string *&source)
+{
+    if(gHavePacks)
+    {
+        auto iter = gIndex.find(std::string(packname)+"/"+std::to_string(id));
+        if(iter != gIndex.end())
+        {
+            VFS::IStreamPtr stream = open_entry(iter->second);
+            if(stream) trace_entry(iter->second);
+            source = &source_of(iter->second);
+            return stream;
+        }
+    }
+
+    VFS::IStreamPtr stream = archive.open(id);
+    if(stream) trace_id(archive, id);
+    source = &archive.getName();
+    return stream;
+}
+
+void write_json_string(std::ostream &out, const std::string &str)
+{
+    out<< '"';
+    for(char c : str)
+    {
+        if(c == '"' || c == '\\')
+            out<< '\\'<<c;
+        else if((unsigned char)c < 0x20)
+        {
+            static const char hex[] = "0123456789abcdef";
+            out<< "\\u00"<<hex[(c>>4)&0xf]<<hex[c&0xf];
+        }
+        else
+            out<< c;
+    }
+    out<< '"';
+}
+
+void write_json_stats(std::ostream &out, const std::map<std::string,VFS::AccessStats> &statmap)
+{
+    out<< "{";
+    bool first = true;
+    for(const auto &item : statmap)
+    {
+        const VFS::AccessStats &stats = item.second;
+        out<< (first ? "\n" : ",\n")<<"    ";
+        first = false;
+        write_json_string(out, item.first);
+        out<< ": {\"opens\": "<<stats.mOpens<<", \"bytes\": "<<stats.mBytes<<
+              ", \"reads\": "<<stats.mReads<<", \"seeks\": "<<stats.mSeeks<<
+              ", \"total_us\": "<<stats.mTotalUsec<<", \"max_us\": "<<stats.mMaxUsec<<
+              ", \"latency\": [";
+        for(size_t i = 0;i < stats.mLatency.size();++i)
+            out<< (i ? ", " : "")<<stats.mLatency[i];
+        out<< "]}";
+    }
+    out<< (first ? "}" : "\n  }");
+}
+
+/* Returns the part of the pattern before its first wildcard. */
+std::string literal_prefix(const char *pattern)
+{
+    size_t len = strcspn(pattern, "*?[\\");
+    return std::string(pattern, len);
+}
 
 }
 
@@ -46,6 +430,18 @@ Manager::Manager()
 
 void Manager::initialize(std::string&& root_path)
 {
+    if(gFrozen.load())
+        throw std::runtime_error("Cannot initialize VFS after it has been frozen");
+
+    if(root_path.empty() && gHavePacks)
+    {
+        // Everything comes from the packs, so there are no BSAs to load or
+        // directories to scan.
+        build_index();
+        osgDB::Registry::instance()->setReadFileCallback(new OSGReadCallback());
+        return;
+    }
+
     if(root_path.empty())
         root_path += "./";
     else if(root_path.back() != '/' && root_path.back() != '\\')
@@ -58,91 +454,274 @@ void Manager::initialize(std::string&& root_path)
     {
         std::unique_ptr<Archives::BsaArchive> archive(new Archives::BsaArchive());
         archive->load(root_path+names[i]);
-        gArchives.push_back(std::move(archive));
+        // Ahead of any packs added already, so they keep precedence.
+        gArchives.insert(gArchives.begin()+i, std::move(archive));
     }
     gArchitecture.load(root_path+"ARCH3D.BSA");
     gSound.load(root_path+"DAGGER.SND");
 
     gRootPaths.push_back(std::move(root_path));
+    build_index();
 
     osgDB::Registry::instance()->setReadFileCallback(new OSGReadCallback());
 }
 
 void Manager::addDataPath(std::string&& path)
 {
+    if(gFrozen.load())
+        throw std::runtime_error("Cannot add data path "+path+" after VFS has been frozen");
+
     if(path.empty())
         path += "./";
     else if(path.back() != '/' && path.back() != '\\')
         path += "/";
     gRootPaths.push_back(std::move(path));
+    build_index();
 }
 
+void Manager::addPack(std::string&& fname)
+{
+    if(gFrozen.load())
+        throw std::runtime_error("Cannot add pack "+fname+" after VFS has been frozen");
+
+    std::unique_ptr<Archives::PackArchive> pack(new Archives::PackArchive());
+    pack->load(fname);
+    gArchives.push_back(std::move(pack));
+    gHavePacks = true;
+    build_index();
+}
 
-IStreamPtr Manager::open(const char *name)
+void Manager::freeze()
 {
-    auto iter = gArchives.rbegin();
-    while(iter != gArchives.rend())
+    if(!gIOPool)
+        gIOPool.reset(new Misc::ThreadPool(Misc::ThreadPool::defaultSize()));
+    gFrozen.store(true);
+}
+
+void Manager::build_index()
+{
+    gIndex.clear();
+
+    /* Sources are added from lowest to highest precedence, so later sources
+     * replace earlier ones: loose files from the oldest path to the newest,
+     * then archives from the oldest to the newest.
+     */
+    for(size_t root = 0;root < gRootPaths.size();++root)
     {
-        IStreamPtr stream((*iter)->open(name));
-        if(stream) return stream;
-        ++iter;
+        const std::string &path = gRootPaths[root];
+        std::set<std::string> names;
+        add_dir(path+".", "", nullptr, names);
+        for(const std::string &name : names)
+            gIndex[normalize_name(name.c_str())] = IndexEntry{name, nullptr, path+name, root};
     }
 
-    std::unique_ptr<std::ifstream> stream(new std::ifstream());
-    auto piter = gRootPaths.rbegin();
-    while(piter != gRootPaths.rend())
+    for(std::unique_ptr<Archives::Archive> &archive : gArchives)
     {
-        stream->open((*piter+name).c_str(), std::ios_base::binary);
-        if(stream->good()) return IStreamPtr(std::move(stream));
-        ++piter;
+        for(const std::string &name : archive->list())
+            gIndex[normalize_name(name.c_str())] = IndexEntry{name, archive.get(), std::string(), 0};
     }
 
-    return IStreamPtr();
+    gArchIds = gArchitecture.getIds();
+    gSoundIds = gSound.getIds();
+    if(gHavePacks)
+    {
+        static const std::string archpre("arch3d.bsa/"), soundpre("dagger.snd/");
+        for(const auto &entry : gIndex)
+        {
+            const std::string &name = entry.first;
+            if(name.compare(0, archpre.size(), archpre) == 0)
+                gArchIds.insert(strtoul(name.c_str()+archpre.size(), nullptr, 10));
+            else if(name.compare(0, soundpre.size(), soundpre) == 0)
+                gSoundIds.insert(strtoul(name.c_str()+soundpre.size(), nullptr, 10));
+        }
+    }
+
+    gSortedNames.clear();
+    gSortedNames.reserve(gIndex.size());
+    for(const auto &entry : gIndex)
+        gSortedNames.push_back(entry.second.mName);
+    std::sort(gSortedNames.begin(), gSortedNames.end());
+}
+
+
+IStreamPtr Manager::open(const char *name)
+{
+    std::string key = normalize_name(name);
+    auto iter = gIndex.find(key);
+    if(iter == gIndex.end())
+        return IStreamPtr();
+
+    auto start = std::chrono::steady_clock::now();
+    IStreamPtr stream = open_entry(iter->second);
+    if(stream)
+    {
+        gIOTracker.record(source_of(iter->second), extension_of(key), start, 0);
+        trace_entry(iter->second);
+    }
+    return stream;
 }
 
 IStreamPtr Manager::openSoundId(size_t id)
 {
-    return gSound.open(id);
+    auto start = std::chrono::steady_clock::now();
+    const std::string *source;
+    IStreamPtr stream = open_id(gSound, "dagger.snd", id, source);
+    if(stream) gIOTracker.record(*source, "(sound)", start, 0);
+    return stream;
 }
 
 IStreamPtr Manager::openArchId(size_t id)
 {
-    return gArchitecture.open(id);
+    auto start = std::chrono::steady_clock::now();
+    const std::string *source;
+    IStreamPtr stream = open_id(gArchitecture, "arch3d.bsa", id, source);
+    if(stream) gIOTracker.record(*source, "(arch3d)", start, 0);
+    return stream;
 }
 
-bool Manager::exists(const char *name)
+std::vector<std::future<bool>> Manager::readBatch(const std::vector<ReadRequest> &requests, const ReadCallback &callback)
 {
-    auto iter = gArchives.rbegin();
-    while(iter != gArchives.rend())
+    if(!gFrozen.load())
+        throw std::runtime_error("Cannot read asynchronously before VFS is frozen");
+
+    std::vector<std::future<bool>> results;
+    results.reserve(requests.size());
+    for(const ReadRequest &request : requests)
     {
-        if((*iter)->exists(name))
-            return true;
-        ++iter;
+        results.push_back(gIOPool->submit([this, request, callback]() -> bool
+        {
+            bool success = false;
+            try {
+                *request.mDest = request.mName.empty() ? readArchId(request.mArchId) :
+                                                         readAll(request.mName.c_str());
+                success = !!*request.mDest;
+            }
+            catch(std::exception&) {
+            }
+            if(callback) callback(request, success);
+            return success;
+        }));
     }
+    return results;
+}
+
+BlobPtr Manager::readAll(const char *name)
+{
+    std::string key = normalize_name(name);
+    BlobPtr blob = gCache.get(key);
+    if(blob) return blob;
+
+    auto iter = gIndex.find(key);
+    if(iter == gIndex.end())
+        return blob;
+
+    auto start = std::chrono::steady_clock::now();
+    blob = read_blob(open_entry(iter->second));
+    if(!blob) return blob;
+    gIOTracker.record(source_of(iter->second), extension_of(key), start, blob->size());
+    trace_entry(iter->second);
+    return gCache.insert(key, std::move(blob));
+}
+
+BlobPtr Manager::readArchId(size_t id)
+{
+    std::string key = "ARCH3D.BSA:"+std::to_string(id);
+    BlobPtr blob = gCache.get(key);
+    if(blob) return blob;
+
+    auto start = std::chrono::steady_clock::now();
+    const std::string *source;
+    blob = read_blob(open_id(gArchitecture, "arch3d.bsa", id, source));
+    if(!blob) return blob;
+    gIOTracker.record(*source, "(arch3d)", start, blob->size());
+    return gCache.insert(key, std::move(blob));
+}
 
-    std::ifstream file;
-    for(const std::string &path : gRootPaths)
+void Manager::setCacheBudget(size_t bytes)
+{
+    gCache.setBudget(bytes);
+}
+
+CacheStats Manager::getCacheStats() const
+{
+    return gCache.getStats();
+}
+
+void Manager::resetCacheStats()
+{
+    gCache.resetStats();
+}
+
+void Manager::clearCache()
+{
+    gCache.clear();
+}
+
+void Manager::dropCaches()
+{
+    gCache.clear();
+    for(std::unique_ptr<Archives::Archive> &archive : gArchives)
+        archive->dropCache();
+    gArchitecture.dropCache();
+    gSound.dropCache();
+    for(const auto &entry : gIndex)
     {
-        file.open((path+name).c_str(), std::ios_base::binary);
-        if(file.is_open()) return true;
+        if(!entry.second.mArchive)
+            Archives::drop_file_cache(entry.second.mPath);
     }
+}
+
+const std::set<size_t> &Manager::listSoundIds() const
+{
+    return gSoundIds;
+}
+
+const std::set<size_t> &Manager::listArchIds() const
+{
+    return gArchIds;
+}
 
-    return false;
+bool Manager::exists(const char *name)
+{
+    return gIndex.find(normalize_name(name)) != gIndex.end();
 }
 
 
 void Manager::add_dir(const std::string &path, const std::string &pre, const char *pattern, std::set<std::string> &names)
 {
+    ++gFsCallCount;
     DIR *dir = opendir(path.c_str());
     if(!dir) return;
 
     dirent *ent;
     while((ent=readdir(dir)) != nullptr)
     {
+        ++gFsCallCount;
         if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
             continue;
 
-        if(!S_ISDIR(ent->d_type))
+        std::string fullname = path+"/"+ent->d_name;
+        bool isdir = (ent->d_type == DT_DIR);
+        bool islink = (ent->d_type == DT_LNK);
+        if(ent->d_type == DT_UNKNOWN || islink)
+        {
+            struct stat st;
+#ifndef _WIN32
+            if(!islink)
+            {
+                ++gFsCallCount;
+                islink = (lstat(fullname.c_str(), &st) == 0 && S_ISLNK(st.st_mode));
+            }
+#endif
+            ++gFsCallCount;
+            isdir = (stat(fullname.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+        }
+        // Symlinked directories are left out, as they may lead back up the
+        // tree and recurse forever. Symlinked files are fine.
+        if(isdir && islink)
+            continue;
+
+        if(!isdir)
         {
             std::string fname = pre + ent->d_name;
             if(!pattern || fnmatch(pattern, fname.c_str(), 0) == 0)
@@ -150,38 +729,202 @@ void Manager::add_dir(const std::string &path, const std::string &pre, const cha
         }
         else
         {
-            std::string newpath = path+"/"+ent->d_name;
             std::string newpre = pre+ent->d_name+"/";
-            add_dir(newpath, newpre, pattern, names);
+            add_dir(fullname, newpre, pattern, names);
         }
     }
 
+    ++gFsCallCount;
     closedir(dir);
 }
 
 std::set<std::string> Manager::list(const char *pattern) const
 {
+    if(!pattern)
+        return std::set<std::string>(gSortedNames.begin(), gSortedNames.end());
+
     std::set<std::string> files;
+    std::string prefix = literal_prefix(pattern);
+    auto iter = std::lower_bound(gSortedNames.begin(), gSortedNames.end(), prefix);
+    for(;iter != gSortedNames.end() && iter->compare(0, prefix.size(), prefix) == 0;++iter)
+    {
+        if(fnmatch(pattern, iter->c_str(), 0) == 0)
+            files.insert(files.end(), *iter);
+    }
+    return files;
+}
+
+IOStatsReport Manager::getIOStats() const
+{
+    IOStatsReport report = gIOTracker.get();
+
+    // The archives know how much their streams actually read, including
+    // streams that were only partially read.
+    auto merge = [&report](const Archives::Archive &archive)
+    {
+        if(archive.getName().empty())
+            return;
+        const Archives::IOStats &iostats = archive.getStats();
+        AccessStats &stats = report.mSources[archive.getName()];
+        stats.mBytes = iostats.mBytes.load();
+        stats.mReads = iostats.mReads.load();
+        stats.mSeeks = iostats.mSeeks.load();
+    };
+    for(const std::unique_ptr<Archives::Archive> &archive : gArchives)
+        merge(*archive);
+    merge(gArchitecture);
+    merge(gSound);
+
+    return report;
+}
+
+void Manager::resetIOStats()
+{
+    gIOTracker.reset();
+    for(std::unique_ptr<Archives::Archive> &archive : gArchives)
+        archive->getStats().reset();
+    gArchitecture.getStats().reset();
+    gSound.getStats().reset();
+}
+
+void Manager::dumpIOStats(const std::string &fname) const
+{
+    std::ofstream out(fname, std::ios_base::binary);
+    if(!out.is_open())
+        throw std::runtime_error("Failed to open "+fname+" for writing");
+
+    IOStatsReport report = getIOStats();
+    out<< "{\n  \"latency_buckets_us\": [";
+    for(size_t i = 0;i < AccessStats::sNumBuckets;++i)
+        out<< (i ? ", " : "")<<(uint64_t(1)<<i);
+    out<< "],\n  \"sources\": ";
+    write_json_stats(out, report.mSources);
+    out<< ",\n  \"extensions\": ";
+    write_json_stats(out, report.mExtensions);
+    out<< "\n}\n";
+
+    if(!out.good())
+        throw std::runtime_error("Failed writing "+fname);
+}
+
+
+void Manager::startTrace()
+{
+    gTrace.clear();
+    gTrace.setEnabled(true);
+}
+
+void Manager::stopTrace()
+{
+    gTrace.setEnabled(false);
+}
+
+void Manager::writeTrace(const std::string &fname) const
+{
+    std::ofstream out(fname, std::ios_base::binary);
+    if(!out.is_open())
+        throw std::runtime_error("Failed to open "+fname+" for writing");
+    gTrace.write(out);
+    if(!out.good())
+        throw std::runtime_error("Failed writing "+fname);
+}
+
+size_t Manager::prefetchTrace(const std::string &fname)
+{
+    if(!gFrozen.load())
+        throw std::runtime_error("Cannot prefetch before VFS is frozen");
+
+    std::ifstream in(fname, std::ios_base::binary);
+    if(!in.is_open())
+        return 0;
+
+    /* Resolve the entries now, so the I/O thread only has to pass on the
+     * hints. Names are looked up again rather than trusting the recorded
+     * offsets, in case the data changed since.
+     */
+    struct Prefetch {
+        const Archives::Archive *mArchive;
+        uint64_t mStart, mEnd;
+        std::string mPath;
+    };
+    auto entries = std::make_shared<std::vector<Prefetch>>();
 
-    auto piter = gRootPaths.rbegin();
-    while(piter != gRootPaths.rend())
+    std::string line;
+    while(std::getline(in, line))
     {
-        add_dir(*piter+".", "", pattern, files);
-        ++piter;
+        if(line.empty() || line[0] == '#')
+            continue;
+        size_t tab = line.find('\t');
+        size_t tab2 = (tab == std::string::npos) ? tab : line.find('\t', tab+1);
+        if(tab2 == std::string::npos)
+            continue;
+        std::string source = line.substr(0, tab);
+        std::string name = line.substr(tab+1, tab2-tab-1);
+
+        Prefetch prefetch{nullptr, 0, 0, std::string()};
+        if(source == gArchitecture.getName() || source == gSound.getName())
+        {
+            const Archives::BsaArchive &archive = (source == gSound.getName()) ? gSound : gArchitecture;
+            if(!archive.getRange(strtoul(name.c_str(), nullptr, 10), prefetch.mStart, prefetch.mEnd))
+                continue;
+            prefetch.mArchive = &archive;
+        }
+        else
+        {
+            auto iter = gIndex.find(normalize_name(name.c_str()));
+            if(iter == gIndex.end())
+                continue;
+            const IndexEntry &entry = iter->second;
+            if(entry.mArchive)
+            {
+                if(!entry.mArchive->getRange(entry.mName.c_str(), prefetch.mStart, prefetch.mEnd))
+                    continue;
+                prefetch.mArchive = entry.mArchive;
+            }
+            else
+                prefetch.mPath = entry.mPath;
+        }
+        entries->push_back(std::move(prefetch));
     }
 
-    auto iter = gArchives.rbegin();
-    while(iter != gArchives.rend())
+    gIOPool->submit([entries]()
     {
-        for(const std::string &name : (*iter)->list())
+        for(const Prefetch &prefetch : *entries)
         {
-            if(!pattern || fnmatch(pattern, name.c_str(), 0) == 0)
-                files.insert(name);
+            if(prefetch.mArchive)
+                prefetch.mArchive->prefetch(prefetch.mStart, prefetch.mEnd);
+            else
+            {
+                ++gFsCallCount;
+                Archives::prefetch_file(prefetch.mPath, 0, 0);
+            }
         }
-        ++iter;
+    });
+    return entries->size();
+}
+
+
+uint64_t AccessStats::percentile(double frac) const
+{
+    uint64_t total = 0;
+    for(uint64_t count : mLatency)
+        total += count;
+    if(total == 0)
+        return 0;
+
+    uint64_t count = 0;
+    for(size_t i = 0;i < sNumBuckets;++i)
+    {
+        count += mLatency[i];
+        if(count >= total*frac)
+            return uint64_t(1)<<i;
     }
+    return uint64_t(1)<<(sNumBuckets-1);
+}
 
-    return files;
+size_t Manager::getFsCallCount() const
+{
+    return gFsCallCount.load();
 }
 
 } // namespace VFS
@@ -5,13 +5,20 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 #include <set>
+#include <map>
+#include <array>
+#include <future>
+#include <functional>
 
 
 namespace VFS
 {
 
 typedef std::shared_ptr<std::istream> IStreamPtr;
+/* The complete, immutable contents of an entry. */
+typedef std::shared_ptr<const std::vector<uint8_t>> BlobPtr;
 
 inline uint32_t read_le32(std::istream &stream)
 {
@@ -30,27 +37,182 @@ inline uint16_t read_le16(std::istream &stream)
     return ((uint16_t(buf[0]   )&0x00ff) | (uint16_t(buf[1]<<8)&0xff00));
 }
 
+/* Reads the remainder of the stream into memory, in one read when the stream
+ * can report its size.
+ */
+inline std::vector<uint8_t> read_all(std::istream &stream)
+{
+    std::vector<uint8_t> data;
+
+    std::streampos pos = stream.tellg();
+    if(pos != std::streampos(-1) && stream.seekg(0, std::ios_base::end))
+    {
+        std::streampos end = stream.tellg();
+        stream.seekg(pos);
+        if(end > pos)
+        {
+            data.resize(end - pos);
+            stream.read(reinterpret_cast<char*>(data.data()), data.size());
+            data.resize(stream.gcount());
+        }
+        return data;
+    }
+
+    stream.clear();
+    char buf[4096];
+    while(stream.read(buf, sizeof(buf)) || stream.gcount() > 0)
+        data.insert(data.end(), buf, buf+stream.gcount());
+    return data;
+}
+
+/* An entry to read asynchronously, by name or, if the name is empty, by
+ * ARCH3D ID. The data is stored in *mDest, which must stay valid until the
+ * read completes.
+ */
+struct ReadRequest {
+    std::string mName;
+    size_t mArchId;
+    BlobPtr *mDest;
+};
+
+struct CacheStats {
+    size_t mHits;
+    size_t mMisses;
+    size_t mEntries;
+    size_t mBytes;
+    size_t mBudget;
+};
+typedef std::function<void(const ReadRequest &request, bool success)> ReadCallback;
+
+/* I/O statistics for one source (an archive or data path) or file extension.
+ * Latencies are of opens, and of whole reads for entries read with readAll.
+ * mLatency[i] counts accesses that took under 2^i microseconds, with the
+ * last bucket also holding anything slower.
+ */
+struct AccessStats {
+    static const size_t sNumBuckets = 22;
+
+    uint64_t mOpens;
+    uint64_t mBytes;
+    uint64_t mReads;
+    uint64_t mSeeks;
+    uint64_t mTotalUsec;
+    uint64_t mMaxUsec;
+    std::array<uint64_t,sNumBuckets> mLatency;
+
+    AccessStats() : mOpens(0), mBytes(0), mReads(0), mSeeks(0), mTotalUsec(0), mMaxUsec(0)
+    { mLatency.fill(0); }
+
+    /* Returns the upper bound, in microseconds, of the histogram bucket that
+     * holds the given fraction of accesses.
+     */
+    uint64_t percentile(double frac) const;
+};
+
+struct IOStatsReport {
+    std::map<std::string,AccessStats> mSources;
+    std::map<std::string,AccessStats> mExtensions;
+};
+
 
 class Manager {
     Manager(const Manager&) = delete;
     Manager& operator=(const Manager&) = delete;
 
     static void add_dir(const std::string &path, const std::string &pre, const char *pattern, std::set<std::string> &names);
+    static void build_index();
 
     Manager();
 
 public:
+    /* Archives and data paths may only be registered before freeze() is
+     * called, from one thread. Once frozen, the lookup and open functions
+     * below are safe to call from any number of threads at once.
+     *
+     * initialize() loads the game's BSAs from root_path, and adds it as the
+     * first data path. If packs were added before and root_path is empty,
+     * the data comes from the packs alone, and no BSAs or directories are
+     * read.
+     */
     void initialize(std::string&& root_path=std::string());
     void addDataPath(std::string&& path);
+    /* Adds a pack archive, made with bsatool. Its entries take precedence
+     * over loose files and BSAs, including the ID-indexed ones it holds.
+     * Packs may be added before or after initialize().
+     */
+    void addPack(std::string&& fname);
+    void freeze();
 
     IStreamPtr open(const char *name);
     IStreamPtr open(std::string&& name) { return open(name.c_str()); }
     IStreamPtr openSoundId(size_t id);
     IStreamPtr openArchId(size_t id);
 
+    const std::set<size_t> &listSoundIds() const;
+    const std::set<size_t> &listArchIds() const;
+
+    /* Returns the whole contents of an entry, or null if it doesn't exist.
+     * Results are kept in a cache, up to the cache budget, so repeated reads
+     * of the same entry share one buffer and don't touch the disk again.
+     */
+    BlobPtr readAll(const char *name);
+    BlobPtr readAll(const std::string &name) { return readAll(name.c_str()); }
+    BlobPtr readArchId(size_t id);
+
+    /* Sets the cache budget in bytes, evicting the least recently used
+     * entries as needed. A budget of 0 disables caching.
+     */
+    void setCacheBudget(size_t bytes);
+    CacheStats getCacheStats() const;
+    void resetCacheStats();
+    void clearCache();
+
+    /* Reads a batch of entries on the VFS's I/O threads, through the cache. The returned
+     * futures are in request order, and become ready with whether each read
+     * succeeded. The callback, if given, is called on the I/O thread as each
+     * read completes. Only available after freeze().
+     */
+    std::vector<std::future<bool>> readBatch(const std::vector<ReadRequest> &requests,
+                                             const ReadCallback &callback=ReadCallback());
+
+    /* Clears the VFS cache and asks the OS to drop cached data for all
+     * archives and loose files, so the following reads measure a cold cache.
+     */
+    void dropCaches();
+
     bool exists(const char *name);
     std::set<std::string> list(const char *pattern=nullptr) const;
 
+    /* Returns the opens, bytes, and latencies recorded so far, by source and
+     * by file extension. Reads and seeks are only known for archives. Bytes
+     * read through streams from loose files are not counted.
+     */
+    IOStatsReport getIOStats() const;
+    void resetIOStats();
+    /* Writes the current I/O statistics to the named file as JSON. */
+    void dumpIOStats(const std::string &fname) const;
+
+    /* An access trace records the order in which entries are first read,
+     * with their file offset ranges, from startTrace() until stopTrace().
+     * Starting a trace discards the previous one.
+     * A later run can replay it with prefetchTrace() to warm the OS cache
+     * while it initializes.
+     */
+    void startTrace();
+    void stopTrace();
+    void writeTrace(const std::string &fname) const;
+    /* Reads a trace written by writeTrace() and asks the OS to read ahead
+     * its entries, in order, on an I/O thread. Entries that no longer exist
+     * are skipped. Returns the number of entries queued. Only available
+     * after freeze().
+     */
+    size_t prefetchTrace(const std::string &fname);
+
+    /* Number of calls made into the filesystem so far (directory scans,
+     * stats, and loose file opens). Archive reads are not included.
+     */
+    size_t getFsCallCount() const;
+
     static Manager &get()
     {
         static Manager manager;
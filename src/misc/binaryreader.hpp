@@ -0,0 +1,131 @@
+#ifndef MISC_BINARYREADER_HPP
+#define MISC_BINARYREADER_HPP
+
+#include <stdexcept>
+#include <string>
+#include <array>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Misc
+{
+
+/* Decodes little-endian data from a block of memory. Every read is checked
+ * against the end of the data, throwing a std::runtime_error instead of
+ * reading out of bounds.
+ *
+ * The reader does not own the memory, which must outlive it.
+ */
+class BinaryReader {
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mPos;
+
+    void check(size_t count) const
+    {
+        if(count > mSize-mPos)
+            throw std::runtime_error("Read of "+std::to_string(count)+" bytes at offset "+
+                                     std::to_string(mPos)+" exceeds data size "+std::to_string(mSize));
+    }
+
+    template<typename T>
+    static T decode(const uint8_t *src)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        U val = 0;
+        for(size_t i = 0;i < sizeof(T);++i)
+            val |= U(src[i]) << (i*8);
+        return T(val);
+    }
+
+public:
+    BinaryReader(const uint8_t *data, size_t size) : mData(data), mSize(size), mPos(0) { }
+
+    size_t size() const { return mSize; }
+    size_t tell() const { return mPos; }
+    size_t remaining() const { return mSize - mPos; }
+    bool eof() const { return mPos >= mSize; }
+
+    void seek(size_t pos)
+    {
+        if(pos > mSize)
+            throw std::runtime_error("Seek to offset "+std::to_string(pos)+" exceeds data size "+
+                                     std::to_string(mSize));
+        mPos = pos;
+    }
+    void skip(size_t count)
+    {
+        check(count);
+        mPos += count;
+    }
+
+    uint8_t readU8()
+    {
+        check(1);
+        return mData[mPos++];
+    }
+    uint16_t readLE16()
+    {
+        check(2);
+        uint16_t val = decode<uint16_t>(mData+mPos);
+        mPos += 2;
+        return val;
+    }
+    uint32_t readLE32()
+    {
+        check(4);
+        uint32_t val = decode<uint32_t>(mData+mPos);
+        mPos += 4;
+        return val;
+    }
+    uint64_t readLE64()
+    {
+        check(8);
+        uint64_t val = decode<uint64_t>(mData+mPos);
+        mPos += 8;
+        return val;
+    }
+
+    /* Copies raw bytes. */
+    void read(void *dst, size_t count)
+    {
+        check(count);
+        memcpy(dst, mData+mPos, count);
+        mPos += count;
+    }
+
+    /* Returns a pointer to the next count bytes, and skips past them. */
+    const uint8_t *consume(size_t count)
+    {
+        check(count);
+        const uint8_t *ptr = mData+mPos;
+        mPos += count;
+        return ptr;
+    }
+
+    /* Reads an array of little-endian integers. */
+    template<typename T>
+    void readArray(T *dst, size_t count)
+    {
+        static_assert(std::is_integral<T>::value, "BinaryReader can only read integral types");
+        if(count > (mSize-mPos)/sizeof(T))
+            throw std::runtime_error("Read of "+std::to_string(count)+" elements at offset "+
+                                     std::to_string(mPos)+" exceeds data size "+std::to_string(mSize));
+        if(sizeof(T) == 1)
+            memcpy(dst, mData+mPos, count);
+        else for(size_t i = 0;i < count;++i)
+            dst[i] = decode<T>(mData+mPos + i*sizeof(T));
+        mPos += count*sizeof(T);
+    }
+    template<typename T, size_t N>
+    void readArray(T (&dst)[N]) { readArray(dst, N); }
+    template<typename T, size_t N>
+    void readArray(std::array<T,N> &dst) { readArray(dst.data(), N); }
+};
+
+} // namespace Misc
+
+#endif /* MISC_BINARYREADER_HPP */
@@ -0,0 +1,159 @@
+#ifndef MISC_LZ4_HPP
+#define MISC_LZ4_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Misc
+{
+
+/* A minimal codec for the LZ4 block format (no frame headers or checksums),
+ * compatible with the reference implementation's LZ4_compress_default and
+ * LZ4_decompress_safe. The compressor is a simple greedy one, meant for
+ * offline packing, so favors simplicity over speed and ratio.
+ */
+namespace LZ4
+{
+
+/* Decodes a compressed block of srcsize bytes into exactly dstsize bytes.
+ * Returns false if the data is malformed or doesn't decode to dstsize bytes.
+ */
+inline bool decompress(const uint8_t *src, size_t srcsize, uint8_t *dst, size_t dstsize)
+{
+    const uint8_t *const srcend = src + srcsize;
+    uint8_t *const dstbegin = dst;
+    uint8_t *const dstend = dst + dstsize;
+
+    auto read_length = [&src, srcend](size_t &length) -> bool
+    {
+        if(length != 15)
+            return true;
+        uint8_t b;
+        do {
+            if(src == srcend) return false;
+            b = *(src++);
+            length += b;
+        } while(b == 255);
+        return true;
+    };
+
+    while(src < srcend)
+    {
+        uint8_t token = *(src++);
+
+        size_t litlen = token >> 4;
+        if(!read_length(litlen) || litlen > size_t(srcend-src) || litlen > size_t(dstend-dst))
+            return false;
+        memcpy(dst, src, litlen);
+        src += litlen;
+        dst += litlen;
+
+        // The last sequence only has literals.
+        if(src == srcend)
+            break;
+
+        if(srcend-src < 2)
+            return false;
+        size_t offset = src[0] | (src[1]<<8);
+        src += 2;
+        if(offset == 0 || offset > size_t(dst-dstbegin))
+            return false;
+
+        size_t matchlen = token & 15;
+        if(!read_length(matchlen))
+            return false;
+        matchlen += 4;
+        if(matchlen > size_t(dstend-dst))
+            return false;
+
+        // Matches may overlap their own output, so copy forward bytewise.
+        const uint8_t *match = dst - offset;
+        for(size_t i = 0;i < matchlen;++i)
+            dst[i] = match[i];
+        dst += matchlen;
+    }
+
+    return dst == dstend;
+}
+
+/* Compresses size bytes into a block, replacing the contents of out. */
+inline void compress(const uint8_t *src, size_t size, std::vector<uint8_t> &out)
+{
+    // Format limits: the last 5 bytes are always literals, and the last match
+    // must start at least 12 bytes before the end.
+    static const size_t MinMatch = 4;
+    static const size_t LastLiterals = 5;
+    static const size_t MatchFindLimit = 12;
+    static const size_t HashBits = 12;
+
+    out.clear();
+    out.reserve(size + size/255 + 16);
+
+    auto write_length = [&out](size_t length)
+    {
+        for(;length >= 255;length -= 255)
+            out.push_back(255);
+        out.push_back(uint8_t(length));
+    };
+    auto emit = [&](size_t anchor, size_t litlen, size_t offset, size_t matchlen)
+    {
+        size_t tokenpos = out.size();
+        out.push_back(uint8_t(std::min<size_t>(litlen, 15) << 4));
+        if(litlen >= 15) write_length(litlen - 15);
+        out.insert(out.end(), src+anchor, src+anchor+litlen);
+        if(matchlen == 0) return;
+
+        out.push_back(uint8_t(offset&0xff));
+        out.push_back(uint8_t(offset>>8));
+        matchlen -= MinMatch;
+        out[tokenpos] |= uint8_t(std::min<size_t>(matchlen, 15));
+        if(matchlen >= 15) write_length(matchlen - 15);
+    };
+    auto read32 = [src](size_t pos) -> uint32_t
+    {
+        uint32_t val;
+        memcpy(&val, src+pos, sizeof(val));
+        return val;
+    };
+
+    size_t anchor = 0;
+    if(size > MatchFindLimit)
+    {
+        std::vector<uint32_t> table(size_t(1)<<HashBits, ~uint32_t(0));
+        size_t limit = size - MatchFindLimit;
+        size_t pos = 0;
+        while(pos <= limit)
+        {
+            uint32_t seq = read32(pos);
+            uint32_t &slot = table[(seq*2654435761u) >> (32-HashBits)];
+            size_t ref = slot;
+            slot = uint32_t(pos);
+
+            if(ref == ~uint32_t(0) || pos-ref > 65535 || read32(ref) != seq)
+            {
+                ++pos;
+                continue;
+            }
+
+            size_t matchlen = MinMatch;
+            size_t maxlen = size - LastLiterals - pos;
+            while(matchlen < maxlen && src[ref+matchlen] == src[pos+matchlen])
+                ++matchlen;
+
+            emit(anchor, pos-anchor, pos-ref, matchlen);
+            pos += matchlen;
+            anchor = pos;
+        }
+    }
+    emit(anchor, size-anchor, 0, 0);
+}
+
+} // namespace LZ4
+
+} // namespace Misc
+
+#endif /* MISC_LZ4_HPP */
@@ -0,0 +1,98 @@
+#ifndef MISC_THREADPOOL_HPP
+#define MISC_THREADPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+
+namespace Misc
+{
+
+/* A fixed set of worker threads running queued jobs in FIFO order. Jobs
+ * still queued when the pool is destroyed are run before the workers exit.
+ */
+class ThreadPool {
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void()>> mQueue;
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    bool mQuit;
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(1)
+        {
+            while(mQueue.empty() && !mQuit)
+                mCondVar.wait(lock);
+            if(mQueue.empty())
+                break;
+
+            std::function<void()> job(std::move(mQueue.front()));
+            mQueue.pop_front();
+
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+public:
+    ThreadPool(size_t count) : mQuit(false)
+    {
+        if(count == 0) count = 1;
+        mThreads.reserve(count);
+        for(size_t i = 0;i < count;++i)
+            mThreads.emplace_back(&ThreadPool::run, this);
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mCondVar.notify_all();
+        for(std::thread &thread : mThreads)
+            thread.join();
+    }
+
+    size_t size() const { return mThreads.size(); }
+
+    /* Queues a job, returning a future for its result. An exception thrown
+     * by the job is stored in the future.
+     */
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> submit(F&& func)
+    {
+        typedef typename std::result_of<F()>::type R;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+        std::future<R> future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueue.emplace_back([task]() { (*task)(); });
+        }
+        mCondVar.notify_one();
+        return future;
+    }
+
+    /* Returns a default worker count for the current system. */
+    static size_t defaultSize()
+    {
+        size_t count = std::thread::hardware_concurrency();
+        return (count > 1) ? count : 2;
+    }
+};
+
+} // namespace Misc
+
+#endif /* MISC_THREADPOOL_HPP */
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 
@@ -98,6 +100,26 @@ std::string getUserConfigDir()
     return path;
 }
 
+std::string getUserCacheDir()
+{
+    std::string path;
+#ifdef _WIN32
+    const char *base = getenv("LocalAppData");
+    if(base) path = base;
+#else
+    const char *base = getenv("XDG_CACHE_HOME");
+    if(base && base[0] != 0)
+        path = base;
+    else
+    {
+        base = getenv("HOME");
+        if(base) path = base;
+        path += "/.cache";
+    }
+#endif
+    return path;
+}
+
 void makeDirRecurse(std::string path)
 {
     int err = mkdir(path.c_str(), S_IRWXU);
@@ -127,6 +149,88 @@ CVAR(CVarInt, vid_width, 1280, 0);
 CVAR(CVarInt, vid_height, 720, 0);
 CVAR(CVarBool, vid_fullscreen, false);
 
+// VFS cache budget, in megabytes.
+CVAR(CVarInt, vfs_cachesize, 64, 0);
+// Record the files read up to the first frame, and prefetch them on the next
+// start.
+CVAR(CVarBool, vfs_prefetch, true);
+
+// Keep textures as 8-bit palette indices, and look the colors up in the
+// shaders. Takes effect on restart.
+CVAR(CVarBool, tex_palettized, false);
+// Pack the same-sized images of a TEXTURE file into one texture array, so
+// models using them take fewer draws. Takes effect on restart.
+CVAR(CVarBool, tex_arrays, true);
+// Keep decoded textures on disk, under the user's cache directory, so later
+// runs needn't decode them again. The store is limited to tex_cachesize
+// megabytes, which also caps the new images held in memory until it's written.
+// Takes effect on restart.
+CVAR(CVarBool, tex_diskcache, true);
+CVAR(CVarInt, tex_cachesize, 256, 0);
+// Threads decoding textures in the background, while blank placeholders are
+// shown. With 0, textures are decoded as they're needed, stalling the frame.
+// Takes effect on restart.
+CVAR(CVarInt, tex_decodethreads, 2, 0);
+// Only decode textures once they're drawn, so ones that never come into view
+// cost nothing. Newly drawn textures show blank (models black, sprites not
+// at all) for a frame or more until their decode is done, so it's off by
+// default. Takes effect on restart.
+CVAR(CVarBool, tex_lazydecode, false);
+// Build RGBA textures' mipmaps when decoding them, without letting
+// transparent texels darken the edges, instead of in the driver on upload.
+// Takes effect on restart.
+CVAR(CVarBool, tex_cpumipmaps, true);
+// Estimated GPU memory, in megabytes, of recently used textures to keep
+// around after nothing uses them, so going back to a location doesn't load
+// them again.
+CVAR(CVarInt, tex_residentmb, 128, 0);
+
+
+namespace
+{
+
+/* One sample per frame: how long it took, and how many textures finished
+ * and were still decoding.
+ */
+struct FrameSample {
+    double mTime;
+    size_t mTexturesDone;
+    size_t mTexturesPending;
+};
+std::vector<FrameSample> sFrameTrace;
+bool sFrameTracing = false;
+
+void writeFrameTrace(const std::string &fname)
+{
+    std::ofstream file(fname.c_str());
+    if(!file.is_open())
+        throw std::runtime_error("Failed to open "+fname);
+
+    file<< "frame,ms,textures_done,textures_pending\n";
+    for(size_t i = 0;i < sFrameTrace.size();++i)
+    {
+        const FrameSample &sample = sFrameTrace[i];
+        file<< i<<","<<(sample.mTime*1000.0)<<","<<sample.mTexturesDone<<","<<sample.mTexturesPending<<"\n";
+    }
+    if(!file.good())
+        throw std::runtime_error("Failed to write "+fname);
+
+    std::vector<double> times;
+    times.reserve(sFrameTrace.size());
+    for(const FrameSample &sample : sFrameTrace)
+        times.push_back(sample.mTime);
+    std::sort(times.begin(), times.end());
+    double total = 0.0;
+    for(double time : times)
+        total += time;
+    if(!times.empty())
+        Log::get().stream()<< "Wrote "<<times.size()<<" frames to "<<fname<<": "<<
+            (total*1000.0/times.size())<<"ms average, "<<(times[times.size()*99/100]*1000.0)<<
+            "ms 99th percentile, "<<(times.back()*1000.0)<<"ms worst";
+}
+
+} // namespace
+
 CCMD(qqq)
 {
     SDL_Event evt{};
@@ -160,9 +264,217 @@ CCMD(savecfg)
     CVar::writeAll(ocfg);
 }
 
+CCMD(vfscache)
+{
+    if(params == "reset")
+        VFS::Manager::get().resetCacheStats();
+    else if(!params.empty())
+    {
+        if(!vfs_cachesize.set(params))
+        {
+            Log::get().stream(Log::Level_Error)<< "Failed to set VFS cache size to \""<<params<<"\"";
+            return;
+        }
+        VFS::Manager::get().setCacheBudget(size_t(*vfs_cachesize)<<20);
+    }
+
+    VFS::CacheStats stats = VFS::Manager::get().getCacheStats();
+    size_t total = stats.mHits + stats.mMisses;
+    Log::get().stream()<< "VFS cache: "<<stats.mEntries<<" entries, "<<(stats.mBytes>>10)<<"KB of "<<
+        (stats.mBudget>>10)<<"KB; "<<stats.mHits<<" hits, "<<stats.mMisses<<" misses ("<<
+        (total ? stats.mHits*100/total : 0)<<"% hit rate)";
+}
+
+/* Shows VFS I/O by source and by extension. "reset" clears the counters, and
+ * any other parameter is the name of a JSON file to dump them to.
+ */
+CCMD(vfsstats)
+{
+    if(params == "reset")
+    {
+        VFS::Manager::get().resetIOStats();
+        return;
+    }
+    if(!params.empty())
+    {
+        try {
+            VFS::Manager::get().dumpIOStats(params);
+            Log::get().stream()<< "Wrote VFS stats to "<<params;
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+        return;
+    }
+
+    VFS::IOStatsReport report = VFS::Manager::get().getIOStats();
+    auto show = [](const std::string &name, const VFS::AccessStats &stats)
+    {
+        Log::get().stream()<< "  "<<name<<": "<<stats.mOpens<<" opens, "<<(stats.mBytes>>10)<<"KB, "<<
+            stats.mReads<<" reads, "<<stats.mSeeks<<" seeks; "<<
+            (stats.mOpens ? stats.mTotalUsec/stats.mOpens : 0)<<"us avg, <"<<stats.percentile(0.95)<<
+            "us p95, "<<stats.mMaxUsec<<"us max";
+    };
+    Log::get().message("VFS I/O by source:");
+    for(const auto &item : report.mSources)
+        show(item.first, item.second);
+    Log::get().message("VFS I/O by extension:");
+    for(const auto &item : report.mExtensions)
+        show(item.first, item.second);
+}
+
+/* Records the entries read while, for example, loading a location, for
+ * bsatool to reorder archives by. "start" starts a new trace, "stop" stops
+ * it, and any other parameter is the name of a file to write it to.
+ */
+CCMD(vfstrace)
+{
+    if(params == "start")
+        VFS::Manager::get().startTrace();
+    else if(params == "stop")
+        VFS::Manager::get().stopTrace();
+    else if(!params.empty())
+    {
+        try {
+            VFS::Manager::get().writeTrace(params);
+            Log::get().stream()<< "Wrote VFS trace to "<<params;
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+    else
+        Log::get().message("Usage: vfstrace <start|stop|filename>");
+}
+
+/* Records the time of each frame, to see how much loading a location
+ * stutters. "start" starts a new trace, "stop" stops it, and any other
+ * parameter is the name of a CSV file to write it to.
+ */
+CCMD(frametrace)
+{
+    if(params == "start")
+    {
+        sFrameTrace.clear();
+        sFrameTracing = true;
+    }
+    else if(params == "stop")
+        sFrameTracing = false;
+    else if(!params.empty())
+    {
+        try {
+            writeFrameTrace(params);
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+    else
+        Log::get().message("Usage: frametrace <start|stop|filename>");
+}
+
+/* Shows the decoded texture store's size and hit rate, and the time spent
+ * getting images. "reset" clears the counters, and "flush" writes the store
+ * now instead of at exit.
+ */
+CCMD(texcache)
+{
+    Resource::TextureManager &texmgr = Resource::TextureManager::get();
+    if(params == "reset")
+    {
+        texmgr.getDiskCache().resetStats();
+        texmgr.resetLoadTime();
+        return;
+    }
+    if(params == "flush")
+    {
+        try {
+            texmgr.flushDiskCache();
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+
+    Resource::TextureCacheStats stats = texmgr.getDiskCache().getStats();
+    size_t total = stats.mHits + stats.mMisses;
+    Log::get().stream()<< "Texture cache: "<<stats.mEntries<<" images, "<<(stats.mBytes>>10)<<"KB; "<<
+        stats.mHits<<" hits, "<<stats.mMisses<<" misses ("<<(total ? stats.mHits*100/total : 0)<<
+        "% hit rate); "<<(texmgr.getLoadTime()*1000.0)<<"ms loading images";
+}
+
+/* Shows how many of the textures handed out since entering the current
+ * location were actually decoded. "reset" clears the counts.
+ */
+CCMD(texusage)
+{
+    Resource::TextureManager &texmgr = Resource::TextureManager::get();
+    if(params == "reset")
+    {
+        texmgr.resetUsageStats();
+        return;
+    }
+
+    Resource::TextureUsageStats stats = texmgr.getUsageStats();
+    Log::get().stream()<< "Textures: "<<stats.mDecoded<<" decoded of "<<stats.mReferenced<<
+        " referenced, "<<texmgr.getPendingCount()<<" pending";
+}
+
+/* Shows the memory used by the currently live textures. Palettized textures
+ * take a byte per texel, plus the shared palette. RGBA textures take four,
+ * plus a third more for their mipmaps.
+ */
+CCMD(texmem)
+{
+    Resource::TextureManager &texmgr = Resource::TextureManager::get();
+    Resource::TextureStats stats = texmgr.getStats();
+    size_t bytes = texmgr.isPalettized() ? (stats.mTexels + sizeof(Resource::Palette)) :
+                                           (stats.mTexels*4*4/3);
+    Log::get().stream()<< "Textures ("<<(texmgr.isPalettized() ? "palettized" : "RGBA")<<"): "<<
+        stats.mCount<<" textures, "<<stats.mTexels<<" texels, "<<(bytes>>10)<<"KB";
+}
+
+/* Shows the textures kept resident, with their hits and misses since the last
+ * reset. "reset" clears the counts, "list" also lists each resident texture
+ * (most recently used first), and a number sets the budget in megabytes.
+ */
+CCMD(texresident)
+{
+    Resource::TextureResidency &residency = Resource::TextureManager::get().getResidency();
+    if(params == "reset")
+    {
+        residency.resetStats();
+        return;
+    }
+    if(!params.empty() && params != "list")
+    {
+        if(!tex_residentmb.set(params))
+        {
+            Log::get().stream(Log::Level_Error)<< "Failed to set texture residency budget to \""<<params<<"\"";
+            return;
+        }
+        residency.setBudget(size_t(*tex_residentmb)<<20);
+    }
+
+    if(params == "list")
+    {
+        for(const Resource::ResidentTexture &tex : residency.list())
+            Log::get().stream()<< "  "<<(tex.mArray ? "Array " : "Texture ")<<(tex.mKey>>7)<<":"<<
+                (tex.mKey&0x7f)<<", "<<(tex.mBytes>>10)<<"KB, "<<tex.mUsers<<" users";
+    }
+
+    Resource::TextureResidencyStats stats = residency.getStats();
+    size_t total = stats.mHits + stats.mMisses;
+    Log::get().stream()<< "Resident textures: "<<stats.mEntries<<" textures, "<<(stats.mBytes>>10)<<
+        "KB of "<<(stats.mBudget>>10)<<"KB; "<<stats.mHits<<" hits ("<<stats.mKept<<" kept alive), "<<
+        stats.mMisses<<" misses ("<<(total ? stats.mHits*100/total : 0)<<"% hit rate), "<<
+        stats.mEvictions<<" evictions";
+}
+
 
 Engine::Engine(void)
   : mSDLWindow(nullptr)
+  , mMaxFrames(0)
 {
 }
 
@@ -208,6 +520,16 @@ bool Engine::parseOptions(int argc, char *argv[])
         }
         else if(strcasecmp(argv[i], "-devparm") == 0)
             Log::get().setLevel(Log::Level_Debug);
+        else if(strcasecmp(argv[i], "-frametrace") == 0)
+        {
+            if(i < argc-1)
+                mFrameTraceFile = argv[++i];
+        }
+        else if(strcasecmp(argv[i], "-frames") == 0)
+        {
+            if(i < argc-1)
+                mMaxFrames = strtoul(argv[++i], nullptr, 10);
+        }
         else
         {
             std::stringstream str;
@@ -349,8 +671,17 @@ bool Engine::go(void)
             }
         }
 
+        // Packs go first, as they may hold all the data on their own.
+        Settings::ConfigMultiEntryRange packs = cf.getMultiOptionRange("pack");
+        Settings::ConfigSection::const_iterator path = packs.first;
+        for(;path != packs.second;++path)
+        {
+            Log::get().stream()<< "  Adding pack "<<path->second<<"...";
+            VFS::Manager::get().addPack(path->second.c_str());
+        }
+
         std::string root_path = cf.getOption("data-root", std::string());
-        if(root_path.empty())
+        if(root_path.empty() && packs.first == packs.second)
         {
             std::string user_path = getUserConfigDir();
             if(user_path.empty()) user_path = "settings.cfg";
@@ -360,17 +691,19 @@ bool Engine::go(void)
             user_path<<"\n"<<
             "and add:\n"<<
             "data-root = C:\\DAGGER\\ARENA2\n"<<
-            "where C:\\DAGGER is your Daggerfall install folder";
+            "where C:\\DAGGER is your Daggerfall install folder, or:\n"<<
+            "pack = C:\\DAGGER\\dagger.pack\n"<<
+            "for a pack made with bsatool -p";
             Log::get().message(sstr.str(), Log::Level_Error);
             throw std::runtime_error(sstr.str());
         }
 
-        Log::get().stream()<< "  Setting root path "<<root_path<<"...";
+        if(!root_path.empty())
+            Log::get().stream()<< "  Setting root path "<<root_path<<"...";
         VFS::Manager::get().initialize(root_path.c_str());
 
         Settings::ConfigMultiEntryRange paths = cf.getMultiOptionRange("data");
-        Settings::ConfigSection::const_iterator path = paths.first;
-        for(;path != paths.second;++path)
+        for(path = paths.first;path != paths.second;++path)
         {
             Log::get().stream()<< "  Adding data path "<<path->second<<"...";
             VFS::Manager::get().addDataPath(path->second.c_str());
@@ -384,6 +717,15 @@ bool Engine::go(void)
             Log::get().stream()<< "  Adding data path "<<*path<<"...";
             VFS::Manager::get().addDataPath(*path);
         }
+        VFS::Manager::get().setCacheBudget(size_t(*vfs_cachesize)<<20);
+        VFS::Manager::get().freeze();
+
+        if(*vfs_prefetch)
+        {
+            size_t count = VFS::Manager::get().prefetchTrace(getUserConfigDir()+"/opendf/vfs.trace");
+            Log::get().stream()<< "  Prefetching "<<count<<" entries...";
+            VFS::Manager::get().startTrace();
+        }
     }
 
     // Configure
@@ -449,7 +791,27 @@ bool Engine::go(void)
     SDL_ShowCursor(0);
 
     Log::get().message("Initializing Texture Manager...");
+    Resource::TextureManager::get().setPalettized(*tex_palettized);
+    Resource::TextureManager::get().setArrayBatching(*tex_arrays);
+    if(*tex_diskcache)
+    {
+        std::string cache_dir = getUserCacheDir()+"/opendf";
+        try {
+            struct stat st;
+            if(stat(cache_dir.c_str(), &st) != 0)
+                makeDirRecurse(cache_dir);
+            Resource::TextureManager::get().openDiskCache(cache_dir+"/textures.cache",
+                                                          size_t(*tex_cachesize)<<20);
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
     Resource::TextureManager::get().initialize();
+    Resource::TextureManager::get().setDecodeThreads(*tex_decodethreads);
+    Resource::TextureManager::get().setLazyDecode(*tex_lazydecode);
+    Resource::TextureManager::get().setCpuMipmaps(*tex_cpumipmaps);
+    Resource::TextureManager::get().setResidentBudget(size_t(*tex_residentmb)<<20);
 
     Log::get().message("Initializing Mesh Manager...");
     Resource::MeshManager::get().initialize();
@@ -506,11 +868,19 @@ bool Engine::go(void)
 
     WorldIface::get().initialize(viewer, mSceneRoot);
 
+    if(!mFrameTraceFile.empty())
+        sFrameTracing = true;
+
     // Region: Daggerfall, Location: Privateer's Hold
+    auto load_start = std::chrono::steady_clock::now();
     WorldIface::get().loadDungeonByExterior(17, 179);
+    std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+    Log::get().stream(Log::Level_Debug)<< "Loaded location in "<<(load_time.count()*1000.0)<<"ms";
 
     // And away we go!
     Uint32 last_tick = SDL_GetTicks();
+    bool first_frame = true;
+    size_t frame_count = 0;
     while(!viewer->done() && pumpEvents())
     {
         Uint32 current_tick = SDL_GetTicks();
@@ -518,17 +888,72 @@ bool Engine::go(void)
         last_tick = current_tick;
         float timediff = tick_count / 1000.0;
 
+        auto frame_start = std::chrono::steady_clock::now();
+
         Input::get().update(timediff);
 
         WorldIface::get().update(timediff);
 
+        size_t textures_done = Resource::TextureManager::get().update();
+
         viewer->frame(timediff);
+
+        if(sFrameTracing)
+        {
+            std::chrono::duration<double> frame_time = std::chrono::steady_clock::now() - frame_start;
+            sFrameTrace.push_back(FrameSample{
+                frame_time.count(), textures_done, Resource::TextureManager::get().getPendingCount()
+            });
+        }
+
+        if(first_frame)
+        {
+            // Only the startup reads are worth prefetching.
+            VFS::Manager::get().stopTrace();
+            first_frame = false;
+        }
+
+        if(mMaxFrames > 0 && ++frame_count >= mMaxFrames)
+            break;
     }
     Log::get().message("Main loop shutting down...");
     mSceneRoot->removeChildren(0, mSceneRoot->getNumChildren());
 
+    if(!mFrameTraceFile.empty())
+    {
+        try {
+            writeFrameTrace(mFrameTraceFile);
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+
+    // Let decodes still running finish, so they make it to the disk cache.
+    Resource::TextureManager::get().setDecodeThreads(0);
+
     savecfg(std::string());
 
+    if(*tex_diskcache)
+    {
+        try {
+            Resource::TextureManager::get().flushDiskCache();
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+
+    if(*vfs_prefetch)
+    {
+        try {
+            VFS::Manager::get().writeTrace(getUserConfigDir()+"/opendf/vfs.trace");
+        }
+        catch(std::exception &e) {
+            Log::get().message(e.what(), Log::Level_Error);
+        }
+    }
+
     return true;
 }
 
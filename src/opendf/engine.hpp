@@ -33,6 +33,11 @@ class Engine {
 
     std::vector<const char*> mRootPaths;
 
+    // Frame time trace to write at exit, and the frame count to quit after
+    // (0 to run until told to quit), for timing runs without a user.
+    std::string mFrameTraceFile;
+    size_t mMaxFrames;
+
     osg::ref_ptr<osg::Group> mSceneRoot;
 
     osg::ref_ptr<osg::Camera> mCamera;
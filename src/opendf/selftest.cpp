@@ -0,0 +1,856 @@
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <future>
+#include <numeric>
+#include <cstring>
+
+#include <osg/Image>
+
+#include "components/vfs/manager.hpp"
+#include "components/dfosg/texloader.hpp"
+#include "components/dfosg/texformat.hpp"
+#include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/blockformat.hpp"
+#include "components/dfosg/palexpand.hpp"
+#include "components/dfosg/texrle.hpp"
+#include "components/dfosg/mipgen.hpp"
+#include "components/resource/texturemanager.hpp"
+#include "misc/threadpool.hpp"
+#include "misc/binaryreader.hpp"
+
+#include "cvars.hpp"
+#include "log.hpp"
+
+
+namespace
+{
+
+struct StressEntry {
+    std::string mName;
+    size_t mId;
+    size_t mSize;
+    uint32_t mChecksum;
+};
+
+uint32_t checksum(const std::vector<uint8_t> &data)
+{
+    uint32_t sum = 2166136261u;
+    for(uint8_t c : data)
+        sum = (sum^c) * 16777619u;
+    return sum;
+}
+
+VFS::IStreamPtr open_entry(const StressEntry &entry)
+{
+    if(!entry.mName.empty())
+        return VFS::Manager::get().open(entry.mName.c_str());
+    return VFS::Manager::get().openArchId(entry.mId);
+}
+
+bool check_entry(const StressEntry &entry)
+{
+    VFS::IStreamPtr stream = open_entry(entry);
+    if(!stream) return false;
+    std::vector<uint8_t> data = VFS::read_all(*stream);
+    return data.size() == entry.mSize && checksum(data) == entry.mChecksum;
+}
+
+size_t read_serial(const std::vector<std::string> &names)
+{
+    size_t total = 0;
+    for(const std::string &name : names)
+    {
+        VFS::IStreamPtr stream = VFS::Manager::get().open(name.c_str());
+        if(stream) total += VFS::read_all(*stream).size();
+    }
+    return total;
+}
+
+size_t read_batched(const std::vector<std::string> &names)
+{
+    std::vector<VFS::BlobPtr> data(names.size());
+    std::vector<VFS::ReadRequest> requests;
+    requests.reserve(names.size());
+    for(size_t i = 0;i < names.size();++i)
+        requests.push_back(VFS::ReadRequest{names[i], 0, &data[i]});
+
+    std::atomic<size_t> total(0);
+    std::vector<std::future<bool>> results = VFS::Manager::get().readBatch(requests,
+        [&total](const VFS::ReadRequest &request, bool success)
+        {
+            if(success) total += (*request.mDest)->size();
+        }
+    );
+    for(std::future<bool> &result : results)
+        result.wait();
+    return total.load();
+}
+
+
+/* Reference encoders for the TEXTURE RLE schemes, written plainly from the
+ * format descriptions, to check the decoders against.
+ */
+std::vector<uint8_t> encode_rle(const std::vector<uint8_t> &pixels)
+{
+    std::vector<uint8_t> out;
+    size_t i = 0;
+    while(i < pixels.size())
+    {
+        size_t run = 1;
+        while(i+run < pixels.size() && run < 128 && pixels[i+run] == pixels[i])
+            ++run;
+        if(run >= 3)
+        {
+            out.push_back(0x7f + run);
+            out.push_back(pixels[i]);
+            i += run;
+            continue;
+        }
+
+        size_t count = 0;
+        while(i+count < pixels.size() && count < 128)
+        {
+            if(i+count+2 < pixels.size() && pixels[i+count] == pixels[i+count+1] &&
+               pixels[i+count] == pixels[i+count+2])
+                break;
+            ++count;
+        }
+        out.push_back(count - 1);
+        out.insert(out.end(), pixels.begin()+i, pixels.begin()+i+count);
+        i += count;
+    }
+    return out;
+}
+
+void put_le16(std::vector<uint8_t> &out, uint16_t value)
+{
+    out.push_back(value&0xff);
+    out.push_back(value>>8);
+}
+
+/* Builds a record with the row table at its start, followed by the rows.
+ * Rows are encoded when that makes them smaller.
+ */
+std::vector<uint8_t> encode_row_rle(const std::vector<uint8_t> &pixels, size_t width, size_t height)
+{
+    std::vector<uint8_t> out(height*4);
+    for(size_t y = 0;y < height;++y)
+    {
+        const uint8_t *row = &pixels[y*width];
+        std::vector<uint8_t> enc;
+        put_le16(enc, width);
+        size_t x = 0;
+        while(x < width)
+        {
+            size_t run = 1;
+            while(x+run < width && row[x+run] == row[x])
+                ++run;
+            if(run >= 4)
+            {
+                put_le16(enc, -(int)run);
+                enc.push_back(row[x]);
+                x += run;
+                continue;
+            }
+            size_t count = 0;
+            while(x+count < width)
+            {
+                if(x+count+3 < width && row[x+count] == row[x+count+1] &&
+                   row[x+count] == row[x+count+2] && row[x+count] == row[x+count+3])
+                    break;
+                ++count;
+            }
+            put_le16(enc, count);
+            enc.insert(enc.end(), row+x, row+x+count);
+            x += count;
+        }
+
+        size_t offset = out.size();
+        out[y*4 + 0] = offset&0xff;
+        out[y*4 + 1] = offset>>8;
+        if(enc.size() < width)
+        {
+            out[y*4 + 2] = DFOSG::sRowIsRle&0xff;
+            out[y*4 + 3] = DFOSG::sRowIsRle>>8;
+            out.insert(out.end(), enc.begin(), enc.end());
+        }
+        else
+        {
+            out[y*4 + 2] = 0;
+            out[y*4 + 3] = 0;
+            out.insert(out.end(), row, row+width);
+        }
+    }
+    return out;
+}
+
+/* Random indices in runs of random lengths, like the flat areas and noisy
+ * details of real textures.
+ */
+std::vector<uint8_t> make_rle_image(std::minstd_rand &rng, size_t width, size_t height)
+{
+    std::vector<uint8_t> pixels(width*height);
+    size_t i = 0;
+    while(i < pixels.size())
+    {
+        size_t run = (rng()%4 == 0) ? 1 + rng()%200 : 1;
+        uint8_t value = rng();
+        for(;run > 0 && i < pixels.size();--run)
+            pixels[i++] = value;
+    }
+    return pixels;
+}
+
+/* Random RGBA texels, with the alpha either all opaque, a mix of opaque and
+ * transparent (as with expanded index 0), or anything.
+ */
+std::vector<uint8_t> make_rgba_image(std::minstd_rand &rng, size_t width, size_t height, int alphamode)
+{
+    std::vector<uint8_t> pixels(width*height*4);
+    for(size_t i = 0;i < pixels.size();i += 4)
+    {
+        pixels[i+0] = rng();
+        pixels[i+1] = rng();
+        pixels[i+2] = rng();
+        pixels[i+3] = (alphamode == 0) ? 255 : (alphamode == 1) ? ((rng()%8 == 0) ? 0 : 255) : rng();
+    }
+    return pixels;
+}
+
+/* Builds the mip levels below src into buf with the given path, returning
+ * their total size.
+ */
+size_t build_mip_chain(DFOSG::ExpandPath path, const std::vector<uint8_t> &src, size_t width, size_t height,
+                       std::vector<uint8_t> &buf)
+{
+    size_t total = 0;
+    for(size_t w = width, h = height;w > 1 || h > 1;)
+    {
+        w = std::max<size_t>(w/2, 1);
+        h = std::max<size_t>(h/2, 1);
+        total += w*h*4;
+    }
+    buf.resize(std::max<size_t>(total, 1));
+
+    const uint8_t *level = src.data();
+    size_t offset = 0;
+    while(width > 1 || height > 1)
+    {
+        DFOSG::downsample_rgba(path, level, width, height, &buf[offset]);
+        level = &buf[offset];
+        width = std::max<size_t>(width/2, 1);
+        height = std::max<size_t>(height/2, 1);
+        offset += width*height*4;
+    }
+    return total;
+}
+
+struct ParseTimes {
+    size_t mFiles;
+    size_t mBytes;
+    size_t mFailed;
+    double mTotalMs;
+    // The part of mTotalMs spent parsing, after reading into memory.
+    double mParseMs;
+};
+
+/* Reads each entry into memory and parses it with the given loader, with warm
+ * caches, as the engine does. Entries the loader rejects count as failed.
+ */
+template<typename Parse>
+ParseTimes bench_parse(const std::vector<StressEntry> &entries, Parse parse)
+{
+    typedef std::chrono::steady_clock clock;
+    auto ms = [](clock::duration d) { return std::chrono::duration<double,std::milli>(d).count(); };
+    auto read_entry = [](const StressEntry &entry) -> VFS::BlobPtr
+    {
+        return entry.mName.empty() ? VFS::Manager::get().readArchId(entry.mId) :
+                                     VFS::Manager::get().readAll(entry.mName);
+    };
+
+    ParseTimes times{entries.size(), 0, 0, 0.0, 0.0};
+
+    // Warm the OS cache, without leaving the entries in the VFS cache.
+    for(const StressEntry &entry : entries)
+        read_entry(entry);
+    VFS::Manager::get().clearCache();
+
+    clock::duration parsetime(0);
+    clock::time_point start = clock::now();
+    for(const StressEntry &entry : entries)
+    {
+        VFS::BlobPtr data = read_entry(entry);
+        if(!data) continue;
+        times.mBytes += data->size();
+
+        clock::time_point parsestart = clock::now();
+        try {
+            Misc::BinaryReader reader(data->data(), data->size());
+            parse(reader);
+        }
+        catch(std::exception&) {
+            ++times.mFailed;
+        }
+        parsetime += clock::now() - parsestart;
+    }
+    times.mTotalMs = ms(clock::now() - start);
+    times.mParseMs = ms(parsetime);
+    VFS::Manager::get().clearCache();
+    return times;
+}
+
+void parse_rmb(Misc::BinaryReader &reader)
+{
+    DFOSG::RmbFile rmb;
+    rmb.load(reader);
+}
+
+void parse_rdb(Misc::BinaryReader &reader)
+{
+    DFOSG::RdbFile rdb;
+    rdb.load(reader);
+}
+
+void parse_mdl(Misc::BinaryReader &reader)
+{
+    DFOSG::Mesh mesh;
+    mesh.load(reader);
+}
+
+/* The TEXTURE file header and each image's header, as TexLoader reads them.
+ * The pixels are left to rlebench and palbench.
+ */
+void parse_texture(Misc::BinaryReader &reader)
+{
+    DFOSG::TexFileHeader filehdr;
+    filehdr.load(reader);
+    for(const DFOSG::TexEntryHeader &entryhdr : filehdr.getHeaders())
+    {
+        if(entryhdr.getOffset() == 0)
+            continue;
+        reader.seek(entryhdr.getOffset());
+        DFOSG::TexHeader texhdr;
+        texhdr.load(reader);
+    }
+}
+
+
+}
+
+namespace DF
+{
+
+/* Reads every VFS entry once to get reference checksums, then has a number
+ * of threads open random entries at the same time and compare the results.
+ * Names are also checked with exists() and list().
+ */
+CCMD(vfsstress)
+{
+    const char *str = params.c_str();
+    char *next = nullptr;
+    size_t numthreads = strtoul(str, &next, 10);
+    if(next == str) numthreads = std::max(std::thread::hardware_concurrency(), 2u);
+    str = next;
+    size_t iterations = strtoul(str, &next, 10);
+    if(next == str) iterations = 10000;
+
+    std::vector<StressEntry> entries;
+    for(const std::string &name : VFS::Manager::get().list())
+        entries.push_back(StressEntry{name, 0, 0, 0});
+    for(size_t id : VFS::Manager::get().listArchIds())
+        entries.push_back(StressEntry{std::string(), id, 0, 0});
+
+    std::vector<StressEntry> checked;
+    checked.reserve(entries.size());
+    for(StressEntry &entry : entries)
+    {
+        VFS::IStreamPtr stream = open_entry(entry);
+        if(!stream)
+        {
+            Log::get().stream(Log::Level_Error)<< "Failed to open "<<entry.mName;
+            continue;
+        }
+        std::vector<uint8_t> data = VFS::read_all(*stream);
+        entry.mSize = data.size();
+        entry.mChecksum = checksum(data);
+        checked.push_back(entry);
+    }
+    if(checked.empty())
+    {
+        Log::get().message("No VFS entries to test", Log::Level_Error);
+        return;
+    }
+
+    Log::get().stream()<< "Reading "<<checked.size()<<" entries from "<<numthreads<<" threads, "<<
+        iterations<<" reads each...";
+
+    std::atomic<size_t> failures(0);
+    std::atomic<size_t> bytes(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for(size_t t = 0;t < numthreads;++t)
+    {
+        threads.emplace_back([&checked, &failures, &bytes, iterations, t]()
+        {
+            std::minstd_rand rng(t+1);
+            for(size_t i = 0;i < iterations;++i)
+            {
+                const StressEntry &entry = checked[rng() % checked.size()];
+                if(!check_entry(entry))
+                    ++failures;
+                bytes += entry.mSize;
+
+                if(entry.mName.empty() || (i&63) != 0)
+                    continue;
+                if(!VFS::Manager::get().exists(entry.mName.c_str()))
+                    ++failures;
+                std::string pattern = entry.mName.substr(0, 4) + "*";
+                if(VFS::Manager::get().list(pattern.c_str()).count(entry.mName) == 0)
+                    ++failures;
+            }
+        });
+    }
+    for(std::thread &thread : threads)
+        thread.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Log::get().stream(failures ? Log::Level_Error : Log::Level_Normal)<<
+        failures.load()<<" failures, "<<(bytes.load()/1048576.0/elapsed.count())<<" MB/s over "<<
+        elapsed.count()<<" seconds";
+}
+
+
+/* Compares reading a set of entries one after another with reading them as
+ * one asynchronous batch, on a cold and then a warm OS cache.
+ */
+CCMD(vfsbench)
+{
+    std::set<std::string> list = VFS::Manager::get().list(params.empty() ? nullptr : params.c_str());
+    std::vector<std::string> names(list.begin(), list.end());
+    if(names.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "No entries match \""<<params<<"\"";
+        return;
+    }
+
+    static const char *const modes[2] = { "serial", "batch" };
+    for(size_t mode = 0;mode < 2;++mode)
+    {
+        for(size_t warm = 0;warm < 2;++warm)
+        {
+            if(!warm) VFS::Manager::get().dropCaches();
+            else VFS::Manager::get().clearCache();
+
+            auto start = std::chrono::steady_clock::now();
+            size_t bytes = (mode == 0) ? read_serial(names) : read_batched(names);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            Log::get().stream()<< modes[mode]<<(warm ? ", warm: " : ", cold: ")<<names.size()<<" entries, "<<
+                bytes<<" bytes in "<<(elapsed.count()*1000.0)<<"ms ("<<
+                (bytes/1048576.0/elapsed.count())<<" MB/s)";
+        }
+    }
+}
+
+
+/* Loads every image of the matching TEXTURE files (all by default) three
+ * ways: reparsing the file for each image, as TexLoader used to, one image
+ * at a time through the header cache, and one batch per file. Give the
+ * files a dungeon uses to measure its texture load time.
+ */
+CCMD(texbench)
+{
+    std::vector<size_t> files;
+    for(const std::string &name : VFS::Manager::get().list(params.empty() ? "TEXTURE.*" : params.c_str()))
+    {
+        const char *str = name.c_str() + name.rfind('.') + 1;
+        char *next = nullptr;
+        size_t fileidx = strtoul(str, &next, 10);
+        if(next != str && *next == 0)
+            files.push_back(fileidx);
+    }
+    if(files.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "No texture files match \""<<params<<"\"";
+        return;
+    }
+
+    DFOSG::TexLoader &loader = DFOSG::TexLoader::get();
+    const Resource::Palette &palette = Resource::TextureManager::get().getCurrentPalette();
+    std::vector<size_t> counts;
+    for(size_t fileidx : files)
+        counts.push_back(loader.getImageCount(fileidx));
+
+    static const char *const modes[3] = { "reparsed", "cached", "batch" };
+    for(size_t mode = 0;mode < 3;++mode)
+    {
+        VFS::Manager::get().clearCache();
+        loader.clearCache();
+
+        size_t images = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0;i < files.size();++i)
+        {
+            if(mode == 2)
+            {
+                std::vector<size_t> imgidxs(counts[i]);
+                std::iota(imgidxs.begin(), imgidxs.end(), 0);
+                images += loader.loadBatch(files[i], imgidxs, &palette).size();
+                continue;
+            }
+            for(size_t j = 0;j < counts[i];++j)
+            {
+                if(mode == 0) loader.clearCache();
+                images += !loader.load((files[i]<<7) | j, &palette).empty();
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Log::get().stream()<< modes[mode]<<": "<<images<<" images from "<<files.size()<<" files in "<<
+            (elapsed.count()*1000.0)<<"ms";
+    }
+}
+
+
+/* Checks that each supported palette expansion path gives the same output
+ * as the scalar one, for random data of every row length up to 1024 and at
+ * every source alignment, then measures each path's throughput.
+ */
+CCMD(palbench)
+{
+    std::minstd_rand rng(1);
+    Resource::Palette palette;
+    for(Resource::PaletteEntry &color : palette)
+        color = Resource::PaletteEntry{(unsigned char)rng(), (unsigned char)rng(), (unsigned char)rng()};
+    DFOSG::PaletteTable table(palette);
+
+    std::vector<uint8_t> src(1024+16);
+    for(uint8_t &idx : src)
+        idx = rng();
+    std::vector<uint8_t> expected(1024*4), result(1024*4);
+
+    size_t failures = 0;
+    for(size_t p = DFOSG::Expand_SSE2;p < DFOSG::Expand_Count;++p)
+    {
+        DFOSG::ExpandPath path = DFOSG::ExpandPath(p);
+        if(!DFOSG::is_expand_path_supported(path))
+            continue;
+        for(size_t offset = 0;offset < 16;++offset)
+        {
+            for(size_t count = 0;count <= 1024;++count)
+            {
+                DFOSG::expand_row(DFOSG::Expand_Scalar, &src[offset], count, table, expected.data());
+                DFOSG::expand_row(path, &src[offset], count, table, result.data());
+                if(memcmp(expected.data(), result.data(), count*4) != 0)
+                {
+                    if(failures++ == 0)
+                        Log::get().stream(Log::Level_Error)<< DFOSG::get_expand_path_name(path)<<
+                            " differs from scalar for "<<count<<" pixels at offset "<<offset;
+                }
+            }
+        }
+    }
+    Log::get().stream(failures ? Log::Level_Error : Log::Level_Normal)<< failures<<" mismatches";
+
+    // A 256x256 image, expanded a row at a time.
+    const size_t width = 256, height = 256, rounds = 200;
+    std::vector<uint8_t> image(width*height);
+    for(uint8_t &idx : image)
+        idx = rng();
+    std::vector<uint8_t> rgba(width*height*4);
+    for(size_t p = 0;p < DFOSG::Expand_Count;++p)
+    {
+        DFOSG::ExpandPath path = DFOSG::ExpandPath(p);
+        if(!DFOSG::is_expand_path_supported(path))
+            continue;
+
+        auto start = std::chrono::steady_clock::now();
+        for(size_t r = 0;r < rounds;++r)
+        {
+            for(size_t y = 0;y < height;++y)
+                DFOSG::expand_row(path, &image[y*width], width, table, &rgba[y*width*4]);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Log::get().stream()<< DFOSG::get_expand_path_name(path)<<
+            (path == DFOSG::get_expand_path() ? " (default)" : "")<<": "<<
+            (width*height*rounds/1000000.0/elapsed.count())<<" MPixels/s";
+    }
+}
+
+
+
+/* Round-trips random images of various sizes through reference encoders
+ * and the RLE decoders, including into padded rows, then measures the
+ * decoders' throughput on 256x128 images.
+ */
+CCMD(rlebench)
+{
+    std::minstd_rand rng(1);
+
+    static const size_t sizes[][2] = {
+        {1, 1}, {2, 2}, {7, 3}, {61, 37}, {64, 64}, {129, 17}, {256, 128}
+    };
+    size_t failures = 0;
+    for(const auto &size : sizes)
+    {
+        const size_t width = size[0], height = size[1];
+        for(size_t pad = 0;pad < 8;pad += 7)
+        {
+            const size_t stride = width + pad;
+            std::vector<uint8_t> pixels = make_rle_image(rng, width, height);
+            std::vector<uint8_t> rle = encode_rle(pixels);
+            std::vector<uint8_t> rows = encode_row_rle(pixels, width, height);
+
+            for(int scheme = 0;scheme < 2;++scheme)
+            {
+                std::vector<uint8_t> result(stride*height, 0xcd);
+                bool ok = (scheme == 0) ?
+                    DFOSG::decode_rle(rle.data(), rle.size(), width, height, result.data(), stride) :
+                    DFOSG::decode_row_rle(rows.data(), rows.size(), 0, width, height, result.data(), stride);
+                for(size_t y = 0;ok && y < height;++y)
+                {
+                    ok = memcmp(&result[y*stride], &pixels[y*width], width) == 0;
+                    // Padding must be left alone.
+                    for(size_t x = width;ok && x < stride;++x)
+                        ok = result[y*stride + x] == 0xcd;
+                }
+                if(!ok && failures++ == 0)
+                    Log::get().stream(Log::Level_Error)<< (scheme ? "Row RLE" : "RLE")<<
+                        " round-trip failed for "<<width<<"x"<<height<<", stride "<<stride;
+            }
+
+            // Truncated data must fail cleanly, without reading past the end.
+            std::vector<uint8_t> result(stride*height);
+            if(DFOSG::decode_rle(rle.data(), rle.size()-1, width, height, result.data(), stride) ||
+               DFOSG::decode_row_rle(rows.data(), rows.size()-1, 0, width, height, result.data(), stride))
+            {
+                if(failures++ == 0)
+                    Log::get().stream(Log::Level_Error)<< "Truncated data decoded for "<<
+                        width<<"x"<<height;
+            }
+        }
+    }
+    Log::get().stream(failures ? Log::Level_Error : Log::Level_Normal)<< failures<<" failures";
+
+    const size_t width = 256, height = 128, count = 64, rounds = 20;
+    std::vector<std::vector<uint8_t>> rle(count), rows(count);
+    for(size_t i = 0;i < count;++i)
+    {
+        std::vector<uint8_t> pixels = make_rle_image(rng, width, height);
+        rle[i] = encode_rle(pixels);
+        rows[i] = encode_row_rle(pixels, width, height);
+    }
+    std::vector<uint8_t> result(width*height);
+    for(int scheme = 0;scheme < 2;++scheme)
+    {
+        const std::vector<std::vector<uint8_t>> &data = scheme ? rows : rle;
+        size_t bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(size_t r = 0;r < rounds;++r)
+        {
+            for(const std::vector<uint8_t> &src : data)
+            {
+                if(scheme == 0)
+                    DFOSG::decode_rle(src.data(), src.size(), width, height, result.data(), width);
+                else
+                    DFOSG::decode_row_rle(src.data(), src.size(), 0, width, height, result.data(), width);
+                bytes += src.size();
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Log::get().stream()<< (scheme ? "ImageRle/RecordRle" : "RleCompressed")<<": "<<
+            (width*height*count*rounds/1000000.0/elapsed.count())<<" MPixels/s, "<<
+            (bytes/1048576.0/elapsed.count())<<" MB/s encoded";
+    }
+}
+
+
+/* Checks that each mipmap filter path matches the scalar one for random
+ * images of every size up to 40x40, and that transparent texels don't bleed
+ * into opaque ones. Then builds mip chains for about a city's worth of
+ * textures, with each path on one thread, and on a thread pool.
+ */
+CCMD(mipbench)
+{
+    std::minstd_rand rng(1);
+    size_t failures = 0;
+
+    std::vector<uint8_t> expected, result;
+    for(size_t height = 1;height <= 40;++height)
+    {
+        for(size_t width = 1;width <= 40;++width)
+        {
+            std::vector<uint8_t> src = make_rgba_image(rng, width, height, (width+height)%3);
+            size_t size = build_mip_chain(DFOSG::Expand_Scalar, src, width, height, expected);
+            for(size_t p = DFOSG::Expand_SSE2;p < DFOSG::Expand_Count;++p)
+            {
+                DFOSG::ExpandPath path = DFOSG::ExpandPath(p);
+                if(!DFOSG::is_expand_path_supported(path))
+                    continue;
+                build_mip_chain(path, src, width, height, result);
+                if(memcmp(expected.data(), result.data(), size) != 0 && failures++ == 0)
+                    Log::get().stream(Log::Level_Error)<< DFOSG::get_expand_path_name(path)<<
+                        " mipmaps differ from scalar for "<<width<<"x"<<height;
+            }
+        }
+    }
+
+    // Opaque red and transparent black in a checkerboard should stay red at
+    // every level, at half alpha.
+    {
+        osg::ref_ptr<osg::Image> image(new osg::Image());
+        image->allocateImage(16, 16, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        for(size_t y = 0;y < 16;++y)
+        {
+            for(size_t x = 0;x < 16;++x)
+            {
+                const uint8_t texel[4] = { 255, 0, 0, 255 };
+                if((x+y)%2 == 0) memcpy(image->data(x, y), texel, 4);
+                else memset(image->data(x, y), 0, 4);
+            }
+        }
+        if(!DFOSG::build_mipmaps(image) || image->getNumMipmapLevels() != 5)
+        {
+            if(failures++ == 0)
+                Log::get().stream(Log::Level_Error)<< "Failed to build mipmaps for 16x16";
+        }
+        else for(unsigned int level = 1;level < image->getNumMipmapLevels();++level)
+        {
+            size_t size = 16 >> level;
+            const uint8_t *texels = image->getMipmapData(level);
+            for(size_t i = 0;i < size*size;++i)
+            {
+                const uint8_t *texel = texels + i*4;
+                if((texel[0] != 255 || texel[1] != 0 || texel[2] != 0 || texel[3] != 128) && failures++ == 0)
+                    Log::get().stream(Log::Level_Error)<< "Transparent texels bled into level "<<level<<
+                        ": "<<(int)texel[0]<<","<<(int)texel[1]<<","<<(int)texel[2]<<","<<(int)texel[3];
+            }
+        }
+    }
+    Log::get().stream(failures ? Log::Level_Error : Log::Level_Normal)<< failures<<" failures";
+
+    // Mostly 64x64 wall and floor textures, some bigger ones, and smaller
+    // sprites with transparent edges.
+    static const size_t sizes[][3] = {
+        {64, 64, 1400}, {128, 128, 200}, {256, 128, 40}, {32, 48, 400}
+    };
+    std::vector<std::vector<uint8_t>> images;
+    std::vector<std::pair<size_t,size_t>> dims;
+    size_t texels = 0;
+    for(const auto &size : sizes)
+    {
+        for(size_t i = 0;i < size[2];++i)
+        {
+            images.push_back(make_rgba_image(rng, size[0], size[1], (size[0] < 64) ? 1 : 0));
+            dims.push_back(std::make_pair(size[0], size[1]));
+            texels += size[0]*size[1];
+        }
+    }
+
+    for(size_t p = 0;p < DFOSG::Expand_Count;++p)
+    {
+        DFOSG::ExpandPath path = DFOSG::ExpandPath(p);
+        if(!DFOSG::is_expand_path_supported(path))
+            continue;
+
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0;i < images.size();++i)
+            build_mip_chain(path, images[i], dims[i].first, dims[i].second, result);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        Log::get().stream()<< DFOSG::get_expand_path_name(path)<<
+            (path == DFOSG::get_expand_path() ? " (default)" : "")<<": "<<(elapsed.count()*1000.0)<<
+            "ms for "<<images.size()<<" textures, "<<(texels/1000000.0/elapsed.count())<<" MTexels/s";
+    }
+
+    // As the texture manager does it, on osg::Images (allocation included),
+    // on one thread and then spread over a pool.
+    auto make_osg_images = [&images, &dims]()
+    {
+        std::vector<osg::ref_ptr<osg::Image>> osgimages(images.size());
+        for(size_t i = 0;i < images.size();++i)
+        {
+            osgimages[i] = new osg::Image();
+            osgimages[i]->allocateImage(dims[i].first, dims[i].second, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+            memcpy(osgimages[i]->data(), images[i].data(), images[i].size());
+        }
+        return osgimages;
+    };
+
+    std::vector<osg::ref_ptr<osg::Image>> osgimages = make_osg_images();
+    auto start = std::chrono::steady_clock::now();
+    for(osg::Image *image : osgimages)
+        DFOSG::build_mipmaps(image);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Log::get().stream()<< "build_mipmaps, 1 thread: "<<(elapsed.count()*1000.0)<<"ms";
+
+    osgimages = make_osg_images();
+    Misc::ThreadPool pool(Misc::ThreadPool::defaultSize());
+    start = std::chrono::steady_clock::now();
+    std::vector<std::future<void>> jobs;
+    for(size_t t = 0;t < pool.size();++t)
+    {
+        jobs.push_back(pool.submit([&osgimages, t, &pool]()
+        {
+            for(size_t i = t;i < osgimages.size();i += pool.size())
+                DFOSG::build_mipmaps(osgimages[i]);
+        }));
+    }
+    for(std::future<void> &job : jobs)
+        job.get();
+    elapsed = std::chrono::steady_clock::now() - start;
+    Log::get().stream()<< "build_mipmaps, "<<pool.size()<<" threads: "<<(elapsed.count()*1000.0)<<"ms";
+}
+
+
+/* Times reading every RMB, RDB, MDL and TEXTURE file into memory and parsing
+ * it with the engine's loaders, and how much of that is parsing. Files the
+ * loaders reject are counted as failed.
+ */
+CCMD(parsebench)
+{
+    std::vector<StressEntry> kinds[4];
+    static const char *const patterns[3] = { "*.RMB", "*.RDB", "TEXTURE.*" };
+    for(size_t k = 0;k < 3;++k)
+    {
+        for(const std::string &name : VFS::Manager::get().list(patterns[k]))
+            kinds[k < 2 ? k : 3].push_back(StressEntry{name, 0, 0, 0});
+    }
+    for(size_t id : VFS::Manager::get().listArchIds())
+        kinds[2].push_back(StressEntry{std::string(), id, 0, 0});
+
+    static const char *const names[4] = { "RMB", "RDB", "MDL", "TEXTURE" };
+    for(size_t k = 0;k < 4;++k)
+    {
+        if(kinds[k].empty())
+        {
+            Log::get().stream()<< names[k]<<": no files";
+            continue;
+        }
+
+        ParseTimes times;
+        switch(k)
+        {
+            case 0: times = bench_parse(kinds[k], parse_rmb); break;
+            case 1: times = bench_parse(kinds[k], parse_rdb); break;
+            case 2: times = bench_parse(kinds[k], parse_mdl); break;
+            default: times = bench_parse(kinds[k], parse_texture); break;
+        }
+        Log::get().stream(times.mFailed ? Log::Level_Error : Log::Level_Normal)<<
+            names[k]<<": "<<times.mFiles<<" files, "<<(times.mBytes>>10)<<"KB; "<<times.mTotalMs<<
+            "ms ("<<(times.mTotalMs*1000.0/times.mFiles)<<"us/file), "<<times.mParseMs<<"ms parsing ("<<
+            (times.mParseMs*1000.0/times.mFiles)<<"us/file), "<<times.mFailed<<" failed";
+    }
+}
+
+} // namespace DF
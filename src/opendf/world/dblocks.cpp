@@ -9,7 +9,8 @@
 #include "world.hpp"
 #include "log.hpp"
 
-#include "components/vfs/manager.hpp"
+#include "misc/binaryreader.hpp"
+
 #include "components/resource/meshmanager.hpp"
 
 #include "render/renderer.hpp"
@@ -36,16 +37,14 @@ ObjectBase::~ObjectBase()
     Activator::get().deallocate(mId);
 }
 
-void ObjectBase::loadAction(std::istream &stream, DBlockHeader &block)
+void ObjectBase::loadAction(const DFOSG::RdbAction &action)
 {
     if(mActionOffset <= 0)
         return;
 
-    std::array<uint8_t,5> adata;
-    stream.seekg(mActionOffset);
-    stream.read(reinterpret_cast<char*>(adata.data()), adata.size());
-    int32_t target = VFS::read_le32(stream);
-    uint8_t type = stream.get();
+    const std::array<uint8_t,5> &adata = action.mData;
+    int32_t target = action.mTarget;
+    uint8_t type = action.mType;
 
     if(target > 0)
         target |= mId&0xff000000;
@@ -113,16 +112,16 @@ void ObjectBase::print(std::ostream &stream) const
 }
 
 
-void ModelObject::load(std::istream &stream, const std::array<std::array<char,8>,750> &mdldata)
+void ModelObject::load(const DFOSG::RdbModel &model, const std::array<std::array<char,8>,750> &mdldata)
 {
-    mXRot = VFS::read_le32(stream);
-    mYRot = VFS::read_le32(stream);
-    mZRot = VFS::read_le32(stream);
+    mXRot = model.mXRot;
+    mYRot = model.mYRot;
+    mZRot = model.mZRot;
 
-    mModelIdx = VFS::read_le16(stream);
-    mActionFlags = VFS::read_le32(stream);
-    mSoundId = stream.get();
-    mActionOffset = VFS::read_le32(stream);
+    mModelIdx = model.mModelIdx;
+    mActionFlags = model.mActionFlags;
+    mSoundId = model.mSoundId;
+    mActionOffset = model.mActionOffset;
 
     mModelData = mdldata.at(mModelIdx);
 }
@@ -167,13 +166,13 @@ void ModelObject::print(std::ostream &stream) const
 }
 
 
-void FlatObject::load(std::istream &stream)
+void FlatObject::load(const DFOSG::RdbFlat &flat)
 {
-    mTexture = VFS::read_le16(stream);
-    mGender = VFS::read_le16(stream);
-    mFactionId = VFS::read_le16(stream);
-    mActionOffset = VFS::read_le32(stream);
-    mUnknown = stream.get();
+    mTexture = flat.mTexture;
+    mGender = flat.mGender;
+    mFactionId = flat.mFactionId;
+    mActionOffset = flat.mActionOffset;
+    mUnknown = flat.mUnknown;
 }
 
 void FlatObject::buildNodes(osg::Group *root)
@@ -210,60 +209,36 @@ DBlockHeader::~DBlockHeader()
 }
 
 
-void DBlockHeader::load(std::istream &stream, size_t blockid)
+void DBlockHeader::load(Misc::BinaryReader &reader, size_t blockid)
 {
-    mUnknown1 = VFS::read_le32(stream);
-    mWidth = VFS::read_le32(stream);
-    mHeight = VFS::read_le32(stream);
-    mObjectRootOffset = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    stream.read(mModelData[0].data(), sizeof(mModelData));
-    for(uint32_t &val : mUnknown3)
-        val = VFS::read_le32(stream);
-
-    stream.seekg(mObjectRootOffset);
-
-    std::vector<int32_t> rootoffsets(mWidth*mHeight);
-    for(int32_t &val : rootoffsets)
-        val = VFS::read_le32(stream);
-
-    for(int32_t offset : rootoffsets)
+    DFOSG::RdbFile rdb;
+    rdb.load(reader);
+    mHeader = rdb.mHeader;
+
+    for(const DFOSG::RdbObject &obj : rdb.mObjects)
     {
-        while(offset > 0)
+        // Objects linked from more than one list are only made once.
+        size_t id = blockid | obj.mOffset;
+        if(mObjects.exists(id))
+            continue;
+
+        if(obj.mType == ObjectType_Model)
+        {
+            ref_ptr<ModelObject> mdl(new ModelObject(id, obj.mXPos, obj.mYPos, obj.mZPos));
+            mdl->load(obj.mModel, mHeader.mModelData);
+
+            mObjects.insert(id, mdl);
+            mdl->loadAction(obj.mAction);
+        }
+        else if(obj.mType == ObjectType_Flat)
         {
-            stream.seekg(offset);
-            int32_t next = VFS::read_le32(stream);
-            /*int32_t prev =*/ VFS::read_le32(stream);
-
-            int32_t x = VFS::read_le32(stream);
-            int32_t y = VFS::read_le32(stream);
-            int32_t z = VFS::read_le32(stream);
-            uint8_t type = stream.get();
-            uint32_t objoffset = VFS::read_le32(stream);
-
-            if(type == ObjectType_Model)
-            {
-                stream.seekg(objoffset);
-                ref_ptr<ModelObject> mdl(new ModelObject(blockid|offset, x, y, z));
-                mdl->load(stream, mModelData);
-
-                mObjects.insert(blockid|offset, mdl);
-            }
-            else if(type == ObjectType_Flat)
-            {
-                stream.seekg(objoffset);
-                ref_ptr<FlatObject> flat(new FlatObject(blockid|offset, x, y, z));
-                flat->load(stream);
-
-                mObjects.insert(blockid|offset, flat);
-            }
-
-            offset = next;
+            ref_ptr<FlatObject> flat(new FlatObject(id, obj.mXPos, obj.mYPos, obj.mZPos));
+            flat->load(obj.mFlat);
+
+            mObjects.insert(id, flat);
+            flat->loadAction(obj.mAction);
         }
     }
-
-    for(ref_ptr<ObjectBase> &obj : mObjects)
-        obj->loadAction(stream, *this);
 }
 
 
@@ -318,15 +293,15 @@ size_t DBlockHeader::getObjectByTexture(size_t texid) const
 
 void DBlockHeader::print(std::ostream &stream, int objtype) const
 {
-    stream<< "Unknown: 0x"<<std::hex<<std::setw(8)<<mUnknown1<<std::dec<<std::setw(0)<<"\n";
-    stream<< "Width: "<<mWidth<<"\n";
-    stream<< "Height: "<<mHeight<<"\n";
-    stream<< "ObjectRootOffset: 0x"<<std::hex<<std::setw(8)<<mObjectRootOffset<<std::dec<<std::setw(0)<<"\n";
-    stream<< "Unknown: 0x"<<std::hex<<std::setw(8)<<mUnknown2<<std::dec<<std::setw(0)<<"\n";
+    stream<< "Unknown: 0x"<<std::hex<<std::setw(8)<<mHeader.mUnknown1<<std::dec<<std::setw(0)<<"\n";
+    stream<< "Width: "<<mHeader.mWidth<<"\n";
+    stream<< "Height: "<<mHeader.mHeight<<"\n";
+    stream<< "ObjectRootOffset: 0x"<<std::hex<<std::setw(8)<<mHeader.mObjectRootOffset<<std::dec<<std::setw(0)<<"\n";
+    stream<< "Unknown: 0x"<<std::hex<<std::setw(8)<<mHeader.mUnknown2<<std::dec<<std::setw(0)<<"\n";
     stream<< "ModelData:"<<"\n";
-    const uint32_t *unknown = mUnknown3.data();
+    const uint32_t *unknown = mHeader.mUnknown3.data();
     int idx = 0;
-    for(const auto &id : mModelData)
+    for(const auto &id : mHeader.mModelData)
     {
         if(id[0] != -1)
         {
@@ -12,6 +12,8 @@
 #include "misc/sparsearray.hpp"
 #include "referenceable.hpp"
 
+#include "components/dfosg/blockformat.hpp"
+
 
 namespace osg
 {
@@ -57,9 +59,9 @@ struct ActionRotate {
 
 
 enum ObjectType {
-    ObjectType_Model = 0x01,
-    ObjectType_Light = 0x02,
-    ObjectType_Flat = 0x03,
+    ObjectType_Model = DFOSG::RdbObject_Model,
+    ObjectType_Light = DFOSG::RdbObject_Light,
+    ObjectType_Flat = DFOSG::RdbObject_Flat,
 };
 
 struct ObjectBase : public Referenceable {
@@ -75,7 +77,7 @@ struct ObjectBase : public Referenceable {
     ObjectBase(size_t id, uint8_t type, int x, int y, int z);
     virtual ~ObjectBase();
 
-    void loadAction(std::istream &stream, DBlockHeader &block);
+    void loadAction(const DFOSG::RdbAction &action);
 
     virtual void buildNodes(osg::Group *root) = 0;
 
@@ -94,7 +96,7 @@ struct ModelObject : public ObjectBase {
 
     ModelObject(size_t id, int x, int y, int z) : ObjectBase(id, ObjectType_Model, x, y, z) { }
 
-    void load(std::istream &stream, const std::array<std::array<char,8>,750> &mdldata);
+    void load(const DFOSG::RdbModel &model, const std::array<std::array<char,8>,750> &mdldata);
 
     virtual void buildNodes(osg::Group *root) final;
 
@@ -109,7 +111,7 @@ struct FlatObject : public ObjectBase {
     uint8_t mUnknown;
 
     FlatObject(size_t id, int x, int y, int z) : ObjectBase(id, ObjectType_Flat, x, y, z) { }
-    void load(std::istream &stream);
+    void load(const DFOSG::RdbFlat &flat);
 
     virtual void buildNodes(osg::Group *root) final;
 
@@ -121,14 +123,7 @@ enum {
 };
 
 struct DBlockHeader {
-    uint32_t mUnknown1;
-    uint32_t mWidth;
-    uint32_t mHeight;
-    uint32_t mObjectRootOffset;
-    uint32_t mUnknown2;
-
-    std::array<std::array<char,8>,750> mModelData;
-    std::array<uint32_t,750> mUnknown3;
+    DFOSG::RdbHeader mHeader;
 
     /* Objects are stored in the files as an array of (width*height) root
      * offsets, which contain a linked list of objects. We merely use an array
@@ -142,7 +137,7 @@ struct DBlockHeader {
 
     ~DBlockHeader();
 
-    void load(std::istream &stream, size_t blockid);
+    void load(Misc::BinaryReader &reader, size_t blockid);
 
     void buildNodes(osg::Group *root, int x, int z);
     void detachNode();
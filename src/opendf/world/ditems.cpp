@@ -3,7 +3,7 @@
 
 #include <iomanip>
 
-#include "components/vfs/manager.hpp"
+#include "misc/binaryreader.hpp"
 
 #include "log.hpp"
 
@@ -11,22 +11,22 @@
 namespace DF
 {
 
-void DungeonInterior::load(std::istream &stream)
+void DungeonInterior::load(Misc::BinaryReader &reader)
 {
-    LocationHeader::load(stream);
+    LocationHeader::load(reader);
 
-    mNullValue = VFS::read_le16(stream);
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mBlockCount = VFS::read_le16(stream);
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
+    mNullValue = reader.readLE16();
+    mUnknown1 = reader.readLE32();
+    mUnknown2 = reader.readLE32();
+    mBlockCount = reader.readLE16();
+    reader.readArray(mUnknown3);
 
     mBlocks.resize(mBlockCount);
     for(DungeonBlock &block : mBlocks)
     {
-        block.mX = stream.get();
-        block.mZ = stream.get();
-        block.mBlockNumberStartIndex = VFS::read_le16(stream);
+        block.mX = reader.readU8();
+        block.mZ = reader.readU8();
+        block.mBlockNumberStartIndex = reader.readLE16();
     }
 }
 
@@ -29,7 +29,7 @@ struct DungeonInterior : public LocationHeader {
 
     std::vector<DungeonBlock> mBlocks;
 
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 };
 LogStream& operator<<(LogStream &stream, const DungeonInterior &dgn);
 
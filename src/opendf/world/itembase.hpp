@@ -6,6 +6,11 @@
 #include <stdint.h>
 
 
+namespace Misc
+{
+    class BinaryReader;
+}
+
 namespace DF
 {
 
@@ -43,7 +48,7 @@ struct LocationHeader {
     char mLocationName[32];
     uint8_t mUnknown3[9];
 
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 };
 LogStream& operator<<(LogStream &stream, const LocationHeader &loc);
 
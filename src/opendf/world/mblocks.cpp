@@ -7,7 +7,8 @@
 #include <osg/Group>
 #include <osg/MatrixTransform>
 
-#include "components/vfs/manager.hpp"
+#include "misc/binaryreader.hpp"
+
 #include "components/resource/meshmanager.hpp"
 
 #include "render/renderer.hpp"
@@ -18,43 +19,6 @@
 namespace DF
 {
 
-void MObjectBase::load(std::istream &stream)
-{
-    mXPos = VFS::read_le32(stream);
-    mYPos = VFS::read_le32(stream);
-    mZPos = VFS::read_le32(stream);
-}
-
-void MObjectBase::print(std::ostream &stream) const
-{
-    stream<< "Pos: "<<mXPos<<" "<<mYPos<<" "<<mZPos<<"\n";
-}
-
-void MSection3::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mUnknown1 = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-}
-
-void MDoor::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mUnknown1 = VFS::read_le16(stream);
-    mRotation = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-    mNullValue = stream.get();
-}
-
-
-void MFlat::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mTexture = VFS::read_le16(stream);
-    mUnknown = VFS::read_le16(stream);
-    mFlags = stream.get();
-}
-
 void MFlat::buildNodes(osg::Group *root)
 {
     osg::ref_ptr<osg::MatrixTransform> node = new osg::MatrixTransform();
@@ -69,45 +33,13 @@ void MFlat::buildNodes(osg::Group *root)
 
 void MFlat::print(std::ostream &stream) const
 {
-    DF::MObjectBase::print(stream);
+    stream<< "Pos: "<<mXPos<<" "<<mYPos<<" "<<mZPos<<"\n";
     stream<< "Texture: 0x"<<std::hex<<std::setw(4)<<mTexture<<std::dec<<std::setw(0)<<"\n";
     stream<< "Unknown: 0x"<<std::hex<<std::setw(4)<<mUnknown<<std::dec<<std::setw(0)<<"\n";
     stream<< "Flags: 0x"<<std::hex<<std::setw(2)<<(int)mFlags<<std::setw(0)<<std::dec<<"\n";
 }
 
 
-void MPerson::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mTexture = VFS::read_le16(stream);
-    mFactionId = VFS::read_le16(stream);
-}
-
-
-void MModel::load(std::istream &stream)
-{
-    mModelIdx  = (int)VFS::read_le16(stream) * 100;
-    mModelIdx += stream.get();
-    mUnknown1 = stream.get();
-    mUnknown2 = VFS::read_le32(stream);
-    mUnknown3 = VFS::read_le32(stream);
-    mUnknown4 = VFS::read_le32(stream);
-    mNullValue1 = VFS::read_le32(stream);
-    mNullValue2 = VFS::read_le32(stream);
-    mUnknownX = VFS::read_le32(stream);
-    mUnknownY = VFS::read_le32(stream);
-    mUnknownZ = VFS::read_le32(stream);
-    mXPos = VFS::read_le32(stream);
-    mYPos = VFS::read_le32(stream);
-    mZPos = VFS::read_le32(stream);
-    mNullValue3 = VFS::read_le32(stream);
-    mYRotation = VFS::read_le16(stream);
-    mUnknown5 = VFS::read_le16(stream);
-    mUnknown6 = VFS::read_le32(stream);
-    mUnknown8 = VFS::read_le32(stream);
-    mNullValue4 = VFS::read_le16(stream);
-}
-
 void MModel::buildNodes(osg::Group *root)
 {
     osg::ref_ptr<osg::MatrixTransform> node = new osg::MatrixTransform();
@@ -122,7 +54,7 @@ void MModel::buildNodes(osg::Group *root)
 
 void MModel::print(std::ostream &stream) const
 {
-    DF::MObjectBase::print(stream);
+    stream<< "Pos: "<<mXPos<<" "<<mYPos<<" "<<mZPos<<"\n";
     stream<< "ModelIdx: "<<mModelIdx<<"\n";
     stream<< "Unknown: 0x"<<std::hex<<std::setw(2)<<(int)mUnknown1<<std::dec<<std::setw(0)<<"\n";
     stream<< "Unknown: 0x"<<std::hex<<std::setw(8)<<mUnknown2<<std::dec<<std::setw(0)<<"\n";
@@ -154,43 +86,22 @@ MBlock::~MBlock()
     }
 }
 
-void MBlock::load(std::istream &stream, size_t blockid)
+void MBlock::load(const DFOSG::RmbBlock &block, size_t blockid)
 {
-    mModelCount = stream.get();
-    mFlatCount = stream.get();
-    mSection3Count = stream.get();
-    mPersonCount = stream.get();
-    mDoorCount = stream.get();
-    mUnknown1 = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-    mUnknown3 = VFS::read_le16(stream);
-    mUnknown4 = VFS::read_le16(stream);
-    mUnknown5 = VFS::read_le16(stream);
-    mUnknown6 = VFS::read_le16(stream);
-
-    mModels.reserve(mModelCount);
-    for(size_t i = 0;i < mModelCount;++i)
+    mModels.reserve(block.mModels.size());
+    for(size_t i = 0;i < block.mModels.size();++i)
     {
         MModel &model = mModels[blockid | i];
         model.mId = blockid | i;
-        model.load(stream);
+        static_cast<DFOSG::RmbModel&>(model) = block.mModels[i];
     }
-    mFlats.reserve(mFlatCount);
-    for(size_t i = 0;i < mFlatCount;++i)
+    mFlats.reserve(block.mFlats.size());
+    for(size_t i = 0;i < block.mFlats.size();++i)
     {
-        MFlat &flat = mFlats[blockid | (mModelCount+i)];
-        flat.mId = blockid | (mModelCount+i);
-        flat.load(stream);
+        MFlat &flat = mFlats[blockid | (block.mModels.size()+i)];
+        flat.mId = blockid | (block.mModels.size()+i);
+        static_cast<DFOSG::RmbFlat&>(flat) = block.mFlats[i];
     }
-    mSection3s.resize(mSection3Count);
-    for(MSection3 &sec3 : mSection3s)
-        sec3.load(stream);
-    mNpcs.resize(mPersonCount);
-    for(MPerson &npc : mNpcs)
-        npc.load(stream);
-    mDoors.resize(mDoorCount);
-    for(MDoor &door : mDoors)
-        door.load(stream);
 }
 
 void MBlock::buildNodes(osg::Group *root, int x, int z, int yrot)
@@ -220,16 +131,6 @@ MObjectBase *MBlock::getObject(size_t id)
 }
 
 
-void MBlockPosition::load(std::istream &stream)
-{
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mX = VFS::read_le32(stream);
-    mZ = VFS::read_le32(stream);
-    mYRot = VFS::read_le32(stream);
-}
-
-
 MBlockHeader::~MBlockHeader()
 {
     detachNode();
@@ -245,63 +146,33 @@ MBlockHeader::~MBlockHeader()
     }
 }
 
-void MBlockHeader::load(std::istream &stream, size_t blockid)
+void MBlockHeader::load(Misc::BinaryReader &reader, size_t blockid)
 {
-    mBlockCount = stream.get();
-    mModelCount = stream.get();
-    mFlatCount = stream.get();
+    DFOSG::RmbFile rmb;
+    rmb.load(reader);
+    mHeader = rmb.mHeader;
 
-    for(MBlockPosition &blockpos : mBlockPositions)
-        blockpos.load(stream);
-    for(ExteriorBuilding &building : mBuildings)
-    {
-        building.mNameSeed = VFS::read_le16(stream);
-        building.mNullValue1 = VFS::read_le32(stream);
-        building.mNullValue2 = VFS::read_le32(stream);
-        building.mNullValue3 = VFS::read_le32(stream);
-        building.mNullValue4 = VFS::read_le32(stream);
-        building.mFactionId = VFS::read_le16(stream);
-        building.mSector = VFS::read_le16(stream);
-        building.mLocationId = VFS::read_le16(stream);
-        building.mBuildingType = stream.get();
-        building.mQuality = stream.get();
-    }
-    for(uint32_t &unknown : mUnknown1)
-        unknown = VFS::read_le32(stream);
-    for(uint32_t &size : mBlockSizes)
-        size = VFS::read_le32(stream);
-
-    stream.read(reinterpret_cast<char*>(mUnknown2.data()), mUnknown2.size());
-    stream.read(reinterpret_cast<char*>(mGroundTexture.data()), mGroundTexture.size());
-    stream.read(reinterpret_cast<char*>(mUnknown3.data()), mUnknown3.size());
-    stream.read(reinterpret_cast<char*>(mAutomap.data()), mAutomap.size());
-
-    // Unused list? An array of 33 8.3 filenames are here...
-    stream.ignore(429);
-
-    mExteriorBlocks.resize(mBlockCount);
-    mInteriorBlocks.resize(mBlockCount);
-    for(size_t i = 0;i < mBlockCount;++i)
+    mExteriorBlocks.resize(mHeader.mBlockCount);
+    mInteriorBlocks.resize(mHeader.mBlockCount);
+    for(size_t i = 0;i < mHeader.mBlockCount;++i)
     {
-        size_t pos = stream.tellg();
-        mExteriorBlocks[i].load(stream, blockid | (i<<17) | 0x00000);
-        mInteriorBlocks[i].load(stream, blockid | (i<<17) | 0x10000);
-        stream.seekg(pos + mBlockSizes[i]);
+        mExteriorBlocks[i].load(rmb.mExteriorBlocks[i], blockid | (i<<17) | 0x00000);
+        mInteriorBlocks[i].load(rmb.mInteriorBlocks[i], blockid | (i<<17) | 0x10000);
     }
 
-    mModels.reserve(mModelCount);
-    for(size_t i = 0;i < mModelCount;++i)
+    mModels.reserve(rmb.mModels.size());
+    for(size_t i = 0;i < rmb.mModels.size();++i)
     {
         MModel &model = mModels[blockid | 0x00ff0000 | i];
         model.mId = blockid | 0x00ff0000 | i;
-        model.load(stream);
+        static_cast<DFOSG::RmbModel&>(model) = rmb.mModels[i];
     }
-    mFlats.reserve(mFlatCount);
-    for(size_t i = 0;i < mFlatCount;++i)
+    mFlats.reserve(rmb.mFlats.size());
+    for(size_t i = 0;i < rmb.mFlats.size();++i)
     {
-        MFlat &flat = mFlats[blockid | 0x00ff0000 | (mModelCount+i)];
-        flat.mId = blockid | 0x00ff0000 | (mModelCount+i);
-        flat.load(stream);
+        MFlat &flat = mFlats[blockid | 0x00ff0000 | (rmb.mModels.size()+i)];
+        flat.mId = blockid | 0x00ff0000 | (rmb.mModels.size()+i);
+        static_cast<DFOSG::RmbFlat&>(flat) = rmb.mFlats[i];
     }
 }
 
@@ -314,11 +185,10 @@ void MBlockHeader::buildNodes(osg::Group *root, int x, int z)
         ));
 
         mBaseNode = new osg::MatrixTransform(mat);
-        for(size_t i = 0;i < mBlockCount;++i)
+        for(size_t i = 0;i < mHeader.mBlockCount;++i)
         {
-            MBlock &block = mExteriorBlocks[i];
-            block.buildNodes(mBaseNode, mBlockPositions[i].mX, mBlockPositions[i].mZ,
-                             mBlockPositions[i].mYRot);
+            const DFOSG::RmbBlockPosition &blockpos = mHeader.mBlockPositions[i];
+            mExteriorBlocks[i].buildNodes(mBaseNode, blockpos.mX, blockpos.mZ, blockpos.mYRot);
         }
 
         for(MModel &model : mModels)
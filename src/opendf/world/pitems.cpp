@@ -5,7 +5,7 @@
 #include <iomanip>
 #include <array>
 
-#include "components/vfs/manager.hpp"
+#include "misc/binaryreader.hpp"
 
 
 namespace
@@ -64,45 +64,44 @@ static const std::array<std::array<char,5>,45> gBuildingLabel{{
 namespace DF
 {
 
-void ExteriorLocation::load(std::istream& stream)
+void ExteriorLocation::load(Misc::BinaryReader &reader)
 {
-    LocationHeader::load(stream);
+    LocationHeader::load(reader);
 
-    uint16_t mBuildingCount = VFS::read_le16(stream);
-    stream.read(reinterpret_cast<char*>(mUnknown1), sizeof(mUnknown1));
+    uint16_t mBuildingCount = reader.readLE16();
+    reader.readArray(mUnknown1);
 
     mBuildings.resize(mBuildingCount);
     for(ExteriorBuilding &building : mBuildings)
     {
-        building.mNameSeed = VFS::read_le16(stream);
-        building.mNullValue1 = VFS::read_le32(stream);
-        building.mNullValue2 = VFS::read_le32(stream);
-        building.mNullValue3 = VFS::read_le32(stream);
-        building.mNullValue4 = VFS::read_le32(stream);
-        building.mFactionId = VFS::read_le16(stream);
-        building.mSector = VFS::read_le16(stream);
-        building.mLocationId = VFS::read_le16(stream);
-        building.mBuildingType = stream.get();
-        building.mQuality = stream.get();
+        building.mNameSeed = reader.readLE16();
+        building.mNullValue1 = reader.readLE32();
+        building.mNullValue2 = reader.readLE32();
+        building.mNullValue3 = reader.readLE32();
+        building.mNullValue4 = reader.readLE32();
+        building.mFactionId = reader.readLE16();
+        building.mSector = reader.readLE16();
+        building.mLocationId = reader.readLE16();
+        building.mBuildingType = reader.readU8();
+        building.mQuality = reader.readU8();
     }
 
-    stream.read(mName, sizeof(mName));
-    mMapId = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mWidth = stream.get();
-    mHeight = stream.get();
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
-    stream.read(reinterpret_cast<char*>(mBlockIndex), sizeof(mBlockIndex));
-    stream.read(reinterpret_cast<char*>(mBlockNumber), sizeof(mBlockNumber));
-    stream.read(reinterpret_cast<char*>(mBlockCharacter), sizeof(mBlockCharacter));
-    stream.read(reinterpret_cast<char*>(mUnknown4), sizeof(mUnknown4));
-    mNullValue1 = VFS::read_le32(stream);
-    mNullValue2 = VFS::read_le32(stream);
-    mNullValue3 = stream.get();
-    for(uint32_t &val : mUnknown5)
-        val = VFS::read_le32(stream);
-    stream.read(reinterpret_cast<char*>(mNullValue4), sizeof(mNullValue4));
-    mUnknown6 = VFS::read_le32(stream);
+    reader.readArray(mName);
+    mMapId = reader.readLE32();
+    mUnknown2 = reader.readLE32();
+    mWidth = reader.readU8();
+    mHeight = reader.readU8();
+    reader.readArray(mUnknown3);
+    reader.readArray(mBlockIndex);
+    reader.readArray(mBlockNumber);
+    reader.readArray(mBlockCharacter);
+    reader.readArray(mUnknown4);
+    mNullValue1 = reader.readLE32();
+    mNullValue2 = reader.readLE32();
+    mNullValue3 = reader.readU8();
+    reader.readArray(mUnknown5);
+    reader.readArray(mNullValue4);
+    mUnknown6 = reader.readLE32();
 }
 
 std::string ExteriorLocation::getMapBlockName(size_t idx, size_t regnum) const
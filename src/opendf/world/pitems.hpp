@@ -43,7 +43,7 @@ struct ExteriorLocation : public LocationHeader {
     uint8_t  mNullValue4[40];
     uint32_t mUnknown6;
 
-    void load(std::istream &stream);
+    void load(Misc::BinaryReader &reader);
 
     std::string getMapBlockName(size_t idx, size_t regnum) const;
 };
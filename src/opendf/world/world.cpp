@@ -9,7 +9,10 @@
 #include <osg/Light>
 #include <osg/Quat>
 
+#include "misc/binaryreader.hpp"
+
 #include "components/vfs/manager.hpp"
+#include "components/resource/texturemanager.hpp"
 
 #include "render/renderer.hpp"
 #include "render/pipeline.hpp"
@@ -32,6 +35,19 @@ static const size_t InvalidHandle = ~static_cast<size_t>(0);
 
 static const std::array<char,6> gBlockIndexLabel{{ 'N', 'W', 'L', 'S', 'B', 'M' }};
 
+/* Logs how many of the textures used by the location being left were
+ * decoded, and starts counting anew for the next one.
+ */
+void report_texture_usage(const char *name)
+{
+    Resource::TextureManager &texmgr = Resource::TextureManager::get();
+    Resource::TextureUsageStats stats = texmgr.getUsageStats();
+    if(name && stats.mReferenced > 0)
+        DF::Log::get().stream(DF::Log::Level_Debug)<< "Leaving "<<name<<": "<<stats.mDecoded<<" of "<<
+            stats.mReferenced<<" textures decoded";
+    texmgr.resetUsageStats();
+}
+
 /* This is only stored temporarily */
 struct DungeonHeader {
     struct Offset {
@@ -43,57 +59,92 @@ struct DungeonHeader {
     uint32_t mDungeonCount;
     std::vector<Offset> mOffsets;
 
-    void load(std::istream &stream)
+    void load(Misc::BinaryReader &reader)
     {
-        mDungeonCount = VFS::read_le32(stream);
+        mDungeonCount = reader.readLE32();
 
         mOffsets.resize(mDungeonCount);
         for(Offset &offset : mOffsets)
         {
-            offset.mOffset = VFS::read_le32(stream);
-            offset.mIsDungeon = VFS::read_le16(stream);
-            offset.mExteriorLocationId = VFS::read_le16(stream);
+            offset.mOffset = reader.readLE32();
+            offset.mIsDungeon = reader.readLE16();
+            offset.mExteriorLocationId = reader.readLE16();
         }
     }
 };
 
+/* Reads the named files on the VFS I/O threads, handing each one to the
+ * parse function in order as soon as its data is in.
+ */
+template<typename F>
+void read_batch(const std::vector<std::string> &names, F&& parse)
+{
+    std::vector<VFS::BlobPtr> data(names.size());
+    std::vector<VFS::ReadRequest> requests;
+    requests.reserve(names.size());
+    for(size_t i = 0;i < names.size();++i)
+        requests.push_back(VFS::ReadRequest{names[i], 0, &data[i]});
+
+    std::vector<std::future<bool>> results = VFS::Manager::get().readBatch(requests);
+    try {
+        for(size_t i = 0;i < names.size();++i)
+        {
+            if(!results[i].get())
+                throw std::runtime_error("Failed to read "+names[i]);
+
+            Misc::BinaryReader reader(data[i]->data(), data[i]->size());
+            parse(i, reader);
+            data[i] = nullptr;
+        }
+    }
+    catch(...) {
+        // Reads still in flight write into data, so let them finish first.
+        for(std::future<bool> &result : results)
+        {
+            if(result.valid())
+                result.wait();
+        }
+        throw;
+    }
+}
+
 }
 
 namespace DF
 {
 
-void LocationHeader::load(std::istream &stream)
+void LocationHeader::load(Misc::BinaryReader &reader)
 {
-    mDoorCount = VFS::read_le32(stream);
+    mDoorCount = reader.readLE32();
 
     mDoors.resize(mDoorCount);
     for(auto &door : mDoors)
     {
-        door.mBuildingDataIndex = VFS::read_le16(stream);
-        door.mNullValue = stream.get();
-        door.mUnknownMask = stream.get();
-        door.mUnknown1 = stream.get();
-        door.mUnknown2 = stream.get();
+        door.mBuildingDataIndex = reader.readLE16();
+        door.mNullValue = reader.readU8();
+        door.mUnknownMask = reader.readU8();
+        door.mUnknown1 = reader.readU8();
+        door.mUnknown2 = reader.readU8();
     }
 
-    mAlwaysOne1 = VFS::read_le32(stream);
-    mNullValue1 = VFS::read_le16(stream);
-    mNullValue2 = stream.get();
-    mY = VFS::read_le32(stream);
-    mNullValue3 = VFS::read_le32(stream);
-    mX = VFS::read_le32(stream);
-    mIsExterior = VFS::read_le16(stream);
-    mNullValue4 = VFS::read_le16(stream);
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mAlwaysOne2 = VFS::read_le16(stream);
-    mLocationId = VFS::read_le16(stream);
-    mNullValue5 = VFS::read_le32(stream);
-    mIsInterior = VFS::read_le16(stream);
-    mExteriorLocationId = VFS::read_le32(stream);
-    stream.read(reinterpret_cast<char*>(mNullValue6), sizeof(mNullValue6));
-    stream.read(mLocationName, sizeof(mLocationName));
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
+    mAlwaysOne1 = reader.readLE32();
+    mNullValue1 = reader.readLE16();
+    mNullValue2 = reader.readU8();
+    mY = reader.readLE32();
+    mNullValue3 = reader.readLE32();
+    mX = reader.readLE32();
+    mIsExterior = reader.readLE16();
+    mNullValue4 = reader.readLE16();
+    mUnknown1 = reader.readLE32();
+    mUnknown2 = reader.readLE32();
+    mAlwaysOne2 = reader.readLE16();
+    mLocationId = reader.readLE16();
+    mNullValue5 = reader.readLE32();
+    mIsInterior = reader.readLE16();
+    mExteriorLocationId = reader.readLE32();
+    reader.readArray(mNullValue6);
+    reader.readArray(mLocationName);
+    reader.readArray(mUnknown3);
 }
 
 LogStream& operator<<(LogStream &stream, const LocationHeader &loc)
@@ -250,6 +301,7 @@ void World::initialize(osgViewer::Viewer *viewer, osg::Group *sceneroot)
     if(names.empty()) throw std::runtime_error("Failed to find any regions");
 
     VFS::IStreamPtr stream;
+    std::vector<uint8_t> data;
     for(const std::string &name : names)
     {
         size_t pos = name.rfind('.');
@@ -261,82 +313,87 @@ void World::initialize(osgViewer::Viewer *viewer, osg::Group *sceneroot)
         /* Get names */
         stream = VFS::Manager::get().open(name.c_str());
         if(!stream) throw std::runtime_error("Failed to open "+name);
+        data = VFS::read_all(*stream);
+        stream = nullptr;
 
-        uint32_t mapcount = VFS::read_le32(*stream);
+        Misc::BinaryReader names_reader(data.data(), data.size());
+        uint32_t mapcount = names_reader.readLE32();
         if(mapcount == 0) continue;
 
         MapRegion region;
         region.mNames.resize(mapcount);
         for(std::string &mapname : region.mNames)
         {
-            char mname[32];
-            if(!stream->read(mname, sizeof(mname)) || stream->gcount() != sizeof(mname))
-                throw std::runtime_error("Failed to read map names from "+name);
-            mapname.assign(mname, sizeof(mname));
+            const char *mname = reinterpret_cast<const char*>(names_reader.consume(32));
+            mapname.assign(mname, 32);
             size_t end = mapname.find('\0');
             if(end != std::string::npos)
                 mapname.resize(end);
         }
-        stream = nullptr;
 
         /* Get table data */
         std::string fname = "MAPTABLE."+regstr;
         stream = VFS::Manager::get().open(fname.c_str());
         if(!stream) throw std::runtime_error("Failed to open "+fname);
+        data = VFS::read_all(*stream);
+        stream = nullptr;
 
+        Misc::BinaryReader table_reader(data.data(), data.size());
         region.mTable.resize(region.mNames.size());
         for(MapTable &maptable : region.mTable)
         {
-            maptable.mMapId = VFS::read_le32(*stream);
-            maptable.mUnknown1 = stream->get();
-            maptable.mLongitudeType = VFS::read_le32(*stream);
-            maptable.mLatitude = VFS::read_le16(*stream);
-            maptable.mUnknown2 = VFS::read_le16(*stream);
-            maptable.mUnknown3 = VFS::read_le32(*stream);
+            maptable.mMapId = table_reader.readLE32();
+            maptable.mUnknown1 = table_reader.readU8();
+            maptable.mLongitudeType = table_reader.readLE32();
+            maptable.mLatitude = table_reader.readLE16();
+            maptable.mUnknown2 = table_reader.readLE16();
+            maptable.mUnknown3 = table_reader.readLE32();
         }
-        stream = nullptr;
 
         /* Get exterior data */
         fname = "MAPPITEM."+regstr;
         stream = VFS::Manager::get().open(fname.c_str());
         if(!stream) throw std::runtime_error("Failed to open "+fname);
+        data = VFS::read_all(*stream);
+        stream = nullptr;
 
+        Misc::BinaryReader ext_reader(data.data(), data.size());
         std::vector<uint32_t> extoffsets(region.mNames.size());
-        for(uint32_t &offset : extoffsets)
-            offset = VFS::read_le32(*stream);
-        std::streamoff extbase_offset = stream->tellg();
+        ext_reader.readArray(extoffsets.data(), extoffsets.size());
+        size_t extbase_offset = ext_reader.tell();
 
         uint32_t *extoffset = extoffsets.data();
         region.mExteriors.resize(extoffsets.size());
         for(ExteriorLocation &extinfo : region.mExteriors)
         {
-            stream->seekg(extbase_offset + *extoffset);
-            extinfo.load(*stream);
+            ext_reader.seek(extbase_offset + *extoffset);
+            extinfo.load(ext_reader);
             ++extoffset;
         }
-        stream = nullptr;
 
         /* Get dungeon data */
         fname = "MAPDITEM."+regstr;
         stream = VFS::Manager::get().open(fname.c_str());
         if(!stream) throw std::runtime_error("Failed to open "+fname);
+        data = VFS::read_all(*stream);
+        stream = nullptr;
 
+        Misc::BinaryReader dgn_reader(data.data(), data.size());
         DungeonHeader dheader;
-        dheader.load(*stream);
-        std::streamoff dbase_offset = stream->tellg();
+        dheader.load(dgn_reader);
+        size_t dbase_offset = dgn_reader.tell();
 
         DungeonHeader::Offset *doffset = dheader.mOffsets.data();
         region.mDungeons.resize(dheader.mDungeonCount);
         for(DungeonInterior &dinfo : region.mDungeons)
         {
-            stream->seekg(dbase_offset + doffset->mOffset);
-            dinfo.load(*stream);
+            dgn_reader.seek(dbase_offset + doffset->mOffset);
+            dinfo.load(dgn_reader);
             if(dinfo.mExteriorLocationId != doffset->mExteriorLocationId)
                 throw std::runtime_error("Dungeon exterior location id mismatch for "+std::string(dinfo.mLocationName)+": "+
                     std::to_string(dinfo.mExteriorLocationId)+" / "+std::to_string(doffset->mExteriorLocationId));
             ++doffset;
         }
-        stream = nullptr;
 
         if(regnum >= mRegions.size()) mRegions.resize(regnum+1);
         mRegions[regnum] = std::move(region);
@@ -362,12 +419,15 @@ void World::loadPakList(std::string&& fname, std::vector<PakArray> &paklist)
 {
     VFS::IStreamPtr stream = VFS::Manager::get().open(fname.c_str());
     if(!stream) throw std::runtime_error("Failed to open "+fname);
+    std::vector<uint8_t> data = VFS::read_all(*stream);
+    stream = nullptr;
 
+    Misc::BinaryReader reader(data.data(), data.size());
     size_t rownum = 0;
     std::map<size_t,size_t> offsets_rows;
-    offsets_rows[VFS::read_le32(*stream)] = rownum++;
-    while((size_t)stream->tellg() < offsets_rows.begin()->first)
-        offsets_rows[VFS::read_le32(*stream)] = rownum++;
+    offsets_rows[reader.readLE32()] = rownum++;
+    while(reader.tell() < offsets_rows.begin()->first)
+        offsets_rows[reader.readLE32()] = rownum++;
 
     auto iter = offsets_rows.begin();
     while(iter != offsets_rows.end())
@@ -375,11 +435,11 @@ void World::loadPakList(std::string&& fname, std::vector<PakArray> &paklist)
         auto next = std::next(iter);
 
         PakArray pak;
-        while((next != offsets_rows.end() && (size_t)stream->tellg() < next->first) ||
-              (next == offsets_rows.end() && stream->peek() != std::istream::traits_type::eof()))
+        while((next != offsets_rows.end() && reader.tell() < next->first) ||
+              (next == offsets_rows.end() && !reader.eof()))
         {
-            uint16_t count = VFS::read_le16(*stream);
-            uint8_t val = stream->get();
+            uint16_t count = reader.readLE16();
+            uint8_t val = reader.readU8();
             pak.push_back(std::make_pair(count, val));
         }
 
@@ -432,6 +492,8 @@ void World::loadExterior(int regnum, int extid)
     const MapRegion &region = mRegions.at(regnum);
     const ExteriorLocation &extloc = region.mExteriors.at(extid);
 
+    report_texture_usage(mCurrentDungeon ? mCurrentDungeon->mLocationName :
+                       mCurrentExterior ? mCurrentExterior->mLocationName : nullptr);
     mExterior.clear();
     mDungeon.clear();
     mCurrentRegion = &region;
@@ -439,12 +501,14 @@ void World::loadExterior(int regnum, int extid)
     mCurrentDungeon = nullptr;
     mCurrentSelection = InvalidHandle;
 
+    size_t fscalls = VFS::Manager::get().getFsCallCount();
     uint8_t climate = getClimateValue(extloc.mX, extloc.mY);
     Log::get().stream()<< "Climate "<<(int)climate;
 
     Log::get().stream()<< "Entering "<<extloc.mLocationName;
     size_t count = extloc.mWidth * extloc.mHeight;
-    mExterior.reserve(count);
+    std::vector<std::string> names;
+    names.reserve(count);
     for(size_t i = 0;i < count;++i)
     {
         std::string name = extloc.getMapBlockName(i, regnum);
@@ -457,13 +521,17 @@ void World::loadExterior(int regnum, int extid)
             if(list.empty()) name.clear();
             else name = *list.begin();
         }
+        names.push_back(std::move(name));
+    }
 
-        VFS::IStreamPtr stream = VFS::Manager::get().open(name.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+name);
-
+    mExterior.reserve(count);
+    read_batch(names, [this](size_t i, Misc::BinaryReader &reader)
+    {
         mExterior.push_back(std::unique_ptr<MBlockHeader>(new MBlockHeader()));
-        mExterior.back()->load(*stream, i<<24);
-    }
+        mExterior.back()->load(reader, i<<24);
+    });
+    Log::get().stream(Log::Level_Debug)<< "Loaded "<<mExterior.size()<<" blocks with "<<
+        (VFS::Manager::get().getFsCallCount()-fscalls)<<" filesystem calls";
 
     size_t startobj = InvalidHandle;
     for(size_t i = 0;i < mExterior.size();++i)
@@ -505,6 +573,8 @@ void World::loadDungeonByExterior(int regnum, int extid)
         if(extloc.mLocationId != dinfo.mExteriorLocationId)
             continue;
 
+        report_texture_usage(mCurrentDungeon ? mCurrentDungeon->mLocationName :
+                           mCurrentExterior ? mCurrentExterior->mLocationName : nullptr);
         mExterior.clear();
         mDungeon.clear();
         mCurrentRegion = &region;
@@ -512,24 +582,30 @@ void World::loadDungeonByExterior(int regnum, int extid)
         mCurrentDungeon = &dinfo;
         mCurrentSelection = InvalidHandle;
 
+        size_t fscalls = VFS::Manager::get().getFsCallCount();
         uint8_t climate = getClimateValue(extloc.mX, extloc.mY);
         Log::get().stream()<< "Climate "<<(int)climate;
 
         Log::get().stream()<< "Entering "<<dinfo.mLocationName;
-        mDungeon.reserve(dinfo.mBlocks.size());
+        std::vector<std::string> names;
+        names.reserve(dinfo.mBlocks.size());
         for(const DungeonBlock &block : dinfo.mBlocks)
         {
             std::stringstream sstr;
             sstr<< std::setfill('0')<<std::setw(8)<< block.mBlockIdx<<".RDB";
             std::string name = sstr.str();
             name.front() = gBlockIndexLabel.at(block.mBlockPreIndex);
+            names.push_back(std::move(name));
+        }
 
-            VFS::IStreamPtr stream = VFS::Manager::get().open(name.c_str());
-            if(!stream) throw std::runtime_error("Failed to open "+name);
-
+        mDungeon.reserve(dinfo.mBlocks.size());
+        read_batch(names, [this](size_t i, Misc::BinaryReader &reader)
+        {
             mDungeon.push_back(std::unique_ptr<DBlockHeader>(new DBlockHeader()));
-            mDungeon.back()->load(*stream, std::distance(dinfo.mBlocks.data(), &block)<<24);
-        }
+            mDungeon.back()->load(reader, i<<24);
+        });
+        Log::get().stream(Log::Level_Debug)<< "Loaded "<<mDungeon.size()<<" blocks with "<<
+            (VFS::Manager::get().getFsCallCount()-fscalls)<<" filesystem calls";
 
         for(size_t i = 0;i < mDungeon.size();++i)
         {